@@ -27,16 +27,47 @@ enum libsdod_log_level {
 };
 
 
+enum libsdod_backend {
+   LIBSDOD_BACKEND_GPU,
+   LIBSDOD_BACKEND_HTP,
+   LIBSDOD_BACKEND_CPU
+};
+
+
+enum libsdod_decoder {
+   LIBSDOD_DECODER_FULL,
+   LIBSDOD_DECODER_FAST
+};
+
+
+enum libsdod_guidance_policy {
+   LIBSDOD_GUIDANCE_FULL,
+   LIBSDOD_GUIDANCE_TRUNCATED,
+   LIBSDOD_GUIDANCE_INTERVAL,
+   LIBSDOD_GUIDANCE_REUSE_UNCOND
+};
+
+
+enum libsdod_step_skipping {
+   LIBSDOD_SKIP_REUSE,
+   LIBSDOD_SKIP_EXTRAPOLATE
+};
+
+
 /* Prepare models and devices to run image generation.
 
    context - will return prepared context (type void*) there, should not be nullptr
-   models_dir - directory holding models to load, should include "decoder.bin", "cond.bin", "sd_unet_inputs.bin", "sd_unet_middle", "sd_unet_outputs.bin", "sd_unet_head.bin"
+   models_dir - directory holding models to load, should include "text_encoder.serialized", "temb", "vae_decoder.serialized" and the UNet:
+      either "unet.serialized" or its partitions "unet_inputs.serialized", "unet_middle.serialized" and "unet_outputs.serialized"
+      (used if present, see set_feature_cache), which are executed one after another: inputs of the later partitions are bound
+      to the UNet input (x, t, p) or the output of an earlier partition with the same name, the last one produces the UNet output
    latent_channels - latent representation channels, SD1.5 uses 4
    latent_spatial - latent representation spatial dimensions, SD1.5 uses 64
    upscale_factor - upscaling factor for the decoder, SD1.5 uses 8
    steps - number of denoising steps to perform when generating an image, can be later overwritten with libsdod_set_steps
    log_level - logging level, can be later overwritten with libsdod_set_log_level
-   use_htp - whether to use HTP or GPU
+   backend - QNN backend to use, see libsdod_backend; for backward compatibility 1 selects HTP and 0 selects GPU,
+      HTP loads serialized contexts ("<name>.bin"), other backends load model libraries ("<name>.so")
 
    Returns 0 if successful, otherwise an error code is returned.
    If successful, *context will be pointer to a prepared context that should be passed to other functions and cleaned when no longer needed, see release.
@@ -44,13 +75,15 @@ enum libsdod_log_level {
    by a call to ``release``, it should also be used when querying for error details; it should not be, however, used to generate images.
    If a method fails before a context object is created, *context will be nullptr.
 */
-LIBSDOD_API int libsdod_setup(void** context, const char* models_dir, unsigned int latent_channels, unsigned int latent_spatial, unsigned int upscale_factor, unsigned int steps, unsigned int log_level, int use_htp);
+LIBSDOD_API int libsdod_setup(void** context, const char* models_dir, unsigned int latent_channels, unsigned int latent_spatial, unsigned int upscale_factor, unsigned int steps, unsigned int log_level, int backend);
 
 
 /* Changes the number of denoising steps performed when generating images using the provided context.
 
    context - a previously prepared context obtained by a call to setup
-   unsigned int steps - new number of denoising steps
+   unsigned int steps - new number of denoising steps, between 1 and 1000
+
+   Schedules of a few recently used step counts are kept, switching back to one of them does not recompute anything.
    
    Returns 0 if successful, otherwise an error code is returned.
 */
@@ -67,6 +100,139 @@ LIBSDOD_API int libsdod_set_steps(void* context, unsigned int steps);
 LIBSDOD_API int libsdod_set_log_level(void* context, unsigned int log_level);
 
 
+/* Selects the decoder used to turn latents into images by the provided context, see libsdod_decoder.
+
+   context - a previously prepared context obtained by a call to setup
+   decoder - LIBSDOD_DECODER_FULL (default) uses the model's VAE decoder ("vae_decoder.serialized"), LIBSDOD_DECODER_FAST uses
+      a tiny autoencoder decoder (TAESD, "taesd_decoder.serialized"), which is much cheaper to run but produces less detailed
+      images, e.g. for previews and thumbnails; the latter is optional, if it was not found in models_dir during setup
+      the full decoder is used instead (get_stats reports "generate.fast_decoder" as 0 in that case)
+
+   The tiny decoder has to take the same latents and produce images in the same range as the full one.
+   The selected decoder is used by all subsequent calls to generate_image, generate_images and decode_latent.
+
+   Returns 0 if successful, otherwise an error code is returned.
+*/
+LIBSDOD_API int libsdod_set_decoder(void* context, int decoder);
+
+
+/* Selects how classifier-free guidance is applied by the provided context, see libsdod_guidance_policy.
+
+   context - a previously prepared context obtained by a call to setup
+   policy - LIBSDOD_GUIDANCE_FULL (default) guides all steps, LIBSDOD_GUIDANCE_TRUNCATED guides only the steps before ``end``,
+      LIBSDOD_GUIDANCE_INTERVAL only the steps between ``start`` and ``end``, LIBSDOD_GUIDANCE_REUSE_UNCOND guides all steps but
+      computes the unconditional prediction only every ``uncond_interval`` steps, reusing the last one in between
+   start, end - fractions of the steps of the schedule (0 - first step, 1 - after the last one), only used by the policies above
+   uncond_interval - at least 1, only used by LIBSDOD_GUIDANCE_REUSE_UNCOND
+
+   Steps without guidance run only the conditional UNet pass, as with guidance_scale 1; this trades a little quality
+   for fewer UNet executions, get_stats reports how many were saved by the last generation as "generate.guidance_skipped_unet_executions".
+   If the UNet has been compiled with batch 2 (both passes in a single execution), the policy affects guidance but saves no executions.
+   The policy is used by all subsequent calls to generate_image(s) and generate_latents.
+
+   Returns 0 if successful, otherwise an error code is returned.
+*/
+LIBSDOD_API int libsdod_set_guidance_policy(void* context, int policy, float start, float end, unsigned int uncond_interval);
+
+
+/* Sets the seed of the initial noise of images generated using the provided context.
+
+   context - a previously prepared context obtained by a call to setup
+   seed - new seed, until it is set for the first time a random one is used
+
+   Initial noise of the n-th image generated after this call (counting all calls which generate images or latents) is a function
+   of the seed and n only, so the results do not depend on how the images are split between calls, e.g. generating
+   a batch of images with generate_images gives the same images as generating them one by one with generate_image.
+
+   Returns 0 if successful, otherwise an error code is returned.
+*/
+LIBSDOD_API int libsdod_set_seed(void* context, unsigned int seed);
+
+
+/* Selects steps of the schedule which are made without executing the UNet by the provided context.
+
+   context - a previously prepared context obtained by a call to setup
+   mode - LIBSDOD_SKIP_REUSE makes a skipped step with the denoised latent predicted by the previous one, LIBSDOD_SKIP_EXTRAPOLATE
+      extrapolates it linearly from the predictions of the two previous steps (falling back to the former if there is only one)
+   steps - array of ``num_steps`` indices of the steps to skip (0 - first step), in any order; indices beyond the current
+      number of steps are ignored, as is the first step made by an image (which has nothing to reuse)
+   num_steps - number of skipped steps, 0 disables skipping (default)
+
+   Skipping trades quality for latency without requiring any other models, see calibrate_step_skipping to choose the steps.
+   The number of skipped steps is reported by get_stats as "generate.skipped_steps".
+
+   Returns 0 if successful, otherwise an error code is returned.
+*/
+LIBSDOD_API int libsdod_set_step_skipping(void* context, int mode, const unsigned int* steps, unsigned int num_steps);
+
+
+/* Measures how much skipping each step of the schedule (see set_step_skipping) changes the results, to help choosing the steps to skip.
+
+   context - a previously prepared context obtained by a call to setup
+   prompts, num_prompts, guidance_scale - as in generate_images, should be representative of the actual use
+   mode - see set_step_skipping
+   deviations - array of at least ``num_deviations`` elements, deviations[i] will hold the relative L2 distance between the final latents
+      generated with only the i-th step skipped and the ones generated without skipping (infinity for the first step, which cannot be skipped)
+   num_deviations - size of ``deviations``, has to be at least the current number of steps
+
+   Generates (number of steps) * num_prompts images' latents, all starting from the same noise as the next call to generate_images would.
+   Does not affect the seed or the currently selected steps to skip.
+
+   Returns 0 if successful, otherwise an error code is returned.
+*/
+LIBSDOD_API int libsdod_calibrate_step_skipping(void* context, const char* const* prompts, unsigned int num_prompts, float guidance_scale, int mode, float* deviations, unsigned int num_deviations);
+
+
+/* Selects how often the middle partition of a partitioned UNet is executed by the provided context (DeepCache).
+
+   context - a previously prepared context obtained by a call to setup
+   interval - 1 (default) executes all partitions on every step, N > 1 executes the middle (deep, most expensive) partition
+      only on the first step made by each image and then once its last outputs are N steps old, other steps reuse them and execute only
+      the shallow input and output partitions; values above 1 require a partitioned UNet (see setup)
+
+   Each guidance pass keeps its own outputs, the number of reused ones is reported by get_stats as "generate.feature_cache_hits".
+   Trades quality for latency, like set_step_skipping the two can be combined.
+
+   Returns 0 if successful, otherwise an error code is returned.
+*/
+LIBSDOD_API int libsdod_set_feature_cache(void* context, unsigned int interval);
+
+
+/* Lets the provided context stop denoising of an image early, once its results have converged.
+
+   context - a previously prepared context obtained by a call to setup
+   threshold - after each step which executes the UNet, the relative L2 distance between the solver's data predictions (estimates
+      of the final latent) made by this step and the previous one is compared with the threshold; 0 (default) disables early stopping
+   patience - number of consecutive steps which have to stay below the threshold, at least 1
+
+   Once the criterion is met, the remaining steps of the image are not made and its latest data prediction is decoded instead.
+   Steps saved by the last generation are reported by get_stats as "generate.early_stopped_steps" (and are not included in "generate.steps").
+
+   Returns 0 if successful, otherwise an error code is returned.
+*/
+LIBSDOD_API int libsdod_set_early_stopping(void* context, float threshold, unsigned int patience);
+
+
+/* Lets the provided context choose the number of steps of each generation so that it fits into a latency budget.
+
+   context - a previously prepared context obtained by a call to setup
+   budget_ms - target latency of a single call generating images (or latents), 0 (default) disables the budget and the number of steps
+      set by setup (or prepare_schedule) is used again
+   min_steps, max_steps - range of steps to choose from, within [1, 1000]
+
+   The context keeps running averages of the measured cost of UNet executions, host-side solver updates and the rest of a call
+   (tokenization, text encoding and decoding with each decoder), updated after every successful generation so that they follow
+   changes in load or thermal state. Each call then makes the largest number of steps predicted to fit; if even min_steps does
+   not fit with the current guidance policy, the unconditional pass is only run for the first half of the steps of that call.
+   Until the first generation has been measured, max_steps are made. The decision is reported by get_stats as "generate.budget_steps",
+   "generate.budget_predicted_ms" and "generate.budget_truncated_guidance", the time by which the budget was exceeded
+   as "generate.budget_overrun_ms".
+
+   Returns 0 if successful, otherwise an error code is returned.
+*/
+LIBSDOD_API int libsdod_set_latency_budget(void* context, float budget_ms, unsigned int min_steps, unsigned int max_steps);
+
+
 /* Increase reference counter for a given context.
 
    For each additional call to ref_context, an additional call to release has to be made before
@@ -117,6 +283,185 @@ LIBSDOD_API int libsdod_release(void* context);
 LIBSDOD_API int libsdod_generate_image(void* context, const char* prompt, float guidance_scale, unsigned char** image_out, unsigned int* image_buffer_size);
 
 
+/* Run diffusion processes for several prompts.
+
+   context - a previously prepared context obtained by a call to setup
+   prompts - an array of ``num_prompts`` null-terminated, UTF8-encoded user prompts, one image is generated for each of them
+   num_prompts - number of prompts, has to be at least 1
+   guidance_scale - scaling factor for the classifier-free guidance, see generate_image
+   images_out - output buffer that will hold the resulting RGB images, one after another, each stored as described in generate_image
+   images_buffer_size - size of ``images_out``, memory is handled in the same way as by generate_image
+
+   Prompts are processed by a pipeline of stages (tokenization, text encoding, denoising, decoding, output conversion),
+   each running in its own thread, so that e.g. text encoding and decoding of other images overlap with the denoising loop.
+   Images which reach the denoising stage at the same time are denoised in pairs, the UNet executions of one image are
+   interleaved with the other's, so that host-side processing of one overlaps with the accelerator working on the other.
+   With the same seed, the results are the same as when calling generate_image for each prompt in order.
+   Occupancy of each stage and depths of the queues between them are reported by get_stats as "generate.pipeline.*".
+
+   Returns 0 if successful, otherwise an error code is returned.
+*/
+LIBSDOD_API int libsdod_generate_images(void* context, const char* const* prompts, unsigned int num_prompts, float guidance_scale, unsigned char** images_out, unsigned int* images_buffer_size);
+
+
+/* Run diffusion processes for several prompts, each starting from an existing image rather than from pure noise (image to image).
+
+   context - a previously prepared context obtained by a call to setup
+   prompts, num_prompts, guidance_scale - see generate_images
+   init_images - an array of ``num_prompts`` RGB images, one for each prompt, each stored as described in generate_image (and of the same size as the output)
+   strength - how much the initial images are changed, in range (0, 1]: images are encoded to latents and noised to the point of the schedule
+      at which only ``strength * steps`` (rounded down) denoising steps remain, e.g. with 20 steps and strength 0.4 only 8 steps are run;
+      values close to 1 give images almost unrelated to the initial ones
+   images_out, images_buffer_size - see generate_images
+
+   Requires the VAE encoder ("vae_encoder.serialized") in models_dir, which has to take pixels as values in range [0, 1] and
+   produce latents in the same format as taken by the decoder; if it was not found during setup, an error is returned.
+
+   Returns 0 if successful, otherwise an error code is returned.
+*/
+LIBSDOD_API int libsdod_generate_images_from(void* context, const char* const* prompts, const unsigned char* const* init_images, unsigned int num_prompts, float strength, float guidance_scale, unsigned char** images_out, unsigned int* images_buffer_size);
+
+
+/* Run diffusion processes for several prompts but stop after denoising, returning the final latents instead of images.
+
+   context - a previously prepared context obtained by a call to setup
+   prompts, num_prompts, guidance_scale - see generate_images
+   latents_out - output buffer that will hold the resulting latents, one after another, each holding latent_spatial x latent_spatial x latent_channels
+      floats in [H, W, C] order (e.g. 64 x 64 x 4 for SD1.5)
+   latents_buffer_size - size of ``latents_out`` in floats, memory is handled in the same way as by generate_image
+
+   Latents can be later decoded with decode_latents, e.g. to generate many candidates and decode only the selected ones,
+   or to decode latents produced by several calls at once. With the same seed, decoding the returned latents gives the same images
+   as generate_images.
+
+   Returns 0 if successful, otherwise an error code is returned.
+*/
+LIBSDOD_API int libsdod_generate_latents(void* context, const char* const* prompts, unsigned int num_prompts, float guidance_scale, float** latents_out, unsigned int* latents_buffer_size);
+
+
+/* Decode latents previously returned by generate_latents to RGB images.
+
+   context - a previously prepared context obtained by a call to setup
+   latents - an array of ``num_latents`` pointers, each to a single latent stored as returned by generate_latents
+   num_latents - number of latents, has to be at least 1
+   images_out - output buffer that will hold the resulting RGB images, one after another in the order of ``latents``, each stored as described in generate_image
+   images_buffer_size - size of ``images_out``, memory is handled in the same way as by generate_image
+
+   If the decoder was compiled with batch > 1, that many latents are decoded by a single execution.
+
+   Returns 0 if successful, otherwise an error code is returned.
+*/
+LIBSDOD_API int libsdod_decode_latents(void* context, const float* const* latents, unsigned int num_latents, unsigned char** images_out, unsigned int* images_buffer_size);
+
+
+/* Decode a latent to an RGB image, the latent can be larger than the one the decoder was compiled for.
+
+   context - a previously prepared context obtained by a call to setup
+   latent - ``latent_height`` x ``latent_width`` x 4 floats, in HWC order
+   latent_height, latent_width - size of the latent, each has to be at least the latent size of the models (e.g. 64 for 512x512 images)
+   image_out - output buffer that will hold the resulting RGB image of (latent_height * 8) x (latent_width * 8) pixels, stored as described in generate_image
+   image_buffer_size - size of ``image_out``, memory is handled in the same way as by generate_image
+
+   Latents larger than the decoder's input are split into tiles of the decoder's input size, overlapping by at least 8 latent pixels,
+   and decoded tile by tile (several tiles at once if the decoder was compiled with batch > 1). Tiles are blended linearly across
+   the overlapping regions to hide seams, and only a single row of tiles is kept on the host at any time.
+   The number of decoded tiles is reported by get_stats as "generate.decoder_tiles".
+
+   Returns 0 if successful, otherwise an error code is returned.
+*/
+LIBSDOD_API int libsdod_decode_latent(void* context, const float* latent, unsigned int latent_height, unsigned int latent_width, unsigned char** image_out, unsigned int* image_buffer_size);
+
+
+/* Return measurements recorded by the provided context.
+
+   context - a previously prepared context obtained by a call to setup
+   names - will point to an array of ``count`` null-terminated measurement names
+   values - will point to an array of ``count`` measured values
+   count - will hold the number of measurements
+
+   Measurements recorded while setting up the context are prefixed with "setup." and are followed by measurements
+   recorded during the most recent image generation, prefixed with "generate.". Names ending with "_ms" hold
+   times in milliseconds, other values are counters. The same name can appear more than once, e.g., "generate.step_ms"
+   is recorded once per denoising step (when images are generated in pairs, a step of both images is measured at once).
+
+   Both arrays are owned by the context and remain valid until the next call to any function using the same context.
+
+   Returns 0 if successful, otherwise an error code is returned.
+*/
+LIBSDOD_API int libsdod_get_stats(void* context, const char* const** names, const double** values, unsigned int* count);
+
+
+/* Start recording inputs and outputs of all model executions performed by the provided context to a trace file.
+
+   context - a previously prepared context obtained by a call to setup
+   trace_path - a null-terminated path of the trace file, an existing file will be overwritten
+
+   Each subsequent execution of a model (text encoder, each conditional and unconditional UNet pass, decoder)
+   is appended to the trace, together with the data of all its inputs and outputs, until ``stop_recording`` is called
+   or the context is released. Recording slows down image generation. Traces can be inspected and replayed with
+   the ``replay_trace`` tool.
+
+   Returns 0 if successful, otherwise an error code is returned.
+*/
+LIBSDOD_API int libsdod_start_recording(void* context, const char* trace_path);
+
+
+/* Stop recording started with ``start_recording`` and close the trace file. Does nothing if recording is not active.
+
+   Returns 0 if successful, otherwise an error code is returned.
+*/
+LIBSDOD_API int libsdod_stop_recording(void* context);
+
+
+/* Start gathering statistics of inputs and outputs of all model executions performed by the provided context,
+   to be used when quantizing the models.
+
+   context - a previously prepared context obtained by a call to setup
+
+   For each floating-point input and output of each model, min/max and a histogram of values is accumulated
+   over all subsequent executions (i.e., generate images for a representative set of prompts after calling this function),
+   until ``stop_calibration`` is called or the context is released. Statistics can be saved at any point
+   with ``save_calibration``. Calling this function again discards previously gathered statistics.
+   Calibration should be done with models using floating-point activations (e.g. converted with ``todlc.py --fp16``),
+   otherwise values are limited to the ranges of the existing quantization encodings.
+
+   Returns 0 if successful, otherwise an error code is returned.
+*/
+LIBSDOD_API int libsdod_start_calibration(void* context);
+
+
+/* Save statistics gathered since ``start_calibration`` was called.
+
+   context - a previously prepared context obtained by a call to setup
+   output_dir - a null-terminated path of a directory to store the results in, created if it does not exist
+   bitwidth - bitwidth of the quantized activations, usually 8 or 16
+   percentile - percentage of values which should be representable, e.g. 99.99 to ignore outliers;
+                100 uses the whole observed range
+
+   Two files are written for each model: ``<model>.encodings.json`` holds activation encodings in the format
+   accepted by the QNN converters (``--quantization_overrides``, see ``todlc.py --encodings``) and ``<model>.histograms.json``
+   holds raw histograms of all tensors.
+   Encodings are keyed by the names of the tensors in the QNN graphs, which the converter derives from the names of the inputs
+   and outputs of the source model (replacing characters other than letters, digits and underscores); ``todlc.py --encodings``
+   maps them back to the source names and skips (with a warning) the ones which do not match any input or output.
+
+   Returns 0 if successful, otherwise an error code is returned.
+*/
+LIBSDOD_API int libsdod_save_calibration(void* context, const char* output_dir, unsigned int bitwidth, float percentile);
+
+
+/* Stop gathering statistics started with ``start_calibration`` and discard them. Does nothing if calibration is not active.
+
+   Returns 0 if successful, otherwise an error code is returned.
+*/
+LIBSDOD_API int libsdod_stop_calibration(void* context);
+
+
+/* Return a null-terminated string holding the version of the library, e.g. "1.0.0".
+*/
+LIBSDOD_API const char* libsdod_get_version();
+
+
 /* Return a human-readable null-terminated string describing a returned error code.
 
    The method can return nullptr if ``errorcode`` is not a valid error code.
@@ -42,3 +42,18 @@ LOCAL_SRC_FILES                := $(subst make/,,$(MY_SRC_FILES))
 LOCAL_LDLIBS                   := -lGLESv2 -lEGL
 LOCAL_SHARED_LIBRARIES         := libsdod
 include $(BUILD_EXECUTABLE)
+
+include $(CLEAR_VARS)
+LOCAL_C_INCLUDES               := -I $(LOCAL_PATH)/../api/
+MY_SRC_FILES                   := $(LOCAL_PATH)/../test/bench_generate.cpp
+LOCAL_MODULE                   := bench_generate
+LOCAL_SRC_FILES                := $(subst make/,,$(MY_SRC_FILES))
+LOCAL_SHARED_LIBRARIES         := libsdod
+include $(BUILD_EXECUTABLE)
+
+include $(CLEAR_VARS)
+LOCAL_C_INCLUDES               := $(PACKAGE_C_INCLUDES)
+MY_SRC_FILES                   := $(LOCAL_PATH)/../test/replay_trace.cpp $(addprefix $(LOCAL_PATH)/../src/,trace.cpp qnn_context.cpp logging.cpp utils.cpp errors.cpp)
+LOCAL_MODULE                   := replay_trace
+LOCAL_SRC_FILES                := $(subst make/,,$(MY_SRC_FILES))
+include $(BUILD_EXECUTABLE)
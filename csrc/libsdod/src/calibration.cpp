@@ -0,0 +1,231 @@
+#include "calibration.h"
+#include "qnn_context.h"
+#include "conversions.h"
+#include "errors.h"
+#include "logging.h"
+
+#include <cmath>
+#include <limits>
+#include <fstream>
+#include <iomanip>
+#include <algorithm>
+#include <filesystem>
+
+using namespace libsdod;
+
+
+namespace {
+
+std::string _json_str(std::string const& s) {
+    std::string ret = "\"";
+    for (auto c : s) {
+        if (c == '"' || c == '\\')
+            ret.push_back('\\');
+        ret.push_back(c);
+    }
+    ret.push_back('"');
+    return ret;
+}
+
+
+std::ofstream _open(std::filesystem::path const& path) {
+    std::ofstream out{ path, std::ios::trunc };
+    if (!out)
+        throw libsdod_exception(ErrorCode::INVALID_ARGUMENT, format("Could not open file for writing: {}", path.string()), __func__, __FILE__, STR(__LINE__));
+    out << std::setprecision(std::numeric_limits<float>::max_digits10);
+    return out;
+}
+
+}
+
+
+Histogram::Histogram(unsigned int num_bins) : bins(std::max(2u, num_bins + num_bins % 2), 0) {
+}
+
+
+void Histogram::add(const float* values, std::size_t elements) {
+    double batch_min = std::numeric_limits<double>::infinity();
+    double batch_max = -std::numeric_limits<double>::infinity();
+    for (auto i : range(elements)) {
+        if (!std::isfinite(values[i]))
+            continue;
+        batch_min = std::min<double>(batch_min, values[i]);
+        batch_max = std::max<double>(batch_max, values[i]);
+    }
+    if (batch_min > batch_max)
+        return;
+
+    auto n = bins.size();
+    if (!count) {
+        lo = batch_min;
+        width = (batch_max - batch_min) / n;
+        if (width <= 0.0)
+            width = std::max(std::abs(batch_min), 1.0) * 1e-6;
+        min = batch_min;
+        max = batch_max;
+    } else {
+        while (batch_min < lo)
+            _grow(batch_min);
+        while (batch_max > lo + width * n)
+            _grow(batch_max);
+        min = std::min(min, batch_min);
+        max = std::max(max, batch_max);
+    }
+
+    for (auto i : range(elements)) {
+        if (!std::isfinite(values[i]))
+            continue;
+        auto idx = static_cast<std::size_t>((values[i] - lo) / width);
+        ++bins[std::min(idx, n - 1)];
+        ++count;
+    }
+}
+
+
+std::pair<double, double> Histogram::get_range(double percentile) const {
+    if (!count || percentile >= 100.0)
+        return { min, max };
+
+    auto tail = static_cast<uint64_t>(count * (100.0 - std::max(percentile, 0.0)) / 200.0);
+    auto n = bins.size();
+    uint64_t acc = 0;
+    std::size_t lower = 0;
+    while (lower < n && acc + bins[lower] <= tail)
+        acc += bins[lower++];
+    acc = 0;
+    std::size_t upper = n;
+    while (upper > lower + 1 && acc + bins[upper - 1] <= tail)
+        acc += bins[--upper];
+
+    return { std::max(min, lo + lower * width), std::min(max, lo + upper * width) };
+}
+
+
+// doubles the covered range towards ``value``, each new bin is the sum of two neighbouring old bins
+void Histogram::_grow(double value) {
+    auto n = bins.size();
+    std::vector<uint64_t> merged(n, 0);
+    bool downwards = (value < lo);
+    for (auto i : range(n))
+        merged[(downwards ? n / 2 : 0) + i / 2] += bins[i];
+    if (downwards)
+        lo -= width * n;
+    width *= 2;
+    bins.swap(merged);
+}
+
+
+Encoding Encoding::from_range(double min, double max, unsigned int bitwidth) {
+    if (bitwidth < 1 || bitwidth > 16)
+        throw libsdod_exception(ErrorCode::INVALID_ARGUMENT, format("Unsupported bitwidth: {}", bitwidth), __func__, __FILE__, STR(__LINE__));
+
+    // zero has to be exactly representable
+    min = std::min(min, 0.0);
+    max = std::max(max, 0.0);
+    if (max - min < 1e-8)
+        max = min + 1e-8;
+
+    double levels = double((1u << bitwidth) - 1);
+    double scale = (max - min) / levels;
+    auto offset = static_cast<int32_t>(std::round(min / scale));
+    return Encoding{ .bitwidth = bitwidth, .min = offset * scale, .max = (offset + levels) * scale, .scale = scale, .offset = offset };
+}
+
+
+Calibrator::Calibrator(unsigned int num_bins) : num_bins(num_bins) {
+}
+
+
+void Calibrator::on_execution(std::string const& graph, std::vector<TraceTensor> const& inputs, std::vector<TraceTensor> const& outputs, double exec_ms) {
+    (void)exec_ms;
+    auto&& _guard = std::lock_guard<std::mutex>{ mutex };
+    (void)_guard;
+
+    auto&& stats = graphs[graph];
+    for (auto&& t : inputs)
+        _observe(stats, t);
+    for (auto&& t : outputs)
+        _observe(stats, t);
+    ++stats.executions;
+}
+
+
+void Calibrator::_observe(GraphStats& stats, TraceTensor const& t) {
+    auto&& desc = t.get_desc();
+    if (!QnnTensor::is_floating_point(desc) || t.data.empty())
+        return;
+
+    auto elements = t.data.size() / QnnTensor::get_element_size(desc);
+    tmp.resize(elements);
+    qnn2host<false, false>(t.data.data(), tmp.data(), elements, desc, 0.0f);
+    stats.tensors.try_emplace(t.name, num_bins).first->second.add(tmp.data(), elements);
+}
+
+
+uint64_t Calibrator::get_num_executions() const {
+    auto&& _guard = std::lock_guard<std::mutex>{ mutex };
+    (void)_guard;
+
+    uint64_t ret = 0;
+    for (auto&& g : graphs)
+        ret += g.second.executions;
+    return ret;
+}
+
+
+void Calibrator::save(std::string const& output_dir, unsigned int bitwidth, double percentile) const {
+    auto&& _guard = std::lock_guard<std::mutex>{ mutex };
+    (void)_guard;
+
+    std::filesystem::path dir{ output_dir };
+    std::error_code ec;
+    std::filesystem::create_directories(dir, ec);
+    if (ec)
+        throw libsdod_exception(ErrorCode::INVALID_ARGUMENT, format("Could not create directory {}: {}", output_dir, ec.message()), __func__, __FILE__, STR(__LINE__));
+
+    for (auto&& [graph, stats] : graphs) {
+        auto&& enc_out = _open(dir / (graph + ".encodings.json"));
+        enc_out << "{" << std::endl << "  \"activation_encodings\": {";
+        bool first = true;
+        for (auto&& [name, hist] : stats.tensors) {
+            auto&& [min, max] = hist.get_range(percentile);
+            auto&& enc = Encoding::from_range(min, max, bitwidth);
+            enc_out << (first ? "" : ",") << std::endl << "    " << _json_str(name) << ": [ { "
+                << "\"bitwidth\": " << enc.bitwidth
+                << ", \"dtype\": \"int\""
+                << ", \"is_symmetric\": \"False\""
+                << ", \"min\": " << enc.min
+                << ", \"max\": " << enc.max
+                << ", \"scale\": " << enc.scale
+                << ", \"offset\": " << enc.offset
+                << " } ]";
+            first = false;
+        }
+        enc_out << std::endl << "  }," << std::endl << "  \"param_encodings\": {}" << std::endl << "}" << std::endl;
+
+        auto&& hist_out = _open(dir / (graph + ".histograms.json"));
+        hist_out << "{" << std::endl << "  \"executions\": " << stats.executions << "," << std::endl << "  \"tensors\": {";
+        first = true;
+        for (auto&& [name, hist] : stats.tensors) {
+            hist_out << (first ? "" : ",") << std::endl << "    " << _json_str(name) << ": { "
+                << "\"count\": " << hist.get_count()
+                << ", \"min\": " << hist.get_min()
+                << ", \"max\": " << hist.get_max()
+                << ", \"bins_min\": " << hist.get_bins_min()
+                << ", \"bins_max\": " << hist.get_bins_max()
+                << ", \"bins\": [";
+            bool first_bin = true;
+            for (auto b : hist.get_bins()) {
+                hist_out << (first_bin ? "" : ", ") << b;
+                first_bin = false;
+            }
+            hist_out << "] }";
+            first = false;
+        }
+        hist_out << std::endl << "  }" << std::endl << "}" << std::endl;
+
+        if (!enc_out || !hist_out)
+            throw libsdod_exception(ErrorCode::RUNTIME_ERROR, format("Failed to write calibration results for graph {} to: {}", graph, output_dir), __func__, __FILE__, STR(__LINE__));
+        info("Saved calibration of {} tensors of graph {} ({} executions) to: {}", stats.tensors.size(), graph, stats.executions, output_dir);
+    }
+}
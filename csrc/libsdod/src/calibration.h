@@ -0,0 +1,90 @@
+#ifndef LIBSDOD_CALIBRATION_H
+#define LIBSDOD_CALIBRATION_H
+
+#include "trace.h"
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+
+namespace libsdod {
+
+// Histogram of values of a single tensor, the range covered by the bins grows (by merging neighbouring bins)
+// as new values are observed, so the data does not have to be seen upfront.
+class Histogram {
+public:
+    explicit Histogram(unsigned int num_bins);
+
+    void add(const float* values, std::size_t count);
+
+    // range of values excluding ``(100 - percentile) / 2`` percent of the smallest and the largest values,
+    // for percentile == 100 this is equal to (min, max)
+    std::pair<double, double> get_range(double percentile) const;
+
+    auto get_min() const { return min; }
+    auto get_max() const { return max; }
+    auto get_count() const { return count; }
+    auto get_bins_min() const { return lo; }
+    auto get_bins_max() const { return lo + width * bins.size(); }
+    auto const& get_bins() const { return bins; }
+
+private:
+    std::vector<uint64_t> bins;
+    double lo = 0.0;
+    double width = 0.0;
+    double min = 0.0;
+    double max = 0.0;
+    uint64_t count = 0;
+
+    void _grow(double value);
+};
+
+
+// Quantization encoding of a tensor, using the same convention as QNN: real = (quantized + offset) * scale
+struct Encoding {
+    unsigned int bitwidth;
+    double min;
+    double max;
+    double scale;
+    int32_t offset;
+
+    static Encoding from_range(double min, double max, unsigned int bitwidth);
+};
+
+
+// Gathers statistics of all floating-point inputs and outputs of observed graph executions. Statistics can be saved as:
+//  - <graph>.encodings.json - encodings in the format accepted by QNN converters (``--quantization_overrides``), keyed by
+//    the runtime names of the tensors (which todlc.py maps back to the names used by the source model)
+//  - <graph>.histograms.json - raw histograms, useful to pick different clipping later
+// Quantized tensors are dequantized before being observed, therefore calibration should be done using models
+// with floating-point activations, otherwise the ranges are limited by the existing encodings.
+class Calibrator : public ExecutionObserver {
+public:
+    explicit Calibrator(unsigned int num_bins = 2048);
+
+    void on_execution(std::string const& graph, std::vector<TraceTensor> const& inputs, std::vector<TraceTensor> const& outputs, double exec_ms) override;
+
+    void save(std::string const& output_dir, unsigned int bitwidth, double percentile) const;
+
+    uint64_t get_num_executions() const;
+
+private:
+    struct GraphStats {
+        uint64_t executions = 0;
+        std::map<std::string, Histogram> tensors;
+    };
+
+    unsigned int num_bins;
+    mutable std::mutex mutex;
+    std::map<std::string, GraphStats> graphs;
+    std::vector<float> tmp;
+
+    void _observe(GraphStats& stats, TraceTensor const& t);
+};
+
+}
+
+#endif // LIBSDOD_CALIBRATION_H
@@ -1,19 +1,116 @@
 #include "context.h"
 #include "error.h"
 #include "utils.h"
+#include "conversions.h"
+#include "noise.h"
 
 #include <chrono>
 #include <cmath>
 #include <array>
+#include <atomic>
 #include <mutex>
 #include <thread>
+#include <random>
+#include <limits>
+#include <exception>
+#include <algorithm>
+#include <filesystem>
+#include <string_view>
 
 using namespace libsdod;
 
 
-Context::Context(std::string const& models_dir, unsigned int latent_channels, unsigned int latent_spatial, unsigned int upscale_factor, LogLevel log_level, bool use_htp)
-    : models_dir(models_dir), latent_channels(latent_channels), latent_spatial(latent_spatial), upscale_factor(upscale_factor), use_htp(use_htp),
-    _random_gen{ std::random_device{}() }, _normal{ 0, 1 } {
+namespace {
+
+// entries pinned at the same time: one being encoded, a full queue of encoded requests and two being denoised
+constexpr std::size_t prompt_cache_size = 8;
+
+// number of step counts whose schedules are kept at the same time, see prepare_schedule
+constexpr std::size_t schedule_cache_size = 4;
+
+// elements of the initial noise generated by a single thread, see _generate_noise
+constexpr std::size_t noise_chunk = 8192;
+
+// training timesteps of the model, also the upper limit of denoising steps
+constexpr unsigned int solver_timesteps = 1000;
+
+// weight of the latest measurement in the running averages of CostModel
+constexpr double cost_model_smoothing = 0.3;
+
+// fraction of steps made with guidance when a budget falls back to truncated guidance: the early steps, which set the layout
+// of the image, keep it, while the later ones mostly refine details and are the cheapest to make without it
+constexpr float budget_guidance_end = 0.5f;
+
+// cost model index of generations which output latents (the other ones are indexed by DecoderType)
+constexpr unsigned int latents_output = 2;
+
+// graphs which do not have to be present in the models directory
+constexpr const char* fast_decoder_name = "taesd_decoder.serialized";
+constexpr const char* encoder_name = "vae_encoder.serialized";
+
+bool _is_optional(const char* name) {
+    return std::string(name) == fast_decoder_name || std::string(name) == encoder_name;
+}
+
+// loaded instead of "unet.serialized" if the first one is present, see StableDiffusionModel
+constexpr std::array unet_partition_names{ "unet_inputs.serialized", "unet_middle.serialized", "unet_outputs.serialized" };
+
+bool _same_name(Qnn_Tensor_t const& a, Qnn_Tensor_t const& b) {
+    return std::string_view(a.v1.name) == b.v1.name;
+}
+
+double relative_l2(std::vector<float> const& values, std::vector<float> const& reference) {
+    double diff_sq = 0.0, ref_sq = 0.0;
+    for (auto i : range(reference.size())) {
+        double d = double(values[i]) - reference[i];
+        diff_sq += d * d;
+        ref_sq += double(reference[i]) * reference[i];
+    }
+    return (ref_sq > 0.0 ? std::sqrt(diff_sq / ref_sq) : std::sqrt(diff_sq));
+}
+
+// minimal overlap of neighbouring tiles when decoding large latents, in latent pixels
+constexpr unsigned int tile_overlap = 8;
+
+
+// start positions of ``tile``-sized windows covering ``size`` elements, evenly spaced so that neighbours overlap by at least ``overlap``
+std::vector<unsigned int> _tile_starts(unsigned int size, unsigned int tile, unsigned int overlap) {
+    if (size <= tile)
+        return { 0 };
+
+    auto stride = tile - overlap;
+    auto count = (size - overlap + stride - 1) / stride;
+    std::vector<unsigned int> ret;
+    for (auto i : range(count))
+        ret.push_back(std::size_t(size - tile) * i / (count - 1));
+    return ret;
+}
+
+
+// blending weights of ``tile_px`` pixels along a single axis of the tile ``idx``, fading linearly across its overlaps
+// with the neighbours (so that weights of overlapping tiles sum up to 1)
+std::vector<float> _tile_weights(std::vector<unsigned int> const& starts, std::size_t idx, unsigned int tile, unsigned int scale) {
+    std::size_t tile_px = std::size_t(tile) * scale;
+    std::vector<float> ret(tile_px, 1.0f);
+    if (idx > 0) {
+        std::size_t overlap = std::size_t(starts[idx - 1] + tile - starts[idx]) * scale;
+        for (auto p : range(overlap))
+            ret[p] = std::min(ret[p], (p + 0.5f) / overlap);
+    }
+    if (idx + 1 < starts.size()) {
+        std::size_t overlap = std::size_t(starts[idx] + tile - starts[idx + 1]) * scale;
+        for (auto p : range(overlap))
+            ret[tile_px - 1 - p] = std::min(ret[tile_px - 1 - p], (p + 0.5f) / overlap);
+    }
+    return ret;
+}
+
+}
+
+
+Context::Context(std::string const& models_dir, unsigned int latent_channels, unsigned int latent_spatial, unsigned int upscale_factor, LogLevel log_level, QnnBackendType backend)
+    : models_dir(models_dir), latent_channels(latent_channels), latent_spatial(latent_spatial), upscale_factor(upscale_factor), backend(backend),
+    _seed{ std::random_device{}() } {
     _error_table = allocate_error_table();
     _logger.set_level(log_level);
     if (models_dir.empty())
@@ -23,18 +120,43 @@ Context::Context(std::string const& models_dir, unsigned int latent_channels, un
 }
 
 
+void DenoisingLane::wait() {
+    if (cond_done.valid())
+        cond_done.wait();
+    if (uncond_done.valid())
+        uncond_done.wait();
+}
+
+
+void DenoisingLane::reset() {
+    wait();
+    x.reset();
+    p_cond = nullptr;
+    schedule = nullptr;
+    e.reset();
+    e_uncond.reset();
+    for (auto&& f : features)
+        f.tensors.clear();
+}
+
+
 Context::~Context() {
     temb_in.reset();
     temb_out.reset();
     tokens.reset();
     p.reset();
-    x.reset();
-    t.reset();
-    p_cond.reset();
+    enc_in.reset();
+    enc_out.reset();
+    for (auto&& lane : _lanes)
+        lane.reset();
+    _schedule = nullptr;
+    _schedules.clear();
+    _prompt_cache.clear();
     p_uncond.reset();
-    e.reset();
-    y.reset();
-    img.reset();
+    for (auto&& decoder : _decoders) {
+        decoder.y.reset();
+        decoder.img.reset();
+    }
     other_tensors.clear();
 
     _model.reset();
@@ -46,35 +168,74 @@ Context::~Context() {
 }
 
 
+void Context::init(unsigned int steps) {
+    auto&& tick = std::chrono::high_resolution_clock::now();
+
+    _timed_phase("initialize_qnn", [this]() { initialize_qnn(); });
+    _timed_phase("load_models", [this]() { load_models(); });
+    _timed_phase("load_tokenizer", [this]() { load_tokenizer(); });
+    _timed_phase("prepare_solver", [this]() { prepare_solver(); });
+    _timed_phase("prepare_buffers", [this]() { prepare_buffers(); });
+    _timed_phase("prepare_schedule", [this, steps]() { prepare_schedule(steps); });
+
+    auto&& tock = std::chrono::high_resolution_clock::now();
+    _setup_stats.record_time("setup.total_ms", tick, tock);
+    auto&& diff = std::chrono::duration_cast<std::chrono::milliseconds>(tock - tick);
+    info("Initialization took {}ms", diff.count());
+}
+
+
 void Context::init_mt(unsigned int steps) {
     auto&& tick = std::chrono::high_resolution_clock::now();
 
-    auto&& init_models = std::thread([this, steps]() {
+    // exceptions cannot leave a std::thread, store them and rethrow after all threads have finished
+    std::array<std::exception_ptr, 3> errors;
+
+    auto&& init_models = std::thread([this, &errors]() {
         auto&& _log_guard = activate_logger();
         (void)_log_guard;
-        initialize_qnn();
-        load_models();
-        prepare_buffers();
-        prepare_schedule(steps);
+        try {
+            _timed_phase("initialize_qnn", [this]() { initialize_qnn(); });
+            _timed_phase("load_models", [this]() { load_models(); });
+        } catch (...) {
+            errors[0] = std::current_exception();
+        }
     });
 
-    auto&& init_tokenizer = std::thread([this]() {
+    auto&& init_tokenizer = std::thread([this, &errors]() {
         auto&& _log_guard = activate_logger();
         (void)_log_guard;
-        load_tokenizer();
+        try {
+            _timed_phase("load_tokenizer", [this]() { load_tokenizer(); });
+        } catch (...) {
+            errors[1] = std::current_exception();
+        }
     });
 
-    auto&& init_solver = std::thread([this]() {
+    auto&& init_solver = std::thread([this, &errors]() {
         auto&& _log_guard = activate_logger();
         (void)_log_guard;
-        prepare_solver();
+        try {
+            _timed_phase("prepare_solver", [this]() { prepare_solver(); });
+        } catch (...) {
+            errors[2] = std::current_exception();
+        }
     });
 
     init_models.join();
     init_tokenizer.join();
     init_solver.join();
 
+    for (auto&& e : errors)
+        if (e)
+            std::rethrow_exception(e);
+
+    // both need the models, the tokenizer and the solver
+    _timed_phase("prepare_buffers", [this]() { prepare_buffers(); });
+    _timed_phase("prepare_schedule", [this, steps]() { prepare_schedule(steps); });
+
     auto&& tock = std::chrono::high_resolution_clock::now();
+    _setup_stats.record_time("setup.total_ms", tick, tock);
     auto&& diff = std::chrono::duration_cast<std::chrono::milliseconds>(tock - tick);
     info("Initialization took {}ms", diff.count());
 }
@@ -86,7 +247,7 @@ void Context::initialize_qnn() {
     if (_qnn_initialized)
         return;
 
-    _qnn = std::shared_ptr<QnnBackend>(new QnnBackend(use_htp ? QnnBackendType::HTP : QnnBackendType::GPU));
+    _qnn = std::shared_ptr<QnnBackend>(new QnnBackend(backend));
     _qnn_initialized = true;
 }
 
@@ -102,21 +263,32 @@ void Context::load_models() {
 #if !defined(NOTHREADS) && !defined(LIBSDOD_DEBUG)
     std::map<std::string, QnnGraph*> _graphs;
     std::mutex _graphs_mutex;
-    auto&& _graph_names = std::array{ "unet.serialized", "text_encoder.serialized", "vae_decoder.serialized", "temb" };
+    bool partitioned = std::filesystem::exists(models_dir + "/" + unet_partition_names[0] + (backend == QnnBackendType::HTP ? ".bin" : ".so"));
+    std::vector<const char*> _graph_names = { "text_encoder.serialized", "vae_decoder.serialized", "temb", fast_decoder_name, encoder_name };
+    if (partitioned)
+        _graph_names.insert(_graph_names.begin(), unet_partition_names.begin(), unet_partition_names.end());
+    else
+        _graph_names.insert(_graph_names.begin(), "unet.serialized");
 
     auto&& get_model_async = [this, &_graphs, &_graphs_mutex](const char* name) {
         auto&& _log_guard = activate_logger();
         (void)_log_guard;
 
+        bool is_cached = (backend == QnnBackendType::HTP);
         std::string filename;
-        if (use_htp)
+        if (is_cached)
             filename = std::string(name) + ".bin";
         else
             filename = std::string(name) + ".so";
 
-        info("Attempting to load a model: {}", filename);
         auto&& path = models_dir + "/" + filename;
-        auto&& graphs = _qnn->load_graphs(path, use_htp);
+        if (_is_optional(name) && !std::filesystem::exists(path)) {
+            info("Optional model {} not found, skipping", filename);
+            return;
+        }
+
+        info("Attempting to load a model: {}", filename);
+        auto&& graphs = _qnn->load_graphs(path, is_cached);
         if (graphs.empty())
             throw libsdod_exception(ErrorCode::INVALID_ARGUMENT, format("Deserialized context {} does not contain any graphs!", path), "load_models", __FILE__, STR(__LINE__));
         if (graphs.size() > 1)
@@ -132,29 +304,50 @@ void Context::load_models() {
     };
 
     std::list<std::thread> _loading_threads;
-    for (auto&& gname : _graph_names)
-        _loading_threads.emplace_back(get_model_async, gname);
+    std::vector<std::exception_ptr> _loading_errors(_graph_names.size());
+    for (auto i : range(_graph_names.size()))
+        _loading_threads.emplace_back([&get_model_async, &_graph_names, &_loading_errors, i]() {
+            try {
+                get_model_async(_graph_names[i]);
+            } catch (...) {
+                _loading_errors[i] = std::current_exception();
+            }
+        });
 
     for (auto&& t : _loading_threads)
         t.join();
 
+    for (auto&& e : _loading_errors)
+        if (e)
+            std::rethrow_exception(e);
+
     _model.emplace(StableDiffusionModel{
-        .unet = *_graphs["unet.serialized"],
+        .unet = *_graphs[partitioned ? unet_partition_names[0] : "unet.serialized"],
+        .unet_middle = _graphs[unet_partition_names[1]],
+        .unet_outputs = _graphs[unet_partition_names[2]],
         .cond_model = *_graphs["text_encoder.serialized"],
         .decoder = *_graphs["vae_decoder.serialized"],
-        .temb = *_graphs["temb"]
+        .temb = *_graphs["temb"],
+        .fast_decoder = _graphs[fast_decoder_name],
+        .encoder = _graphs[encoder_name]
     });
 #else
-    auto&& get_model = [this](const char* name) -> graph_ref {
+    auto&& get_model = [this](const char* name) -> QnnGraph* {
+        bool is_cached = (backend == QnnBackendType::HTP);
         std::string filename;
-        if (use_htp)
+        if (is_cached)
             filename = std::string(name) + ".bin";
         else
             filename = std::string(name) + ".qnn.so";
 
-        info("Attempting to load a model: {}", filename);
         auto&& path = models_dir + "/" + filename;
-        auto&& graphs = _qnn->load_graphs(path, use_htp);
+        if (_is_optional(name) && !std::filesystem::exists(path)) {
+            info("Optional model {} not found, skipping", filename);
+            return nullptr;
+        }
+
+        info("Attempting to load a model: {}", filename);
+        auto&& graphs = _qnn->load_graphs(path, is_cached);
         if (graphs.empty())
             throw libsdod_exception(ErrorCode::INVALID_ARGUMENT, format("Deserialized context {} does not contain any graphs!", path), "load_models", __FILE__, STR(__LINE__));
         if (graphs.size() > 1)
@@ -162,17 +355,24 @@ void Context::load_models() {
 
         graphs.front().set_name(name);
         _qnn_graphs.splice(_qnn_graphs.end(), std::move(graphs), graphs.begin());
-        return _qnn_graphs.back();
+        return &_qnn_graphs.back();
     };
 
+    bool partitioned = std::filesystem::exists(models_dir + "/" + unet_partition_names[0] + (backend == QnnBackendType::HTP ? ".bin" : ".qnn.so"));
     _model.emplace(StableDiffusionModel{
-        .unet = get_model("unet.serialized"),
-        .cond_model = get_model("text_encoder.serialized"),
-        .decoder = get_model("vae_decoder.serialized"),
-        .temb = get_model("temb")
+        .unet = *get_model(partitioned ? unet_partition_names[0] : "unet.serialized"),
+        .unet_middle = (partitioned ? get_model(unet_partition_names[1]) : nullptr),
+        .unet_outputs = (partitioned ? get_model(unet_partition_names[2]) : nullptr),
+        .cond_model = *get_model("text_encoder.serialized"),
+        .decoder = *get_model("vae_decoder.serialized"),
+        .temb = *get_model("temb"),
+        .fast_decoder = get_model(fast_decoder_name),
+        .encoder = get_model(encoder_name)
     });
 #endif
 
+    if (_model->unet_middle)
+        info("Using a partitioned UNet");
     info("All models loaded!");
 }
 
@@ -193,7 +393,7 @@ void Context::prepare_solver() {
         return;
     if (_solver)
         return;
-    _solver.emplace(1000, 0.00085, 0.0120);
+    _solver.emplace(solver_timesteps, 0.00085, 0.0120);
     info("ODE solver prepared!");
 }
 
@@ -205,40 +405,68 @@ void Context::prepare_buffers() {
         return;
 
     // allocate important tensors
-    temb_in.emplace(_model->temb.allocate_input(0));
-    temb_out.emplace(_model->temb.allocate_output(0));
+    auto temb_batch = _model->temb.get_input_desc(0).v1.dimensions[0];
+    temb_in.emplace(_model->temb.allocate_input(0, temb_batch));
+    temb_out.emplace(_model->temb.allocate_output(0, temb_batch));
 
     tokens.emplace(_model->cond_model.allocate_input(0));
     p.emplace(_model->cond_model.allocate_output(0));
 
-    x.emplace(_model->unet.allocate_input(0));
-    t.emplace(_model->unet.allocate_input(1));
-    p_cond.emplace(_model->unet.allocate_input(2));
-    p_uncond.emplace(_model->unet.allocate_input(2));
-    e.emplace(_model->unet.allocate_output(0));
+    // UNet compiled with batch 2 runs conditional and unconditional passes in a single execution,
+    // in which case p_cond holds both prompts (conditional first) and p_uncond is not used
+    auto unet_batch = _model->unet.get_input_desc(0).v1.dimensions[0];
+    if (unet_batch != 1 && unet_batch != 2)
+        throw libsdod_exception(ErrorCode::INVALID_ARGUMENT, format("Unsupported UNet batch size: {}, expected 1 or 2", unet_batch), __func__, __FILE__, STR(__LINE__));
+    _batched_cfg = (unet_batch == 2);
+
+    _allocate_lane(_lanes[0], unet_batch, true);
+    _allocate_lane(_lanes[1], unet_batch, false);
+    if (!_batched_cfg)
+        p_uncond.emplace(_allocate_unet_input(2, 1, false));
+
+    _prompt_cache.clear();
+    _prompt_cache.reserve(prompt_cache_size);
+    for (std::size_t i = 0; i < prompt_cache_size; ++i) {
+        auto&& entry = _prompt_cache.emplace_back();
+        entry.p.emplace(_allocate_unet_input(2, unet_batch, i == 0));
+        // the text encoder can write directly to the UNet input, unless the latter also holds the unconditional prompt
+        if (!_batched_cfg && QnnTensor::same_encoding(p->get_desc(), entry.p->get_desc()))
+            entry.encoder_out.emplace(_model->cond_model.attach_output(0, *entry.p, false, false));
+    }
+
+    if (_model->encoder) {
+        enc_in.emplace(_model->encoder->allocate_input(0));
+        enc_out.emplace(_model->encoder->allocate_output(0));
+        std::size_t image_len = 3 * latent_spatial * latent_spatial * upscale_factor * upscale_factor;
+        if (enc_in->get_num_elements(1) != image_len)
+            throw libsdod_exception(ErrorCode::INVALID_ARGUMENT, format("Encoder input size ({}) does not match the image size: {}", enc_in->get_num_elements(1), image_len), __func__, __FILE__, STR(__LINE__));
+        if (enc_out->get_num_elements(1) != std::size_t(latent_channels) * latent_spatial * latent_spatial)
+            throw libsdod_exception(ErrorCode::INVALID_ARGUMENT, format("Encoder output size ({}) does not match the latent size: {}", enc_out->get_num_elements(1), latent_channels * latent_spatial * latent_spatial), __func__, __FILE__, STR(__LINE__));
+        auto&& enc_desc = enc_in->get_desc();
+        _enc_planar = (enc_desc.v1.rank == 4 && enc_desc.v1.dimensions[1] == 3 && enc_desc.v1.dimensions[3] != 3);
+        _model->encoder->verify();
+    }
 
-    y.emplace(_model->decoder.allocate_input(0));
-    img.emplace(_model->decoder.allocate_output(0));
+    _prepare_decoder(_decoders[static_cast<int>(DecoderType::FULL)], _model->decoder);
+    if (_model->fast_decoder)
+        _prepare_decoder(_decoders[static_cast<int>(DecoderType::FAST)], *_model->fast_decoder);
 
+    // UNet is verified by prepare_schedule, once its timestep inputs exist
     _model->cond_model.verify();
-    _model->decoder.verify();
-    _model->unet.verify();
     _model->temb.verify();
 
-    p_host.resize(p->get_num_elements(1));
-    x_host.resize(latent_channels * latent_spatial * latent_spatial);
-    e_host.resize(latent_channels * latent_spatial * latent_spatial);
-    img_host.resize(3 * latent_spatial * upscale_factor * latent_spatial * upscale_factor);
-
     // precompute empty prompt conditioning
     std::vector<Tokenizer::token_type> tokens_host;
     _tokenizer->tokenize(tokens_host, "");
     tokens->set_data(tokens_host);
     _model->cond_model.execute();
-    p->get_data(p_host);
-    p_uncond->set_data(p_host);
+    if (_batched_cfg) {
+        for (auto&& entry : _prompt_cache)
+            p->copy_to(*entry.p, 1);
+    } else
+        p->copy_to(*p_uncond);
 
-    info("Input/output buffers created and prepared!");
+    info("Input/output buffers created and prepared{}!", _batched_cfg ? ", using batched classifier-free guidance" : "");
 }
 
 
@@ -247,11 +475,51 @@ void Context::prepare_schedule(unsigned int steps) {
         return;
     if (!_solver)
         return;
-    if (steps != 20)
-        throw libsdod_exception(ErrorCode::INVALID_ARGUMENT, format("steps!=20 is currently not implemented, got: {}", steps), __func__, __FILE__, STR(__LINE__));
+    if (!_model)
+        return;
+    if (!steps || steps > solver_timesteps)
+        throw libsdod_exception(ErrorCode::INVALID_ARGUMENT, format("Number of steps should be in range [1, {}], got: {}", solver_timesteps, steps), __func__, __FILE__, STR(__LINE__));
+
+    _schedule = _get_schedule(steps);
+}
+
+
+// entries are never moved, so the active one (and the ones referenced by requests) stay valid;
+// the least recently used one is replaced when the cache is full - except for the active one, which a call
+// with a latency budget may not have used for a while (see _plan_budget)
+Schedule* Context::_get_schedule(unsigned int steps) {
+    auto&& cached = std::find_if(_schedules.begin(), _schedules.end(), [steps](Schedule const& s) { return s.steps == steps; });
+    if (cached != _schedules.end()) {
+        cached->last_used = ++_schedule_clock;
+        info("Using cached time schedule for {} steps", steps);
+        return &*cached;
+    }
 
-    std::vector<float> _schedule;
-    _solver->prepare(steps, _schedule);
+    Schedule* entry = nullptr;
+    if (_schedules.size() < schedule_cache_size) {
+        _schedules.reserve(schedule_cache_size);
+        entry = &_schedules.emplace_back();
+    } else {
+        entry = &*std::min_element(_schedules.begin(), _schedules.end(), [this](Schedule const& a, Schedule const& b) {
+            return &a != _schedule && (&b == _schedule || a.last_used < b.last_used);
+        });
+        debug("Evicting time schedule for {} steps", entry->steps);
+    }
+
+    _compute_schedule(*entry, steps);
+    entry->last_used = ++_schedule_clock;
+    info("Time schedule prepared for {} steps!", steps);
+    return entry;
+}
+
+
+void Context::_compute_schedule(Schedule& schedule, unsigned int steps) {
+    schedule.steps = 0; // invalid until done
+    schedule.t_inputs.clear();
+    schedule.solver.emplace(*_solver);
+
+    std::vector<float> model_ts;
+    schedule.solver->prepare(steps, model_ts);
 
     //compute time embeddings
     constexpr float max_period = 10000.0f;
@@ -262,34 +530,168 @@ void Context::prepare_schedule(unsigned int steps) {
     float log_period = -std::log(max_period);
     std::vector<float> mode;
     mode.resize(mode_dim, 0.0f);
-    t_embeddings.resize(steps);
-
-    for (auto i : range(steps)) {
-        auto half = mode_dim/2;
-        t_embeddings[i].resize(temb_dim, 0.0f);
-        for (auto j : range(half)) {
-            auto arg = _schedule[i] * std::exp(log_period * j / half);
-            mode[j] = std::cos(arg);
-            mode[half+j] = std::sin(arg);
+    std::vector<float> t_host(temb_dim, 0.0f);
+
+    // each step gets its own UNet input, converted once here and then only activated by the denoising loop;
+    // with batched guidance both elements of the batch use the same timestep
+    auto unet_batch = _model->unet.get_input_desc(1).v1.dimensions[0];
+    schedule.t_inputs.reserve(steps);
+
+    // the time embedding model computes as many steps per execution as its batch allows (unused elements of the last one are ignored)
+    auto temb_batch = temb_in->get_batch_size();
+    unsigned int temb_executions = 0;
+    for (unsigned int first = 0; first < steps; first += temb_batch) {
+        auto count = std::min(temb_batch, steps - first);
+        for (auto b : range(count)) {
+            auto half = mode_dim/2;
+            for (auto j : range(half)) {
+                auto arg = model_ts[first + b] * std::exp(log_period * j / half);
+                mode[j] = std::cos(arg);
+                mode[half+j] = std::sin(arg);
+            }
+            temb_in->set_batch_data(b, mode);
         }
 
-        temb_in->set_data(mode);
         _model->temb.execute();
-        temb_out->get_data(t_embeddings[i]);
+        ++temb_executions;
+
+        for (auto b : range(count)) {
+            temb_out->get_batch_data(b, t_host);
+            auto&& t = schedule.t_inputs.emplace_back(_allocate_unet_input(1, unet_batch, first + b == 0));
+            t.set_batch_data(0, t_host);
+            t.broadcast_batch(0);
+        }
     }
 
-    info("Time schedule prepared for {} steps!", steps);
+    for (auto&& g : { &_model->unet, _model->unet_middle, _model->unet_outputs })
+        if (g)
+            g->verify();
+
+    schedule.steps = steps;
+    debug("Time embeddings for {} steps computed in {} execution(s)", steps, temb_executions);
 }
 
 
 void Context::set_seed(unsigned int seed) {
     info("Using seed: {}", seed);
-    _normal.reset();
-    _random_gen.seed(seed);
+    _seed = seed;
+    _noise_streams = 0;
 }
 
 
 void Context::generate(std::string const& prompt, float guidance, Buffer<unsigned char>& output) {
+    generate(std::vector<std::string>{ prompt }, guidance, output);
+}
+
+
+namespace {
+
+constexpr std::size_t pipeline_queue_depth = 2;
+
+
+// passes requests from ``in`` to ``out`` (if given) until the end of the stream, calling ``fn`` for each of them
+// unless it has already failed; returns the time spent in ``fn`` in milliseconds
+template <class Fn>
+double _run_stage(request_queue& in, request_queue* out, Fn&& fn) {
+    double busy_ms = 0.0;
+    request_ptr request;
+    while ((request = in.pop())) {
+        if (!request->error) {
+            auto&& tick = Stats::clock::now();
+            try {
+                fn(*request);
+            } catch (...) {
+                request->error = std::current_exception();
+            }
+            busy_ms += std::chrono::duration<double, std::milli>(Stats::clock::now() - tick).count();
+        }
+        if (out)
+            out->push(std::move(request));
+    }
+    if (out)
+        out->push(nullptr);
+    return busy_ms;
+}
+
+
+// called after a stage has failed as a whole (not just for a single request): ends its output stream and drops whatever
+// its producer still sends, so that neither of its neighbours waits for it forever; ``release`` is called for dropped requests
+template <class Release>
+void _abandon_stage(request_queue* in, std::atomic<bool> const* in_finished, request_queue* out, Release&& release) {
+    if (out)
+        out->push(nullptr);
+    if (!in)
+        return;
+
+    request_ptr request;
+    while (true) {
+        bool done = in_finished->load(std::memory_order_acquire);
+        if (in->try_pop(request)) {
+            if (request)
+                release(*request);
+            continue;
+        }
+        if (done)
+            break;
+        std::this_thread::yield();
+    }
+}
+
+}
+
+
+void Context::generate(std::vector<std::string> const& prompts, float guidance, Buffer<unsigned char>& output) {
+    if (_failed_and_gave_up)
+        return;
+    if (!_qnn_initialized)
+        return;
+    if (!_model)
+        return;
+    if (!_solver)
+        return;
+    if (!_tokenizer)
+        return;
+
+    if (prompts.empty())
+        throw libsdod_exception(ErrorCode::INVALID_ARGUMENT, "No prompts given", __func__, __FILE__, STR(__LINE__));
+    std::size_t image_len = 3 * latent_spatial * latent_spatial * upscale_factor * upscale_factor;
+    if (output.data_len() < prompts.size() * image_len)
+        throw libsdod_exception(ErrorCode::INVALID_ARGUMENT, format("Output buffer is too small for {} images: {}", prompts.size(), output.data_len()), __func__, __FILE__, STR(__LINE__));
+
+    _generate(prompts, guidance, output.data_ptr(), nullptr);
+}
+
+
+void Context::generate(std::vector<std::string> const& prompts, std::vector<const unsigned char*> const& init_images, float strength, float guidance, Buffer<unsigned char>& output) {
+    if (_failed_and_gave_up)
+        return;
+    if (!_qnn_initialized)
+        return;
+    if (!_model)
+        return;
+    if (!_solver)
+        return;
+    if (!_tokenizer)
+        return;
+
+    if (!_model->encoder)
+        throw libsdod_exception(ErrorCode::INVALID_ARGUMENT, format("Image to image generation requires the VAE encoder: {}", encoder_name), __func__, __FILE__, STR(__LINE__));
+    if (prompts.empty())
+        throw libsdod_exception(ErrorCode::INVALID_ARGUMENT, "No prompts given", __func__, __FILE__, STR(__LINE__));
+    if (init_images.size() != prompts.size())
+        throw libsdod_exception(ErrorCode::INVALID_ARGUMENT, format("Expected one initial image per prompt, got {} images for {} prompts", init_images.size(), prompts.size()), __func__, __FILE__, STR(__LINE__));
+    std::size_t image_len = 3 * latent_spatial * latent_spatial * upscale_factor * upscale_factor;
+    if (output.data_len() < prompts.size() * image_len)
+        throw libsdod_exception(ErrorCode::INVALID_ARGUMENT, format("Output buffer is too small for {} images: {}", prompts.size(), output.data_len()), __func__, __FILE__, STR(__LINE__));
+
+    if (!(strength > 0.0f && strength <= 1.0f))
+        throw libsdod_exception(ErrorCode::INVALID_ARGUMENT, format("Strength should be in range (0, 1], got: {}", strength), __func__, __FILE__, STR(__LINE__));
+
+    _generate(prompts, guidance, output.data_ptr(), nullptr, &init_images, strength);
+}
+
+
+void Context::generate_latents(std::vector<std::string> const& prompts, float guidance, Buffer<float>& output) {
     if (_failed_and_gave_up)
         return;
     if (!_qnn_initialized)
@@ -301,119 +703,1240 @@ void Context::generate(std::string const& prompt, float guidance, Buffer<unsigne
     if (!_tokenizer)
         return;
 
+    if (prompts.empty())
+        throw libsdod_exception(ErrorCode::INVALID_ARGUMENT, "No prompts given", __func__, __FILE__, STR(__LINE__));
+    std::size_t latent_len = latent_channels * latent_spatial * latent_spatial;
+    if (output.data_len() < prompts.size() * latent_len)
+        throw libsdod_exception(ErrorCode::INVALID_ARGUMENT, format("Output buffer is too small for {} latents: {}", prompts.size(), output.data_len()), __func__, __FILE__, STR(__LINE__));
+
+    _generate(prompts, guidance, nullptr, output.data_ptr());
+}
+
+
+void Context::_generate(std::vector<std::string> const& prompts, float guidance, unsigned char* images, float* latents,
+    std::vector<const unsigned char*> const* init_images, float strength) {
     auto&& start = std::chrono::high_resolution_clock::now();
+    _generate_stats.clear();
+
+    const char* what = (images ? "image" : "latent");
+    info("Starting generation of {} {}(s) with guidance {}", prompts.size(), what, guidance);
+
+    Decoder* decoder = (images ? &_select_decoder() : nullptr);
+    unsigned int output = (!decoder ? latents_output : (decoder == &_decoders[static_cast<int>(DecoderType::FAST)] ? 1u : 0u));
+
+    // a budget overrides the schedule and the guidance policy only for this call
+    auto saved_policy = _guidance_policy;
+    auto&& restore_policy = scope_guard([this, &saved_policy]() { _guidance_policy = saved_policy; });
+    (void)restore_policy;
+    Schedule* schedule = _schedule;
+    _guidance_policy = _plan_budget(prompts.size(), guidance, output, strength, schedule);
+
+    // same as in diffusers: strength selects the number of steps which are actually made
+    if (!schedule)
+        throw libsdod_exception(ErrorCode::INVALID_ARGUMENT, "Time schedule has not been prepared", __func__, __FILE__, STR(__LINE__));
+    unsigned int steps = schedule->steps;
+    auto denoising_steps = std::min(static_cast<unsigned int>(steps * strength), steps);
+    if (!denoising_steps)
+        throw libsdod_exception(ErrorCode::INVALID_ARGUMENT, format("Strength {} is too low to make a single step out of {}", strength, steps), __func__, __FILE__, STR(__LINE__));
+    unsigned int first_step = steps - denoising_steps;
+    debug("Current steps: {}, first step: {}", steps, first_step);
 
-    info("Starting image generation for prompt: \"{}\" and guidance {}", prompt, guidance);
-    debug("Current steps: {}", t_embeddings.size());
+    auto&& burst_scope_guard = scope_guard([this](){ _qnn->start_burst(); }, [this]() { _qnn->end_burst(); });
+    (void)burst_scope_guard;
 
-    auto&& _report_time = [](const char* name,
-        std::chrono::high_resolution_clock::time_point const& t1,
-        std::chrono::high_resolution_clock::time_point const& t2) {
-        auto&& diff = std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t1);
-        info("{} took {}ms", name, diff.count());
+    // schedules prepared by planning are not part of the measured cost
+    auto&& cost_start = Stats::clock::now();
+    _generation_cost = GenerationCost{};
+
+    // each image gets its own noise stream, see set_seed
+    auto first_stream = _noise_streams;
+    _noise_streams += prompts.size();
+
+    request_queue tokenized{ pipeline_queue_depth };
+    request_queue encoded{ pipeline_queue_depth };
+    request_queue denoised{ pipeline_queue_depth };
+    request_queue decoded{ pipeline_queue_depth };
+    std::vector<std::exception_ptr> errors(prompts.size());
+
+    // stages only touch their own tensors (and the models they execute), so they can run concurrently;
+    // errors are reported per request by the last stage, a stage which fails as a whole fails the entire call;
+    // without images, denoised latents go straight to the output stage
+    std::vector<const char*> stage_names = { "tokenize", "encode", "denoise" };
+    std::vector<std::function<double()>> stages = {
+        [&]() { return _tokenize_stage(prompts, init_images, schedule, first_step, first_stream, tokenized); },
+        [&]() { return _encode_stage(tokenized, encoded); },
+        [&]() { return _denoise_stage(encoded, denoised, guidance); }
     };
+    std::vector<std::pair<const char*, request_queue*>> queues = { { "tokenized", &tokenized }, { "encoded", &encoded }, { "denoised", &denoised } };
+    if (images) {
+        stage_names.insert(stage_names.end(), { "decode", "output" });
+        stages.emplace_back([&]() { return _decode_stage(denoised, decoded, *decoder); });
+        stages.emplace_back([&]() { return _output_stage(decoded, images, errors, *decoder); });
+        queues.emplace_back("decoded", &decoded);
+    } else {
+        stage_names.push_back("output");
+        stages.emplace_back([&]() { return _latents_output_stage(denoised, latents, errors); });
+    }
+
+    // exceptions cannot leave a std::thread, store them and rethrow after all threads have finished
+    std::vector<double> busy_ms(stages.size());
+    std::vector<std::exception_ptr> stage_errors(stages.size());
+    std::vector<std::atomic<bool>> finished(stages.size());
+    std::vector<std::thread> workers;
+    for (auto i : range(stages.size()))
+        workers.emplace_back([this, &busy_ms, &stages, &stage_errors, &finished, &queues, i]() {
+            try {
+                auto&& _log_guard = activate_logger();
+                (void)_log_guard;
+                busy_ms[i] = stages[i]();
+            } catch (...) {
+                stage_errors[i] = std::current_exception();
+                try {
+                    _abandon_stage(i ? queues[i - 1].second : nullptr, i ? &finished[i - 1] : nullptr, i < queues.size() ? queues[i].second : nullptr,
+                        [this](GenerationRequest& request) { _release_prompt(request); });
+                } catch (...) {
+                }
+            }
+            finished[i].store(true, std::memory_order_release);
+        });
+    for (auto&& w : workers)
+        w.join();
+
+    for (auto&& e : stage_errors)
+        if (e)
+            std::rethrow_exception(e);
+
+    auto&& end = std::chrono::high_resolution_clock::now();
+    auto wall_ms = std::chrono::duration<double, std::milli>(end - start).count();
+    for (auto i : range(stage_names.size()))
+        _generate_stats.record(format("generate.pipeline.{}_occupancy", stage_names[i]), wall_ms > 0 ? busy_ms[i] / wall_ms : 0.0);
+    for (auto&& [name, queue] : queues) {
+        _generate_stats.record(format("generate.pipeline.{}_max_depth", name), queue->get_max_depth());
+        _generate_stats.record(format("generate.pipeline.{}_mean_depth", name), queue->get_mean_depth());
+    }
+
+    for (auto&& e : errors)
+        if (e)
+            std::rethrow_exception(e);
+
+    _generation_cost.total_ms = std::chrono::duration<double, std::milli>(Stats::clock::now() - cost_start).count();
+    _cost_model.update(_generation_cost, output);
+    if (_latency_budget.enabled()) {
+        _generate_stats.record("generate.cost_model.unet_ms", _cost_model.unet_ms);
+        _generate_stats.record("generate.cost_model.step_ms", _cost_model.step_ms);
+        _generate_stats.record("generate.cost_model.fixed_ms", *_cost_model.fixed_ms[output]);
+        _generate_stats.record("generate.budget_overrun_ms", std::max(0.0, wall_ms - _latency_budget.ms));
+    }
 
-    // auto&& data_preview = [](std::vector<float> const& data, std::string const& msg) {
-    //     std::vector<float> copy(data.data(), data.data() + std::min<size_t>(data.size(), 15));
-    //     error("{}: (size: {}) {}", msg, data.size(), copy);
-    // };
+    info("{} successfully generated!", prompts.size() > 1 ? format("{} {}s", prompts.size(), what) : format("{}", images ? "Image" : "Latent"));
+    _report_time("Image generation", "total", start, end);
+}
+
+
+double Context::_tokenize_stage(std::vector<std::string> const& prompts, std::vector<const unsigned char*> const* init_images, Schedule* schedule, unsigned int first_step, uint64_t first_stream, request_queue& out) {
+    double busy_ms = 0.0;
+    for (auto i : range(prompts.size())) {
+        auto&& request = std::make_unique<GenerationRequest>();
+        request->index = i;
+        request->prompt = &prompts[i];
+        request->init_image = (init_images ? (*init_images)[i] : nullptr);
+        request->schedule = schedule;
+        request->first_step = first_step;
+        request->noise_stream = first_stream + i;
+
+        auto&& tick = Stats::clock::now();
+        try {
+            _tokenizer->tokenize(request->tokens, prompts[i]);
+        } catch (...) {
+            request->error = std::current_exception();
+        }
+        auto&& tock = Stats::clock::now();
+        _generate_stats.record_time("generate.tokenize_ms", tick, tock);
+
+        // the stage is mostly idle, waiting for the next ones - a good place to prepare the noise ahead of denoising
+        try {
+            if (!request->error)
+                _generate_noise(*request);
+        } catch (...) {
+            request->error = std::current_exception();
+        }
+        busy_ms += std::chrono::duration<double, std::milli>(Stats::clock::now() - tick).count();
+
+        out.push(std::move(request));
+    }
+    out.push(nullptr);
+    return busy_ms;
+}
+
+
+double Context::_encode_stage(request_queue& in, request_queue& out) {
+    return _run_stage(in, &out, [this](GenerationRequest& request) { _encode(request); });
+}
+
+
+// takes one request at a time, or two if the second one is already waiting - in which case both are denoised together
+double Context::_denoise_stage(request_queue& in, request_queue& out, float guidance) {
+    double busy_ms = 0.0;
+    bool finished = false;
+    while (!finished) {
+        auto&& first = in.pop();
+        if (!first)
+            break;
+
+        request_ptr second;
+        if (in.try_pop(second) && !second)
+            finished = true;
+
+        std::vector<GenerationRequest*> requests;
+        for (auto&& r : { first.get(), second.get() })
+            if (r && !r->error)
+                requests.push_back(r);
+
+        if (!requests.empty()) {
+            auto&& tick = Stats::clock::now();
+            try {
+                _denoise(requests, guidance);
+            } catch (...) {
+                for (auto&& r : requests)
+                    r->error = std::current_exception();
+            }
+            busy_ms += std::chrono::duration<double, std::milli>(Stats::clock::now() - tick).count();
+        }
+
+        // denoising has finished (or failed), prompts can be evicted from the cache
+        for (auto&& r : { first.get(), second.get() })
+            if (r)
+                _release_prompt(*r);
+
+        out.push(std::move(first));
+        if (second)
+            out.push(std::move(second));
+    }
+    out.push(nullptr);
+    return busy_ms;
+}
+
+
+// with a batched decoder, latents which are already waiting (up to the decoder's batch) are decoded by a single execution;
+// it never waits for more of them, so the first images are not held back by denoising of the later ones
+double Context::_decode_stage(request_queue& in, request_queue& out, Decoder& decoder) {
+    auto batch = decoder.y->get_batch_size();
+    double busy_ms = 0.0;
+    bool finished = false;
+    while (!finished) {
+        auto&& first = in.pop();
+        if (!first)
+            break;
+
+        std::vector<request_ptr> pending;
+        pending.push_back(std::move(first));
+        request_ptr next;
+        while (pending.size() < batch && in.try_pop(next)) {
+            if (!next) {
+                finished = true;
+                break;
+            }
+            pending.push_back(std::move(next));
+        }
+
+        std::vector<GenerationRequest*> requests;
+        for (auto&& r : pending)
+            if (!r->error)
+                requests.push_back(r.get());
+
+        if (!requests.empty()) {
+            auto&& tick = Stats::clock::now();
+            try {
+                _decode(requests, decoder);
+            } catch (...) {
+                for (auto&& r : requests)
+                    r->error = std::current_exception();
+            }
+            busy_ms += std::chrono::duration<double, std::milli>(Stats::clock::now() - tick).count();
+        }
+
+        for (auto&& r : pending)
+            out.push(std::move(r));
+    }
+    out.push(nullptr);
+    return busy_ms;
+}
+
+
+double Context::_output_stage(request_queue& in, unsigned char* output, std::vector<std::exception_ptr>& errors, Decoder const& decoder) {
+    std::size_t image_len = 3 * latent_spatial * latent_spatial * upscale_factor * upscale_factor;
+    double busy_ms = 0.0;
+    request_ptr request;
+    while ((request = in.pop())) {
+        if (request->error) {
+            errors[request->index] = request->error;
+            continue;
+        }
+
+        auto&& tick = Stats::clock::now();
+        // decode img to uint8 pixels
+        qnn2uint8(output + request->index * image_len, request->img_raw.data(), decoder.img->get_desc(), decoder.pixel_lut, image_len / 3, 3, decoder.planar);
+        auto&& tock = Stats::clock::now();
+        busy_ms += std::chrono::duration<double, std::milli>(tock - tick).count();
+        _generate_stats.record_time("generate.output_ms", tick, tock);
+    }
+    return busy_ms;
+}
+
+
+double Context::_latents_output_stage(request_queue& in, float* output, std::vector<std::exception_ptr>& errors) {
+    std::size_t latent_len = latent_channels * latent_spatial * latent_spatial;
+    double busy_ms = 0.0;
+    request_ptr request;
+    while ((request = in.pop())) {
+        if (request->error) {
+            errors[request->index] = request->error;
+            continue;
+        }
+
+        auto&& tick = Stats::clock::now();
+        std::copy(request->latent.begin(), request->latent.end(), output + request->index * latent_len);
+        busy_ms += std::chrono::duration<double, std::milli>(Stats::clock::now() - tick).count();
+    }
+    return busy_ms;
+}
+
+
+void Context::_encode(GenerationRequest& request) {
+    if (request.init_image)
+        _encode_image(request);
+
+    bool hit = false;
+    request.cond = _acquire_prompt(*request.prompt, hit);
+    _generate_stats.record("generate.prompt_cache_hit", hit ? 1.0 : 0.0);
+    if (hit) {
+        debug("Using cached conditioning for prompt: \"{}\"", *request.prompt);
+        return;
+    }
+
+    auto&& tick = Stats::clock::now();
+    auto&& encoder_out = request.cond->encoder_out;
+    if (encoder_out)
+        encoder_out->activate();
+    else
+        p->activate();
+
+    tokens->set_data(request.tokens);
+    _model->cond_model.execute();
+    if (!encoder_out)
+        p->copy_to(*request.cond->p);
+
+    {
+        auto&& _guard = std::lock_guard<std::mutex>{ _prompt_cache_mutex };
+        (void)_guard;
+        request.cond->prompt = *request.prompt;
+    }
+    _report_time("Conditioning", "conditioning", tick, Stats::clock::now());
+}
 
+
+// runs the VAE encoder on the initial image of an img2img request, pixels are passed as values in [0, 1]
+void Context::_encode_image(GenerationRequest& request) {
+    auto&& tick = Stats::clock::now();
+    std::size_t pixels = latent_spatial * latent_spatial * upscale_factor * upscale_factor;
+    tmp.resize(pixels * 3);
+    for (auto p : range(pixels))
+        for (auto c : range(3u))
+            tmp[_enc_planar ? c * pixels + p : p * 3 + c] = request.init_image[p * 3 + c] / 255.0f;
+
+    enc_in->set_data(tmp);
+    _model->encoder->execute();
+    request.init_latent.resize(enc_out->get_num_elements(1));
+    enc_out->get_data(request.init_latent);
+    _report_time("Image encoding", "image_encoding", tick, Stats::clock::now());
+}
+
+
+// returns the cache entry for ``prompt``, pinned until _release_prompt; if ``hit`` is not set, the least recently used
+// entry has been taken over and the caller has to fill it in (and set its prompt once it holds valid data)
+CachedPrompt* Context::_acquire_prompt(std::string const& prompt, bool& hit) {
+    auto&& _guard = std::lock_guard<std::mutex>{ _prompt_cache_mutex };
+    (void)_guard;
+
+    CachedPrompt* ret = nullptr;
+    hit = false;
+    for (auto&& entry : _prompt_cache) {
+        if (!entry.prompt.empty() && entry.prompt == prompt) {
+            ret = &entry;
+            hit = true;
+            break;
+        }
+        if (!entry.users && (!ret || entry.last_used < ret->last_used))
+            ret = &entry;
+    }
+
+    if (!ret)
+        throw libsdod_exception(ErrorCode::INTERNAL_ERROR, format("All {} cached prompts are in use", _prompt_cache.size()), __func__, __FILE__, STR(__LINE__));
+    if (!hit)
+        ret->prompt.clear();
+    ++ret->users;
+    ret->last_used = ++_prompt_cache_clock;
+    return ret;
+}
+
+
+void Context::_release_prompt(GenerationRequest& request) {
+    if (!request.cond)
+        return;
+
+    auto&& _guard = std::lock_guard<std::mutex>{ _prompt_cache_mutex };
+    (void)_guard;
+    --request.cond->users;
+    request.cond = nullptr;
+}
+
+
+// denoises one or two images, in the latter case UNet executions of one are queued before the host-side update
+// of the other is done, so the accelerator is kept busy while the CPU is working
+void Context::_denoise(std::vector<GenerationRequest*> const& requests, float guidance) {
+    if (requests.size() > _lanes.size())
+        throw libsdod_exception(ErrorCode::INTERNAL_ERROR, format("Cannot denoise {} images at the same time", requests.size()), __func__, __FILE__, STR(__LINE__));
+
+    // nothing can be left running if we bail out with an exception
+    auto&& wait_scope_guard = scope_guard([this]() { for (auto&& lane : _lanes) lane.wait(); });
+    (void)wait_scope_guard;
+
+    // lanes are advanced in lockstep, all requests of a single call start at the same step
+    auto num_lanes = requests.size();
+    auto first_step = requests[0]->first_step;
+    auto&& schedule = *requests[0]->schedule;
+    for (auto l : range(num_lanes)) {
+        if (requests[l]->first_step != first_step || requests[l]->schedule != &schedule)
+            throw libsdod_exception(ErrorCode::INTERNAL_ERROR, "Cannot denoise images with different schedules (or starting at different steps) together", __func__, __FILE__, STR(__LINE__));
+        info("Denoising image for prompt: \"{}\"", *requests[l]->prompt);
+        _lanes[l].p_cond = &*requests[l]->cond->p;
+        _lanes[l].schedule = &schedule;
+        _lanes[l].first_step = first_step;
+        _lanes[l].host_ms = 0.0;
+        _sample_noise(_lanes[l], *requests[l]);
+    }
+
+    unsigned int steps = schedule.steps;
+    unsigned int unet_executions = 0;
+    auto&& denoise_start = Stats::clock::now();
+    unet_executions += _submit_step(_lanes[0], first_step, guidance);
+    for (auto step = first_step; step < steps; ++step) {
+        auto&& tick = Stats::clock::now();
+
+        if (num_lanes > 1)
+            unet_executions += _submit_step(_lanes[1], step, guidance);
+        _finish_step(_lanes[0], step);
+        if (step + 1 < steps)
+            unet_executions += _submit_step(_lanes[0], step + 1, guidance);
+        if (num_lanes > 1)
+            _finish_step(_lanes[1], step);
+
+        _report_time("Single iteration", "step", tick, Stats::clock::now());
+        if (std::all_of(_lanes.begin(), _lanes.begin() + num_lanes, [](DenoisingLane const& lane) { return lane.stopped_at.has_value(); }))
+            break;
+    }
+    auto&& denoise_end = Stats::clock::now();
+    _report_time("Denoising", "denoising", denoise_start, denoise_end);
+
+    // lanes stopped early made only the steps up to (and including) the one they stopped at
+    unsigned int made_steps = 0, skipped_steps = 0;
+    for (auto l : range(num_lanes)) {
+        auto end = (_lanes[l].stopped_at ? *_lanes[l].stopped_at + 1 : steps);
+        made_steps += end - first_step;
+        for (auto step = first_step + 1; step < end; ++step)
+            skipped_steps += (_step_skipping.skips(step) ? 1 : 0);
+    }
+    _generate_stats.record("generate.steps", made_steps);
+    _generate_stats.record("generate.early_stopped_steps", (steps - first_step) * num_lanes - made_steps);
+    _generate_stats.record("generate.unet_executions", unet_executions);
+    _generate_stats.record("generate.skipped_steps", skipped_steps);
+    unsigned int full_executions = (made_steps - skipped_steps) * (_batched_cfg || guidance == 1.0f ? 1 : 2);
+    _generate_stats.record("generate.guidance_skipped_unet_executions", full_executions - unet_executions);
+    _generation_cost.denoise_ms += std::chrono::duration<double, std::milli>(denoise_end - denoise_start).count();
+    _generation_cost.steps += made_steps;
+    _generation_cost.unet_executions += unet_executions;
+    for (auto l : range(num_lanes))
+        _generation_cost.host_ms += _lanes[l].host_ms;
+    if (_model->unet_middle) {
+        unsigned int reused = 0;
+        for (auto l : range(num_lanes))
+            for (auto&& f : _lanes[l].features)
+                reused += f.reused;
+        _generate_stats.record("generate.feature_cache_hits", reused);
+    }
+
+    for (auto l : range(num_lanes))
+        requests[l]->latent = _lanes[l].x_host;
+}
+
+
+void Context::_prepare_decoder(Decoder& decoder, QnnGraph& graph) {
+    // a decoder compiled with batch > 1 is used to decode several tiles of large latents at once
+    auto batch = graph.get_input_desc(0).v1.dimensions[0];
+    decoder.graph = &graph;
+    decoder.y.emplace(graph.allocate_input(0, batch));
+    decoder.img.emplace(graph.allocate_output(0, batch));
+
+    // returned images are always interleaved (HWC), the decoder can produce either layout
+    auto&& img_desc = decoder.img->get_desc();
+    std::size_t image_len = 3 * latent_spatial * latent_spatial * upscale_factor * upscale_factor;
+    if (decoder.y->get_num_elements(1) != std::size_t(latent_channels) * latent_spatial * latent_spatial)
+        throw libsdod_exception(ErrorCode::INVALID_ARGUMENT, format("Input size of decoder {} ({}) does not match the latent size: {}", graph.get_name(), decoder.y->get_num_elements(1), latent_channels * latent_spatial * latent_spatial), __func__, __FILE__, STR(__LINE__));
+    if (decoder.img->get_num_elements(1) != image_len)
+        throw libsdod_exception(ErrorCode::INVALID_ARGUMENT, format("Output size of decoder {} ({}) does not match the image size: {}", graph.get_name(), decoder.img->get_num_elements(1), image_len), __func__, __FILE__, STR(__LINE__));
+    decoder.planar = (img_desc.v1.rank == 4 && img_desc.v1.dimensions[1] == 3 && img_desc.v1.dimensions[3] != 3);
+    decoder.pixel_lut = pixel_lut(img_desc);
+    debug("Decoder {} output layout: {}, batch: {}", graph.get_name(), decoder.planar ? "NCHW" : "NHWC", batch);
+    graph.verify();
+}
+
+
+void Context::set_decoder(DecoderType type) {
+    if (type != DecoderType::FULL && type != DecoderType::FAST)
+        throw libsdod_exception(ErrorCode::INVALID_ARGUMENT, format("Invalid decoder type: {}", static_cast<int>(type)), __func__, __FILE__, STR(__LINE__));
+    _decoder_type = type;
+    if (type == DecoderType::FAST && _model && !_model->fast_decoder)
+        info("Fast decoder is not available, the full one will be used");
+}
+
+
+void Context::set_guidance_policy(GuidancePolicy const& policy) {
+    switch (policy.mode) {
+    case GuidanceMode::FULL:
+        break;
+    case GuidanceMode::TRUNCATED:
+        if (!(policy.end >= 0.0f && policy.end <= 1.0f))
+            throw libsdod_exception(ErrorCode::INVALID_ARGUMENT, format("End of guidance should be in range [0, 1], got: {}", policy.end), __func__, __FILE__, STR(__LINE__));
+        break;
+    case GuidanceMode::INTERVAL:
+        if (!(policy.start >= 0.0f && policy.start <= policy.end && policy.end <= 1.0f))
+            throw libsdod_exception(ErrorCode::INVALID_ARGUMENT, format("Guidance interval should be within [0, 1], got: [{}, {}]", policy.start, policy.end), __func__, __FILE__, STR(__LINE__));
+        break;
+    case GuidanceMode::REUSE_UNCOND:
+        if (!policy.uncond_interval)
+            throw libsdod_exception(ErrorCode::INVALID_ARGUMENT, "Interval of unconditional passes should be at least 1", __func__, __FILE__, STR(__LINE__));
+        break;
+    default:
+        throw libsdod_exception(ErrorCode::INVALID_ARGUMENT, format("Invalid guidance mode: {}", static_cast<int>(policy.mode)), __func__, __FILE__, STR(__LINE__));
+    }
+
+    _guidance_policy = policy;
+    info("Using guidance policy: {} (start: {}, end: {}, unconditional pass every {} step(s))", static_cast<int>(policy.mode), policy.start, policy.end, policy.uncond_interval);
+    if (_batched_cfg && policy.mode != GuidanceMode::FULL)
+        info("UNet runs both guidance passes in a single execution, the guidance policy will not save any executions");
+}
+
+
+void Context::set_feature_cache_interval(unsigned int interval) {
+    if (!interval)
+        throw libsdod_exception(ErrorCode::INVALID_ARGUMENT, "Interval of middle UNet executions should be at least 1", __func__, __FILE__, STR(__LINE__));
+    if (interval > 1 && (!_model || !_model->unet_middle))
+        throw libsdod_exception(ErrorCode::INVALID_ARGUMENT, format("Feature caching requires a partitioned UNet, {} has not been loaded", unet_partition_names[1]), __func__, __FILE__, STR(__LINE__));
+    _feature_cache_interval = interval;
+    info("Executing the middle UNet partition every {} step(s)", interval);
+}
+
+
+void Context::set_early_stopping(EarlyStopping const& stopping) {
+    if (!(stopping.threshold >= 0.0f))
+        throw libsdod_exception(ErrorCode::INVALID_ARGUMENT, format("Early stopping threshold should not be negative, got: {}", stopping.threshold), __func__, __FILE__, STR(__LINE__));
+    if (!stopping.patience)
+        throw libsdod_exception(ErrorCode::INVALID_ARGUMENT, "Early stopping patience should be at least 1 step", __func__, __FILE__, STR(__LINE__));
+    _early_stopping = stopping;
+    if (stopping.enabled())
+        info("Stopping denoising once the data prediction changes by less than {} on {} consecutive step(s)", stopping.threshold, stopping.patience);
+    else
+        info("Early stopping disabled");
+}
+
+
+void Context::set_latency_budget(LatencyBudget const& budget) {
+    if (!(budget.ms >= 0.0))
+        throw libsdod_exception(ErrorCode::INVALID_ARGUMENT, format("Latency budget should not be negative, got: {}", budget.ms), __func__, __FILE__, STR(__LINE__));
+    if (!budget.min_steps || budget.min_steps > budget.max_steps || budget.max_steps > solver_timesteps)
+        throw libsdod_exception(ErrorCode::INVALID_ARGUMENT, format("Budgeted steps should be a range within [1, {}], got: [{}, {}]", solver_timesteps, budget.min_steps, budget.max_steps), __func__, __FILE__, STR(__LINE__));
+    _latency_budget = budget;
+    if (budget.enabled())
+        info("Fitting generations into {}ms, with {} to {} steps", budget.ms, budget.min_steps, budget.max_steps);
+    else
+        info("Latency budget disabled");
+}
+
+
+void Context::set_step_skipping(StepSkipping skipping) {
+    if (skipping.mode != StepSkipMode::REUSE && skipping.mode != StepSkipMode::EXTRAPOLATE)
+        throw libsdod_exception(ErrorCode::INVALID_ARGUMENT, format("Invalid step skipping mode: {}", static_cast<int>(skipping.mode)), __func__, __FILE__, STR(__LINE__));
+    std::sort(skipping.steps.begin(), skipping.steps.end());
+    skipping.steps.erase(std::unique(skipping.steps.begin(), skipping.steps.end()), skipping.steps.end());
+    _step_skipping = std::move(skipping);
+    info("Skipping UNet executions of steps: {} ({})", _step_skipping.steps, _step_skipping.mode == StepSkipMode::EXTRAPOLATE ? "extrapolated" : "reused");
+}
+
+
+// final latents of ``prompts`` generated with ``skipping``, starting from the same noise as the next generation would
+void Context::_skipping_latents(std::vector<std::string> const& prompts, float guidance, StepSkipping const& skipping, std::vector<float>& latents) {
+    auto saved_skipping = _step_skipping;
+    auto saved_stopping = _early_stopping;
+    auto saved_budget = _latency_budget;
+    auto saved_streams = _noise_streams;
+    auto&& restore = scope_guard([&]() { _step_skipping = saved_skipping; _early_stopping = saved_stopping; _latency_budget = saved_budget; _noise_streams = saved_streams; });
+    (void)restore;
+
+    // all steps of the current schedule are made, so that the results depend only on the skipping
+    _early_stopping = EarlyStopping{};
+    _latency_budget = LatencyBudget{};
+    set_step_skipping(skipping);
+    auto&& output = allocate_latents(prompts.size());
+    generate_latents(prompts, guidance, output);
+    latents.assign(output.data_ptr(), output.data_ptr() + output.data_len());
+}
+
+
+double Context::measure_step_skipping(std::vector<std::string> const& prompts, float guidance, StepSkipping const& skipping) {
+    std::vector<float> reference, latents;
+    _skipping_latents(prompts, guidance, StepSkipping{}, reference);
+    _skipping_latents(prompts, guidance, skipping, latents);
+    return relative_l2(latents, reference);
+}
+
+
+std::vector<double> Context::calibrate_step_skipping(std::vector<std::string> const& prompts, float guidance, StepSkipMode mode) {
+    if (!_schedule)
+        throw libsdod_exception(ErrorCode::INVALID_ARGUMENT, "Time schedule has not been prepared", __func__, __FILE__, STR(__LINE__));
+
+    std::vector<float> reference, latents;
+    _skipping_latents(prompts, guidance, StepSkipping{}, reference);
+    std::vector<double> ret(_schedule->steps, std::numeric_limits<double>::infinity());
+    for (unsigned int step = 1; step < _schedule->steps; ++step) {
+        _skipping_latents(prompts, guidance, StepSkipping{ .mode = mode, .steps = std::vector<unsigned int>{ step } }, latents);
+        ret[step] = relative_l2(latents, reference);
+        debug("Skipping step {}: latent deviation {}", step, ret[step]);
+    }
+    return ret;
+}
+
+
+UncondPass GuidancePolicy::get_pass(unsigned int step, unsigned int first_step, unsigned int steps) const {
+    switch (mode) {
+    case GuidanceMode::TRUNCATED:
+        return (step < end * steps ? UncondPass::RUN : UncondPass::SKIP);
+    case GuidanceMode::INTERVAL:
+        return (step >= start * steps && step < end * steps ? UncondPass::RUN : UncondPass::SKIP);
+    case GuidanceMode::REUSE_UNCOND:
+        return ((step - first_step) % uncond_interval == 0 ? UncondPass::RUN : UncondPass::REUSE);
+    default:
+        return UncondPass::RUN;
+    }
+}
+
+
+void CostModel::update(GenerationCost const& cost, unsigned int output) {
+    bool first = !valid();
+    auto&& blend = [first](double& average, double sample) { average = (first ? sample : average + cost_model_smoothing * (sample - average)); };
+    if (cost.unet_executions)
+        blend(unet_ms, std::max(0.0, cost.denoise_ms - cost.host_ms) / cost.unet_executions);
+    if (cost.steps)
+        blend(step_ms, cost.host_ms / cost.steps);
+
+    auto fixed = std::max(0.0, cost.total_ms - cost.denoise_ms);
+    auto&& average = fixed_ms[output];
+    average = (average ? *average + cost_model_smoothing * (fixed - *average) : fixed);
+}
+
+
+double CostModel::predict(unsigned int images, unsigned int steps, unsigned int unet_executions, unsigned int output) const {
+    // an output which has not been measured yet is assumed to be as expensive as the most expensive one which has
+    auto fixed = fixed_ms[output];
+    if (!fixed)
+        for (auto&& ms : fixed_ms)
+            if (ms && (!fixed || *ms > *fixed))
+                fixed = ms;
+    return fixed.value_or(0.0) + images * (steps * step_ms + unet_executions * unet_ms);
+}
+
+
+// UNet executions of a single image denoised from ``first_step`` out of ``steps`` with ``policy``, see _submit_step
+unsigned int Context::_count_unet_executions(unsigned int steps, unsigned int first_step, float guidance, GuidancePolicy const& policy) const {
+    unsigned int ret = 0;
+    for (auto step = first_step; step < steps; ++step) {
+        if (step != first_step && _step_skipping.skips(step))
+            continue;
+        if (_batched_cfg || guidance == 1.0f)
+            ret += 1;
+        else
+            ret += (policy.get_pass(step, first_step, steps) == UncondPass::RUN ? 2 : 1);
+    }
+    return ret;
+}
+
+
+// the largest number of steps which is predicted to fit, with the current guidance policy or, if it does not fit at all,
+// with truncated guidance; if nothing fits the minimum number of steps is made as cheaply as possible
+// ``schedule`` is replaced by the one of the planned number of steps, the active one (see prepare_schedule) is left as it is
+GuidancePolicy Context::_plan_budget(unsigned int images, float guidance, unsigned int output, float strength, Schedule*& schedule) {
+    auto&& budget = _latency_budget;
+    if (!budget.enabled())
+        return _guidance_policy;
+
+    _generate_stats.record("generate.budget_ms", budget.ms);
+    if (!_cost_model.valid()) {
+        info("No generations have been measured yet, making {} steps", budget.max_steps);
+        schedule = _get_schedule(budget.max_steps);
+        _generate_stats.record("generate.budget_steps", budget.max_steps);
+        return _guidance_policy;
+    }
+
+    auto&& made_steps = [strength](unsigned int steps) { return std::min(static_cast<unsigned int>(steps * strength), steps); };
+    auto&& predict = [&](unsigned int steps, GuidancePolicy const& policy) {
+        auto made = made_steps(steps);
+        return _cost_model.predict(images, made, _count_unet_executions(steps, steps - made, guidance, policy), output);
+    };
+
+    std::vector<GuidancePolicy> policies = { _guidance_policy };
+    if (guidance != 1.0f && !_batched_cfg)
+        policies.push_back(GuidancePolicy{ .mode = GuidanceMode::TRUNCATED, .end = budget_guidance_end });
+
+    std::optional<std::pair<unsigned int, std::size_t>> plan; // steps and index of the policy
+    for (auto p : range(policies.size())) {
+        for (auto steps = budget.max_steps; steps >= budget.min_steps && !plan; --steps)
+            if (made_steps(steps) && predict(steps, policies[p]) <= budget.ms)
+                plan.emplace(steps, p);
+        if (plan)
+            break;
+    }
+    if (!plan) {
+        std::size_t cheapest = 0;
+        for (auto p : range(policies.size()))
+            if (predict(budget.min_steps, policies[p]) < predict(budget.min_steps, policies[cheapest]))
+                cheapest = p;
+        plan.emplace(budget.min_steps, cheapest);
+        info("Even {} step(s) are predicted to take {}ms, exceeding the budget of {}ms", budget.min_steps, predict(budget.min_steps, policies[cheapest]), budget.ms);
+    }
+
+    auto [steps, p] = *plan;
+    auto predicted = predict(steps, policies[p]);
+    debug("Planned {} step(s){} for {} {}(s), predicted: {}ms", steps, p ? " with truncated guidance" : "", images, output == latents_output ? "latent" : "image", predicted);
+    schedule = _get_schedule(steps);
+    _generate_stats.record("generate.budget_steps", steps);
+    _generate_stats.record("generate.budget_predicted_ms", predicted);
+    _generate_stats.record("generate.budget_truncated_guidance", p ? 1.0 : 0.0);
+    return policies[p];
+}
+
+
+Decoder& Context::_select_decoder() {
+    auto&& ret = _decoders[static_cast<int>(_decoder_type)];
+    bool fallback = !ret.graph;
+    _generate_stats.record("generate.fast_decoder", (_decoder_type == DecoderType::FAST && !fallback) ? 1.0 : 0.0);
+    return fallback ? _decoders[static_cast<int>(DecoderType::FULL)] : ret;
+}
+
+
+// ``requests`` must not hold more latents than the decoder's batch
+void Context::_decode(std::vector<GenerationRequest*> const& requests, Decoder& decoder) {
+    auto&& tick = Stats::clock::now();
+    for (auto b : range(requests.size()))
+        decoder.y->set_batch_data(b, requests[b]->latent);
+    decoder.graph->execute();
+    // the output tensor is reused by the next execution, conversion is left to the output stage
+    auto&& raw = decoder.img->get_raw_data();
+    auto raw_len = decoder.img->get_num_elements(1) * decoder.img->get_element_size();
+    for (auto b : range(requests.size()))
+        requests[b]->img_raw.assign(raw.begin() + b * raw_len, raw.begin() + (b + 1) * raw_len);
+    debug("Decoded {} image(s) of {} elements", requests.size(), decoder.img->get_num_elements(1));
+    _report_time("Decoding", "decoding", tick, Stats::clock::now());
+}
+
+
+void Context::decode_latents(std::vector<const float*> const& latents, Buffer<unsigned char>& output) {
+    if (_failed_and_gave_up)
+        return;
+    if (!_qnn_initialized)
+        return;
+    if (!_model)
+        return;
+
+    if (latents.empty())
+        throw libsdod_exception(ErrorCode::INVALID_ARGUMENT, "No latents given", __func__, __FILE__, STR(__LINE__));
+    std::size_t latent_len = latent_channels * latent_spatial * latent_spatial;
+    std::size_t image_len = 3 * latent_spatial * latent_spatial * upscale_factor * upscale_factor;
+    if (output.data_len() < latents.size() * image_len)
+        throw libsdod_exception(ErrorCode::INVALID_ARGUMENT, format("Output buffer is too small for {} images: {}", latents.size(), output.data_len()), __func__, __FILE__, STR(__LINE__));
+
+    _generate_stats.clear();
     auto&& burst_scope_guard = scope_guard([this](){ _qnn->start_burst(); }, [this]() { _qnn->end_burst(); });
     (void)burst_scope_guard;
 
-    auto&& tick = std::chrono::high_resolution_clock::now();
-    auto&& tokens_host = _tokenizer->tokenize(prompt);
-    tokens->set_data(tokens_host);
-    _model->cond_model.execute();
-    p->get_data(p_host);
-    p_cond->set_data(p_host);
-    auto&& tock = std::chrono::high_resolution_clock::now();
-    _report_time("Conditioning", tick, tock);
+    auto&& decoder = _select_decoder();
+    auto batch = decoder.y->get_batch_size();
+    auto raw_len = decoder.img->get_num_elements(1) * decoder.img->get_element_size();
+    auto&& start = Stats::clock::now();
+    for (std::size_t first = 0; first < latents.size(); first += batch) {
+        auto&& tick = Stats::clock::now();
+        auto count = std::min<std::size_t>(batch, latents.size() - first);
+        for (auto b : range(count)) {
+            tmp.assign(latents[first + b], latents[first + b] + latent_len);
+            decoder.y->set_batch_data(b, tmp);
+        }
+        decoder.graph->execute();
+        for (auto b : range(count))
+            qnn2uint8(output.data_ptr() + (first + b) * image_len, decoder.img->get_raw_data().data() + b * raw_len, decoder.img->get_desc(), decoder.pixel_lut, image_len / 3, 3, decoder.planar);
+        _generate_stats.record_time("generate.decoding_ms", tick, Stats::clock::now());
+    }
+
+    info("{} latent(s) decoded in {} execution(s)", latents.size(), (latents.size() + batch - 1) / batch);
+    _report_time("Decoding", "total", start, Stats::clock::now());
+}
 
-    for (auto& f : x_host)
-        f = _normal(_random_gen);
 
-    // //debug
-    // tmp.resize(p_cond->get_num_elements(1));
-    // p->get_data(tmp);
-    // data_preview(tmp, "Prompt embedding");
+void Context::decode(std::vector<float> const& latent, unsigned int latent_height, unsigned int latent_width, Buffer<unsigned char>& output) {
+    if (_failed_and_gave_up)
+        return;
+    if (!_qnn_initialized)
+        return;
+    if (!_model)
+        return;
 
-    unsigned int step = 0;
-    for (auto&& t_host : t_embeddings) {
-        tick = std::chrono::high_resolution_clock::now();
+    if (latent_height < latent_spatial || latent_width < latent_spatial)
+        throw libsdod_exception(ErrorCode::INVALID_ARGUMENT, format("Latent of size {}x{} is smaller than the decoder's input: {}x{}", latent_height, latent_width, latent_spatial, latent_spatial), __func__, __FILE__, STR(__LINE__));
+    if (latent.size() != std::size_t(latent_height) * latent_width * latent_channels)
+        throw libsdod_exception(ErrorCode::INVALID_ARGUMENT, format("Latent of size {}x{} should hold {} values, got: {}", latent_height, latent_width, std::size_t(latent_height) * latent_width * latent_channels, latent.size()), __func__, __FILE__, STR(__LINE__));
+    std::size_t image_len = std::size_t(3) * latent_height * latent_width * upscale_factor * upscale_factor;
+    if (output.data_len() < image_len)
+        throw libsdod_exception(ErrorCode::INVALID_ARGUMENT, format("Output buffer is too small for an image of {} bytes: {}", image_len, output.data_len()), __func__, __FILE__, STR(__LINE__));
+
+    _generate_stats.clear();
+    auto&& burst_scope_guard = scope_guard([this](){ _qnn->start_burst(); }, [this]() { _qnn->end_burst(); });
+    (void)burst_scope_guard;
+
+    auto&& decoder = _select_decoder();
+    auto&& tick = Stats::clock::now();
+    if (latent_height == latent_spatial && latent_width == latent_spatial) {
+        decoder.y->set_batch_data(0, latent);
+        decoder.graph->execute();
+        qnn2uint8(output.data_ptr(), decoder.img->get_raw_data().data(), decoder.img->get_desc(), decoder.pixel_lut, image_len / 3, 3, decoder.planar);
+    } else
+        _decode_tiled(decoder, latent, latent_height, latent_width, output.data_ptr());
+    _report_time("Decoding", "decoding", tick, Stats::clock::now());
+}
+
+
+// Decodes tiles of the size of the decoder's input, overlapping by at least tile_overlap, as many at once as the decoder's batch allows.
+// Tiles are blended linearly across their overlaps. Rows of the image are accumulated in a strip as high as a single tile and written
+// out as soon as no further tile covers them, so memory used does not depend on the height of the image.
+void Context::_decode_tiled(Decoder& decoder, std::vector<float> const& latent, unsigned int latent_height, unsigned int latent_width, unsigned char* output) {
+    auto tile = latent_spatial;
+    auto&& rows = _tile_starts(latent_height, tile, tile_overlap);
+    auto&& cols = _tile_starts(latent_width, tile, tile_overlap);
+    std::vector<std::vector<float>> row_weights, col_weights;
+    for (auto i : range(rows.size()))
+        row_weights.push_back(_tile_weights(rows, i, tile, upscale_factor));
+    for (auto i : range(cols.size()))
+        col_weights.push_back(_tile_weights(cols, i, tile, upscale_factor));
+
+    std::size_t tile_px = std::size_t(tile) * upscale_factor;
+    std::size_t image_width = std::size_t(latent_width) * upscale_factor;
+    std::size_t image_height = std::size_t(latent_height) * upscale_factor;
+    std::vector<float> tile_in(std::size_t(tile) * tile * latent_channels);
+    std::vector<float> tile_out(tile_px * tile_px * 3);
+    std::vector<float> strip(tile_px * image_width * 3, 0.0f);
+    std::vector<float> strip_weights(tile_px * image_width, 0.0f);
+    std::size_t strip_start = 0; // first row of the image held by the strip
+
+    // writes out rows of the strip before ``end`` and moves the remaining ones to its top
+    auto&& flush = [&](std::size_t end) {
+        auto n = (end - strip_start) * image_width;
+        for (auto i : range(n))
+            for (auto c : range(3u))
+                output[(strip_start * image_width + i) * 3 + c] = float2pixel(strip[i * 3 + c] / strip_weights[i]);
+        std::move(strip.begin() + n * 3, strip.end(), strip.begin());
+        std::fill(strip.end() - n * 3, strip.end(), 0.0f);
+        std::move(strip_weights.begin() + n, strip_weights.end(), strip_weights.begin());
+        std::fill(strip_weights.end() - n, strip_weights.end(), 0.0f);
+        strip_start = end;
+    };
+
+    std::vector<std::pair<std::size_t, std::size_t>> tiles;
+    for (auto r : range(rows.size()))
+        for (auto c : range(cols.size()))
+            tiles.emplace_back(r, c);
+
+    auto batch = decoder.y->get_batch_size();
+    for (std::size_t first = 0; first < tiles.size(); first += batch) {
+        auto count = std::min<std::size_t>(batch, tiles.size() - first);
+        for (auto b : range(count)) {
+            auto&& [r, c] = tiles[first + b];
+            for (auto ty : range(tile)) {
+                auto src = latent.data() + ((std::size_t(rows[r]) + ty) * latent_width + cols[c]) * latent_channels;
+                std::copy(src, src + std::size_t(tile) * latent_channels, tile_in.data() + std::size_t(ty) * tile * latent_channels);
+            }
+            decoder.y->set_batch_data(b, tile_in);
+        }
+        decoder.graph->execute();
+
+        // tiles are accumulated in order, so all tiles of the previous rows are already in the strip
+        for (auto b : range(count)) {
+            auto&& [r, c] = tiles[first + b];
+            std::size_t y0 = std::size_t(rows[r]) * upscale_factor;
+            std::size_t x0 = std::size_t(cols[c]) * upscale_factor;
+            if (y0 > strip_start)
+                flush(y0);
+
+            decoder.img->get_batch_data(b, tile_out);
+            for (auto py : range(tile_px))
+                for (auto px : range(tile_px)) {
+                    auto w = row_weights[r][py] * col_weights[c][px];
+                    auto dst = (py + y0 - strip_start) * image_width + x0 + px;
+                    strip_weights[dst] += w;
+                    for (auto ch : range(3u)) {
+                        auto src = (decoder.planar ? (ch * tile_px + py) * tile_px + px : (py * tile_px + px) * 3 + ch);
+                        strip[dst * 3 + ch] += w * tile_out[src];
+                    }
+                }
+        }
+    }
+    flush(image_height);
 
-        // data_preview(x_host, format("Unet input, step: {}", step));
-        // data_preview(t_host, format("Unet t, step: {}", step));
+    debug("Decoded a {}x{} latent in {} tiles", latent_height, latent_width, tiles.size());
+    _generate_stats.record("generate.decoder_tiles", tiles.size());
+}
 
-        t->set_data(t_host);
-        x->set_data(x_host);
-        p_cond->activate();
 
-        _model->unet.execute();
+void Context::_report_time(const char* name, const char* stat, Stats::clock::time_point const& t1, Stats::clock::time_point const& t2) {
+    auto&& diff = std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t1);
+    info("{} took {}ms", name, diff.count());
+    _generate_stats.record_time(format("generate.{}_ms", stat), t1, t2);
+}
 
-        // //debug
-        // tmp.resize(e->get_num_elements(1));
-        // e->get_data(tmp);
-        // data_preview(tmp, "    Cond output");
 
-        if (guidance == 1.0f)
-            e->get_data(e_host);
-        else {
-            e->get_data(e_host, guidance);
+void Context::_allocate_lane(DenoisingLane& lane, unsigned int unet_batch, bool activate) {
+    auto&& unet_out = (_model->unet_outputs ? *_model->unet_outputs : _model->unet);
+    lane.x.emplace(_allocate_unet_input(0, unet_batch, activate));
+    lane.e.emplace(unet_out.allocate_output(0, unet_batch, activate));
+    // with separate passes, the unconditional output is written to its own buffer so both can be combined after the second pass
+    if (unet_batch == 1)
+        lane.e_uncond.emplace(unet_out.allocate_output(0, 1, false));
+    // the same holds for the features of a partitioned UNet, the ones of either pass might be reused by later steps
+    if (_model->unet_middle) {
+        _allocate_features(lane.features[0], unet_batch, activate);
+        if (unet_batch == 1)
+            _allocate_features(lane.features[1], 1, false);
+    }
 
-            p_uncond->activate();
+    lane.x_host.resize(latent_channels * latent_spatial * latent_spatial);
+    if (unet_batch == 1)
+        lane.e_host.resize(lane.x_host.size());
+    if (lane.x->get_num_elements(1) != lane.x_host.size() || lane.e->get_num_elements(1) != lane.x_host.size())
+        throw libsdod_exception(ErrorCode::INVALID_ARGUMENT, format("UNet input/output sizes ({}, {}) do not match the latent size: {}", lane.x->get_num_elements(1), lane.e->get_num_elements(1), lane.x_host.size()), __func__, __FILE__, STR(__LINE__));
+}
 
-            _model->unet.execute();
 
-            // //debug
-            // tmp.resize(e->get_num_elements(1));
-            // e->get_data(tmp);
-            // data_preview(tmp, "    Uncond output");
+// with a partitioned UNet, the input is also bound to the inputs of the later partitions with the same name
+QnnTensor Context::_allocate_unet_input(unsigned int idx, unsigned int batch, bool activate) {
+    auto&& ret = _model->unet.allocate_input(idx, batch, activate);
+    for (auto&& g : { _model->unet_middle, _model->unet_outputs })
+        if (g)
+            for (auto i : range(g->get_num_inputs()))
+                if (_same_name(g->get_input_desc(i), _model->unet.get_input_desc(idx)))
+                    ret.link(g->attach_input(i, ret, activate));
+    return ret;
+}
 
-            e->get_data(e_host, 1-guidance, true);
 
-            // data_preview(e_host, format("Unet output, step: {}", step));
+// each output of the input and middle partitions is bound to the inputs of the later partitions with the same name,
+// partitions are then executed one after another reading each other's outputs directly
+void Context::_allocate_features(UNetFeatures& features, unsigned int batch, bool activate) {
+    auto&& producers = std::array{ &_model->unet, _model->unet_middle };
+    auto&& consumers = std::array{ _model->unet_middle, _model->unet_outputs };
+    for (auto p : range(producers.size()))
+        for (auto o : range(producers[p]->get_num_outputs())) {
+            auto&& t = features.tensors.emplace_back(producers[p]->allocate_output(o, batch, activate));
+            for (auto c = p; c < consumers.size(); ++c)
+                for (auto i : range(consumers[c]->get_num_inputs()))
+                    if (_same_name(consumers[c]->get_input_desc(i), producers[p]->get_output_desc(o)))
+                        t.link(consumers[c]->attach_input(i, t, activate));
         }
+}
 
-        _solver->update(step++, x_host, e_host);
 
-        tock = std::chrono::high_resolution_clock::now();
-        _report_time("Single iteration", tick, tock);
+// done by the tokenization stage, so the noise of a request is ready before the previous ones have been denoised;
+// elements do not depend on each other (see normal_noise), so the buffer is filled in chunks by several threads
+void Context::_generate_noise(GenerationRequest& request) {
+    auto&& tick = Stats::clock::now();
+    request.noise.resize(latent_channels * latent_spatial * latent_spatial);
+    auto elements = request.noise.size();
+    auto chunks = (elements + noise_chunk - 1) / noise_chunk;
+    auto&& fill = [this, &request, elements](std::size_t chunk) {
+        auto first = chunk * noise_chunk;
+        normal_noise(request.noise.data() + first, std::min(noise_chunk, elements - first), _seed, request.noise_stream, first);
+    };
+
+    std::vector<std::future<void>> workers;
+    for (std::size_t c = 1; c < chunks; ++c)
+        workers.push_back(std::async(std::launch::async, fill, c));
+    fill(0);
+    for (auto&& w : workers)
+        w.get();
+    _generate_stats.record_time("generate.noise_ms", tick, Stats::clock::now());
+}
+
+
+// starting point of the denoising loop: pure noise or, for img2img, the encoded image noised to the first step made
+void Context::_sample_noise(DenoisingLane& lane, GenerationRequest const& request) {
+    if (request.noise.size() != lane.x_host.size())
+        throw libsdod_exception(ErrorCode::INTERNAL_ERROR, format("Initial noise has not been generated for prompt: \"{}\"", *request.prompt), __func__, __FILE__, STR(__LINE__));
+    if (!request.init_latent.empty()) {
+        auto alpha = lane.schedule->solver->get_alphas()[request.first_step];
+        auto sigma = lane.schedule->solver->get_sigmas()[request.first_step];
+        for (auto i : range(lane.x_host.size()))
+            lane.x_host[i] = alpha * request.init_latent[i] + sigma * request.noise[i];
+    } else
+        std::copy(request.noise.begin(), request.noise.end(), lane.x_host.begin());
+    // the first step made is a first-order one, see DPMSolver::update_fused
+    lane.history.clear();
+    lane.prev_history.clear();
+    lane.converged_steps = 0;
+    lane.stopped_at.reset();
+    for (auto&& f : lane.features) {
+        f.valid = false;
+        f.reused = 0;
     }
 
-    tick = std::chrono::high_resolution_clock::now();
+    // after this, x is updated directly by _finish_step
+    lane.x->set_batch_data(0, lane.x_host);
+    lane.x->broadcast_batch(0);
+}
+
 
-    y->set_data(x_host);
-    _model->decoder.execute();
-    img->get_data(img_host); //, 1 / 0.18215, false);
-    debug("Output image has {} elements", img_host.size());
-    auto* output_ptr = output.data_ptr();
-    // decode img to uint8 pixels
-    for (auto i : range(img_host.size())) {
-        auto f = img_host[i];
-        output_ptr[i] = static_cast<uint8_t>(std::clamp(255 * f, 0.0f, 255.0f));
+// activates tensors of the lane (and the ones of the step) and queues UNet execution(s) for the given step,
+// returns the number of queued executions
+unsigned int Context::_submit_step(DenoisingLane& lane, unsigned int step, float guidance) {
+    if (lane.stopped_at)
+        return 0;
+    // skipped steps are made entirely by _finish_step
+    lane.skip_step = (_step_skipping.skips(step) && !lane.history.empty());
+    if (lane.skip_step)
+        return 0;
+
+    auto pass = (guidance != 1.0f ? _guidance_policy.get_pass(step, lane.first_step, lane.schedule->steps) : UncondPass::SKIP);
+    lane.step_guidance = (pass == UncondPass::SKIP ? 1.0f : guidance);
+    lane.reuse_uncond = (pass == UncondPass::REUSE && !_batched_cfg);
+
+    lane.x->activate();
+    lane.schedule->t_inputs[step].activate();
+    lane.p_cond->activate();
+    lane.e->activate();
+    lane.cond_done = _submit_unet(lane.features[0], step);
+    if (_batched_cfg || pass != UncondPass::RUN)
+        return 1;
+
+    // the second pass writes to its own output buffer, so the conditional output can be converted while it is running
+    p_uncond->activate();
+    lane.e_uncond->activate();
+    lane.uncond_done = _submit_unet(lane.features[1], step);
+    return 2;
+}
+
+
+// queues a single UNet pass, with a partitioned UNet the partitions are chained through QnnGraph::submit_sequence - each one
+// is handed to the backend from the completion of the previous one, nothing relies on the backend executing requests in the
+// order of submission, so don't replace it with back-to-back execute_async calls; the middle one runs only if its outputs are too old
+std::future<void> Context::_submit_unet(UNetFeatures& features, unsigned int step) {
+    if (!_model->unet_middle)
+        return _model->unet.submit();
+
+    for (auto&& t : features.tensors)
+        t.activate();
+
+    // partitions depend on each other's outputs, so each of them is submitted only once the previous one has finished
+    std::vector<QnnGraph*> partitions = { &_model->unet };
+    if (!features.valid || step - features.computed_step >= _feature_cache_interval) {
+        partitions.push_back(_model->unet_middle);
+        features.valid = true;
+        features.computed_step = step;
+    } else
+        ++features.reused;
+    partitions.push_back(_model->unet_outputs);
+    return QnnGraph::submit_sequence(partitions);
+}
+
+
+// waits for the UNet execution(s) of the lane, then combines the outputs (applying guidance), updates the latent
+// and writes it to the UNet input in a single pass
+void Context::_finish_step(DenoisingLane& lane, unsigned int step) {
+    if (lane.stopped_at)
+        return;
+
+    // an extrapolated step needs the data predictions of both previous steps
+    std::vector<float> prev_history;
+    if (_step_skipping.mode == StepSkipMode::EXTRAPOLATE && _step_skipping.skips(step + 1))
+        prev_history = lane.history;
+    auto&& keep_prev = scope_guard([&lane, &prev_history]() { lane.prev_history = std::move(prev_history); });
+    (void)keep_prev;
+
+    if (lane.skip_step) {
+        auto&& tick = Stats::clock::now();
+        lane.schedule->solver->update_estimated(step, lane.x_host, lane.history, lane.prev_history, [](std::size_t, float) {});
+        lane.x->set_batch_data(0, lane.x_host);
+        lane.x->broadcast_batch(0);
+        lane.host_ms += std::chrono::duration<double, std::milli>(Stats::clock::now() - tick).count();
+        return;
     }
 
-    tock = std::chrono::high_resolution_clock::now();
-    _report_time("Decoding", tick, tock);
+    // convergence is measured by comparing the data predictions made by this step and the previous one
+    bool measure = (_early_stopping.enabled() && !lane.history.empty());
+    if (measure)
+        lane.prev_prediction = lane.history;
+
+    auto guidance = lane.step_guidance;
+    bool separate_uncond = lane.uncond_done.valid() || lane.reuse_uncond;
+    try {
+        lane.cond_done.get();
+    } catch (...) {
+        lane.wait();
+        throw;
+    }
 
-    info("Image successfully generated!");
-    auto&& end = std::chrono::high_resolution_clock::now();
-    _report_time("Image generation", start, end);
+    // host-side work (but not waiting for the unconditional pass) is measured separately from UNet executions, see CostModel
+    auto&& tick = Stats::clock::now();
+    const uint8_t* cond = lane.e->get_raw_data().data();
+    auto x_dst = lane.x->get_raw_data().data();
+    if (lane.uncond_done.valid()) {
+        // the conditional output is converted while the unconditional pass is still running, which shortens the update left after it;
+        // with a reused unconditional output there is nothing to overlap with and the single pass below is not slower
+        prescale_cond(cond, lane.e->get_desc(), guidance, lane.e_host);
+        auto&& wait_start = Stats::clock::now();
+        lane.uncond_done.get();
+        tick += Stats::clock::now() - wait_start;
+        guided_solver_update(*lane.schedule->solver, step, lane.x_host, lane.history, lane.e_host, lane.e_uncond->get_raw_data().data(), lane.e->get_desc(), guidance, x_dst, lane.x->get_desc(), lane.x->get_batch_size());
+    } else {
+        const uint8_t* uncond = (separate_uncond ? lane.e_uncond->get_raw_data().data() : (guidance != 1.0f ? cond + lane.x_host.size() * lane.e->get_element_size() : nullptr));
+        guided_solver_update(*lane.schedule->solver, step, lane.x_host, lane.history, cond, uncond, lane.e->get_desc(), guidance, x_dst, lane.x->get_desc(), lane.x->get_batch_size());
+    }
+    lane.host_ms += std::chrono::duration<double, std::milli>(Stats::clock::now() - tick).count();
+
+    // the remaining steps are not made (and the latest prediction becomes the final latent) once it has settled, see EarlyStopping
+    if (!measure)
+        return;
+    if (relative_l2(lane.history, lane.prev_prediction) >= _early_stopping.threshold)
+        lane.converged_steps = 0;
+    else if (++lane.converged_steps >= _early_stopping.patience && step + 1 < lane.schedule->steps) {
+        debug("Denoising converged at step {}, stopping", step);
+        lane.stopped_at = step;
+        lane.x_host = lane.history;
+    }
+}
+
+
+void Context::get_stats(const char* const*& names, const double*& values, unsigned int& count) {
+    _exported_stats = _setup_stats.get_samples();
+    auto&& generate_samples = _generate_stats.get_samples();
+    _exported_stats.insert(_exported_stats.end(), generate_samples.begin(), generate_samples.end());
+
+    _exported_names.clear();
+    _exported_values.clear();
+    for (auto&& sample : _exported_stats) {
+        _exported_names.push_back(sample.name.c_str());
+        _exported_values.push_back(sample.value);
+    }
+
+    names = _exported_names.data();
+    values = _exported_values.data();
+    count = _exported_stats.size();
+}
+
+
+void Context::start_recording(std::string const& path) {
+    if (!_model)
+        throw libsdod_exception(ErrorCode::RUNTIME_ERROR, "Cannot start recording before models are loaded", __func__, __FILE__, STR(__LINE__));
+
+    stop_recording();
+    _recorder = std::make_shared<TraceWriter>(path);
+    _add_observer(_recorder);
+}
+
+
+void Context::stop_recording() {
+    if (!_recorder)
+        return;
+
+    _remove_observer(_recorder);
+    _recorder.reset();
+}
+
+
+void Context::start_calibration() {
+    if (!_model)
+        throw libsdod_exception(ErrorCode::RUNTIME_ERROR, "Cannot start calibration before models are loaded", __func__, __FILE__, STR(__LINE__));
+
+    stop_calibration();
+    _calibrator = std::make_shared<Calibrator>();
+    _add_observer(_calibrator);
+    info("Calibration started");
+}
+
+
+void Context::save_calibration(std::string const& output_dir, unsigned int bitwidth, double percentile) const {
+    if (!_calibrator)
+        throw libsdod_exception(ErrorCode::RUNTIME_ERROR, "Calibration has not been started", __func__, __FILE__, STR(__LINE__));
+    if (!_calibrator->get_num_executions())
+        info("Warning: no model executions have been observed since calibration was started");
+
+    _calibrator->save(output_dir, bitwidth, percentile);
 }
 
 
-Buffer<unsigned char> Context::allocate_output() const {
-    std::size_t required_len = 3 * latent_spatial * latent_spatial * upscale_factor * upscale_factor;
+void Context::stop_calibration() {
+    if (!_calibrator)
+        return;
+
+    _remove_observer(_calibrator);
+    _calibrator.reset();
+}
+
+
+void Context::_add_observer(std::shared_ptr<ExecutionObserver> const& observer) {
+    for (auto&& g : { &_model->cond_model, &_model->unet, _model->unet_middle, _model->unet_outputs, &_model->decoder, &_model->temb, _model->fast_decoder, _model->encoder })
+        if (g)
+            g->add_observer(observer);
+}
+
+
+void Context::_remove_observer(std::shared_ptr<ExecutionObserver> const& observer) {
+    for (auto&& g : { &_model->cond_model, &_model->unet, _model->unet_middle, _model->unet_outputs, &_model->decoder, &_model->temb, _model->fast_decoder, _model->encoder })
+        if (g)
+            g->remove_observer(observer);
+}
+
+
+Buffer<unsigned char> Context::allocate_output(unsigned int images, unsigned int latent_height, unsigned int latent_width) const {
+    std::size_t required_len = std::size_t(images) * 3 * latent_height * latent_width * upscale_factor * upscale_factor;
     return Buffer<unsigned char>(required_len);
 }
 
 
-Buffer<unsigned char> Context::reuse_buffer(unsigned char* buffer, unsigned int buffer_len) const {
+Buffer<float> Context::allocate_latents(unsigned int count) const {
+    return Buffer<float>(std::size_t(count) * latent_channels * latent_spatial * latent_spatial);
+}
+
+
+Buffer<float> Context::reuse_latents_buffer(float* buffer, unsigned int buffer_len, unsigned int count) const {
+    if (!buffer)
+        throw libsdod_exception(ErrorCode::INVALID_ARGUMENT, "Asked to reuse a nullptr buffer", __func__, __FILE__, STR(__LINE__));
+
+    std::size_t required_len = std::size_t(count) * latent_channels * latent_spatial * latent_spatial;
+    if (buffer_len < required_len)
+        throw libsdod_exception(ErrorCode::INVALID_ARGUMENT, "Provided buffer is too small, missing " + std::to_string(required_len - buffer_len) + " floats", __func__, __FILE__, STR(__LINE__));
+
+    return Buffer<float>(buffer, buffer_len);
+}
+
+
+Buffer<unsigned char> Context::reuse_buffer(unsigned char* buffer, unsigned int buffer_len, unsigned int images, unsigned int latent_height, unsigned int latent_width) const {
     if (!buffer)
         throw libsdod_exception(ErrorCode::INVALID_ARGUMENT, "Asked to reuse a nullptr buffer", __func__, __FILE__, STR(__LINE__));
 
-    std::size_t required_len = 3 * latent_spatial * latent_spatial * upscale_factor * upscale_factor;
+    std::size_t required_len = std::size_t(images) * 3 * latent_height * latent_width * upscale_factor * upscale_factor;
     if (buffer_len < required_len)
         throw libsdod_exception(ErrorCode::INVALID_ARGUMENT, "Provided buffer is too small, missing " + std::to_string(required_len - buffer_len) + " bytes", __func__, __FILE__, STR(__LINE__));
 
@@ -1,9 +1,16 @@
 #ifndef LIBSDOD_CONTEXT_H
 #define LIBSDOD_CONTEXT_H
 
+#include <array>
+#include <algorithm>
+#include <memory>
 #include <string>
+#include <future>
+#include <mutex>
+#include <exception>
+#include <functional>
 #include <optional>
-#include <random>
+#include <vector>
 
 #include "errors.h"
 #include "buffer.h"
@@ -11,24 +18,235 @@
 #include "logging.h"
 #include "dpm_solver.h"
 #include "tokenizer.h"
+#include "stats.h"
+#include "calibration.h"
+#include "spsc_queue.h"
 
 
 namespace libsdod {
 
 
+// the UNet is either a single graph or split into three partitions executed one after another: shallow input blocks (taking
+// all UNet inputs: x, t and p), deep middle blocks and shallow output blocks (producing e); other inputs of the later partitions
+// are bound to the UNet input or the output of an earlier partition with the same name, see Context::_allocate_features
 struct StableDiffusionModel {
-    graph_ref unet;
+    graph_ref unet; // the whole UNet, or its input partition
+    QnnGraph* unet_middle = nullptr; // partitioned UNet only, see Context::set_feature_cache_interval
+    QnnGraph* unet_outputs = nullptr;
     graph_ref cond_model;
     graph_ref decoder;
     graph_ref temb;
+    QnnGraph* fast_decoder = nullptr; // optional tiny autoencoder, see DecoderType
+    QnnGraph* encoder = nullptr; // optional VAE encoder, used by img2img
 };
 
 
+// FULL uses the model's VAE decoder, FAST a tiny autoencoder (TAESD) decoder taking the same latents, which is several times cheaper
+// but produces less detailed images (e.g. for previews and thumbnails); if the latter is not available, the full one is used
+enum class DecoderType : int {
+    FULL,
+    FAST
+};
+
+
+// classifier-free guidance policies saving UNet executions by skipping the unconditional pass on some steps:
+// FULL guides every step, TRUNCATED only the steps before ``end`` (a fraction of the schedule), INTERVAL only the ones
+// between ``start`` and ``end``, REUSE_UNCOND computes the unconditional prediction every ``uncond_interval`` steps
+// and reuses the last one in between; steps without guidance run only the conditional pass (as with guidance 1)
+enum class GuidanceMode : int {
+    FULL,
+    TRUNCATED,
+    INTERVAL,
+    REUSE_UNCOND
+};
+
+
+// what a single step does with the unconditional pass
+enum class UncondPass : int {
+    RUN,
+    REUSE, // use the previous step's prediction
+    SKIP // no guidance
+};
+
+
+struct GuidancePolicy {
+    GuidanceMode mode = GuidanceMode::FULL;
+    float start = 0.0f;
+    float end = 1.0f;
+    unsigned int uncond_interval = 1;
+
+    // ``first_step`` is the first step made by the image, out of ``steps`` steps of the schedule
+    UncondPass get_pass(unsigned int step, unsigned int first_step, unsigned int steps) const;
+};
+
+
+// steps made without executing the UNet at all, the data prediction of the solver (see DPMSolver::update_estimated) is instead
+// REUSEd from the previous step or EXTRAPOLATEd linearly from the two previous ones; the first step made by an image is never skipped
+enum class StepSkipMode : int {
+    REUSE,
+    EXTRAPOLATE
+};
+
+
+struct StepSkipping {
+    StepSkipMode mode = StepSkipMode::REUSE;
+    std::vector<unsigned int> steps; // sorted, steps of the schedule to skip
+
+    bool skips(unsigned int step) const { return std::binary_search(steps.begin(), steps.end(), step); }
+};
+
+
+// tensors passed between partitions of a partitioned UNet (see StableDiffusionModel) by a single pass of a denoising lane,
+// outputs of the middle partition are kept between steps so that the pass can reuse them instead of executing it (DeepCache)
+struct UNetFeatures {
+    tensor_list tensors; // outputs of the partitions, each linked to the inputs it is bound to
+    bool valid = false; // the middle partition has been executed for the image being denoised
+    unsigned int computed_step = 0; // step of its last execution
+    unsigned int reused = 0; // executions skipped for the image
+};
+
+
+// ends denoising of an image early once the data prediction of the solver (its estimate of the final latent) has changed by less
+// than ``threshold`` (relative L2 distance) on ``patience`` consecutive steps, the last prediction is then used as the final latent;
+// only steps which execute the UNet are measured, a threshold of 0 disables early stopping
+struct EarlyStopping {
+    float threshold = 0.0f;
+    unsigned int patience = 1;
+
+    bool enabled() const { return threshold > 0.0f; }
+};
+
+
+// a latency budget of a single generation (e.g. a service level objective) used instead of a fixed number of steps: each call
+// makes as many steps (between ``min_steps`` and ``max_steps``) as CostModel predicts to fit, see Context::set_latency_budget
+struct LatencyBudget {
+    double ms = 0.0; // 0 disables
+    unsigned int min_steps = 1;
+    unsigned int max_steps = 20;
+
+    bool enabled() const { return ms > 0.0; }
+};
+
+
+// measurements of a single generation, used to update CostModel
+struct GenerationCost {
+    double total_ms = 0.0;
+    double denoise_ms = 0.0; // spent in denoising loops
+    double host_ms = 0.0; // part of the above spent in host-side step updates (solver, conversions)
+    unsigned int steps = 0; // made by all images, including skipped ones
+    unsigned int unet_executions = 0;
+};
+
+
+// running estimates of the cost of a generation, exponential moving averages of recent measurements so that they follow
+// changes in load or thermal state of the device; ``output`` selects the decoder (indexed by DecoderType, latents-only generation last)
+struct CostModel {
+    double unet_ms = 0.0; // a single UNet execution
+    double step_ms = 0.0; // host-side work of a single step of an image
+    std::array<std::optional<double>, 3> fixed_ms; // the rest of a call: tokenization, text encoding, decoding and output not overlapped with denoising
+
+    bool valid() const { return std::any_of(fixed_ms.begin(), fixed_ms.end(), [](auto const& ms) { return ms.has_value(); }); }
+    void update(GenerationCost const& cost, unsigned int output);
+    // ``steps`` and ``unet_executions`` are made by each of ``images`` images
+    double predict(unsigned int images, unsigned int steps, unsigned int unet_executions, unsigned int output) const;
+};
+
+
+// a decoder together with its (batched, see Context::_decode_tiled) input and output
+struct Decoder {
+    QnnGraph* graph = nullptr;
+    std::optional<QnnTensor> y;
+    std::optional<QnnTensor> img;
+    bool planar = false; // output is NCHW rather than NHWC
+    std::vector<uint8_t> pixel_lut; // see pixel_lut(), built once as the output encoding is fixed
+};
+
+
+// solver tables and encoded timesteps for a particular number of steps, the context keeps a few recently used ones
+// so that switching between step counts (see Context::prepare_schedule) does not recompute them
+struct Schedule {
+    unsigned int steps = 0; // 0 if the entry does not hold valid data
+    std::optional<DPMSolver> solver;
+    std::vector<QnnTensor> t_inputs; // sequence of encoded timesteps, in the UNet's input format
+    uint64_t last_used = 0;
+};
+
+
+// UNet conditioning of a recently used prompt, already in the UNet's input format (and, with batched guidance,
+// followed by the unconditional one), so that repeated prompts skip text encoding and conversion altogether;
+// an entry is pinned (``users``) from text encoding until denoising of the request has finished
+struct CachedPrompt {
+    std::string prompt; // empty if the entry does not hold valid data
+    std::optional<QnnTensor> p;
+    std::optional<QnnTensor> encoder_out; // memory of ``p`` bound to the text encoder's output, if both use the same format
+    unsigned int users = 0;
+    uint64_t last_used = 0;
+};
+
+
+// buffers of a single image being denoised, the context holds two sets of them bound to the same UNet slots
+// so that execution of one image can overlap host-side work (solver update, conversions) of the other;
+// constant inputs (timesteps, prompts) are not copied to the lane but shared tensors are activated instead
+struct DenoisingLane {
+    std::optional<QnnTensor> x;
+    QnnTensor const* p_cond = nullptr; // see CachedPrompt
+    Schedule const* schedule = nullptr;
+    unsigned int first_step = 0;
+    std::optional<QnnTensor> e;
+    std::optional<QnnTensor> e_uncond;
+    std::array<UNetFeatures, 2> features; // of the conditional and unconditional passes (only the former with batched guidance)
+
+    std::vector<float> x_host;
+    std::vector<float> e_host; // conditional UNet output (see prescale_cond), converted while the unconditional pass is running
+    std::vector<float> history; // state of the multistep solver
+    std::vector<float> prev_history; // the one before, kept only if the next step is extrapolated (see StepSkipping)
+    bool skip_step = false; // the submitted step does not execute the UNet
+    float step_guidance = 1.0f; // used by the submitted step, see GuidancePolicy
+    bool reuse_uncond = false; // e_uncond still holds the prediction of an earlier step, see GuidancePolicy
+    std::vector<float> prev_prediction; // ``history`` before the last update, kept only with early stopping
+    double host_ms = 0.0; // spent in step updates of the current image, see CostModel
+    unsigned int converged_steps = 0; // consecutive steps which changed the prediction less than the threshold, see EarlyStopping
+    std::optional<unsigned int> stopped_at; // last step made if denoising has been stopped early, x_host holds the final latent
+
+    std::future<void> cond_done;
+    std::future<void> uncond_done;
+
+    void wait();
+    void reset();
+};
+
+
+// a single image passing through the stages of Context::generate, each stage fills in its results
+// and passes the request on; if a stage fails, the remaining ones only pass the request (and the error) through
+struct GenerationRequest {
+    std::size_t index;
+    std::string const* prompt;
+
+    const unsigned char* init_image = nullptr; // img2img only, see Context::generate
+    Schedule const* schedule = nullptr; // the one active when the request was made
+    uint64_t noise_stream = 0; // see Context::set_seed
+    unsigned int first_step = 0; // steps of the schedule before this one are skipped (img2img)
+
+    std::vector<Tokenizer::token_type> tokens;
+    CachedPrompt* cond = nullptr; // see Context::_acquire_prompt
+    std::vector<float> noise; // initial noise, see Context::_generate_noise
+    std::vector<float> init_latent; // encoded init_image
+    std::vector<float> latent; // final output of the denoising loop
+    std::vector<uint8_t> img_raw; // decoder output, stored exactly as produced by the backend
+
+    std::exception_ptr error;
+};
+
+using request_ptr = std::unique_ptr<GenerationRequest>;
+using request_queue = SpscQueue<request_ptr>; // nullptr marks the end of the stream
+
+
 class Context {
 public:
-    Context(std::string const& models_dir, unsigned int latent_channels, unsigned int latent_spatial, unsigned int upscale_factor, LogLevel log_level, bool use_htp=true);
+    Context(std::string const& models_dir, unsigned int latent_channels, unsigned int latent_spatial, unsigned int upscale_factor, LogLevel log_level, QnnBackendType backend=QnnBackendType::HTP);
     virtual ~Context();
 
+    void init(unsigned int steps);
     void init_mt(unsigned int steps);
 
     void initialize_qnn();
@@ -36,16 +254,90 @@ public:
     void load_tokenizer();
     void prepare_solver();
     void prepare_buffers();
+    // selects the number of denoising steps made by subsequent generations, schedules of recently used step counts are cached
     void prepare_schedule(unsigned int steps);
+    unsigned int get_steps() const { return _schedule ? _schedule->steps : 0; }
 
+    // initial noise of the n-th image generated after this call depends only on the seed and n (see normal_noise),
+    // so images are the same regardless of how they are split between calls and how they are denoised
     void set_seed(unsigned int seed);
 
     void generate(std::string const& prompt, float guidance, Buffer<unsigned char>& output);
+    // generates one image per prompt, written one after another to ``output``; prompts are processed by a pipeline
+    // of stages running in their own threads: tokenization, text encoding, denoising, decoding and output conversion,
+    // so e.g. decoding of one image overlaps denoising of the next one; images which reach the denoising stage
+    // at the same time are denoised in pairs, alternating UNet executions between the two
+    void generate(std::vector<std::string> const& prompts, float guidance, Buffer<unsigned char>& output);
+    // img2img: each image starts from the matching (RGB, [H, W, C], same size as the output) image in ``init_images``, encoded with
+    // the VAE encoder and noised to the point of the schedule given by ``strength`` - only the remaining steps are run, so e.g.
+    // strength 0.4 makes 40% of the denoising steps (1 gives almost unrelated images, the closer to 0 the closer to the init image)
+    void generate(std::vector<std::string> const& prompts, std::vector<const unsigned char*> const& init_images, float strength, float guidance, Buffer<unsigned char>& output);
+    // same as generate but stops after the denoising loop, final latents (in the UNet's [H, W, C] order) are written one after another to ``output``
+    void generate_latents(std::vector<std::string> const& prompts, float guidance, Buffer<float>& output);
+
+    // decodes latents of the models' size (e.g. produced by generate_latents) to images written one after another to ``output``,
+    // as many at once as the decoder's batch allows
+    void decode_latents(std::vector<const float*> const& latents, Buffer<unsigned char>& output);
+    // decodes a latent ([H, W, C] order) of any size, at least as large as the decoder's input, to an image of
+    // (H * upscale_factor) x (W * upscale_factor) pixels; larger latents are decoded in overlapping tiles, see _decode_tiled
+    void decode(std::vector<float> const& latent, unsigned int latent_height, unsigned int latent_width, Buffer<unsigned char>& output);
+
+    unsigned int get_latent_channels() const { return latent_channels; }
+
+    // selects the decoder used by subsequent calls to generate and decode
+    void set_decoder(DecoderType type);
+    DecoderType get_decoder() const { return _decoder_type; }
+
+    // selects the guidance policy used by subsequent generations, UNet executions it saves are reported as "generate.guidance_skipped_unet_executions";
+    // with batched guidance (see prepare_buffers) both passes always run together, so only the guidance itself is affected
+    void set_guidance_policy(GuidancePolicy const& policy);
+    GuidancePolicy const& get_guidance_policy() const { return _guidance_policy; }
+
+    // with a partitioned UNet, subsequent generations execute its middle partition only every ``interval`` steps of each image (and pass)
+    // and reuse its last outputs in between, running only the shallow partitions; reused executions are reported as "generate.feature_cache_hits"
+    void set_feature_cache_interval(unsigned int interval);
+    unsigned int get_feature_cache_interval() const { return _feature_cache_interval; }
+
+    // selects the steps made by subsequent generations without executing the UNet, their number is reported as "generate.skipped_steps"
+    void set_step_skipping(StepSkipping skipping);
+    StepSkipping const& get_step_skipping() const { return _step_skipping; }
+    // helpers to choose the steps to skip: relative L2 distance between the final latents generated for ``prompts`` with the given
+    // skipping and without any, for the current seed and schedule (images generated by them do not advance the seed, see set_seed)
+    double measure_step_skipping(std::vector<std::string> const& prompts, float guidance, StepSkipping const& skipping);
+    // as above, for each step of the schedule skipped on its own (infinity for the first one, which cannot be skipped)
+    std::vector<double> calibrate_step_skipping(std::vector<std::string> const& prompts, float guidance, StepSkipMode mode);
+
+    // selects the convergence criterion used by subsequent generations to stop denoising early, steps saved by it are reported as "generate.early_stopped_steps"
+    void set_early_stopping(EarlyStopping const& stopping);
+    EarlyStopping const& get_early_stopping() const { return _early_stopping; }
+
+    // with a budget, each subsequent generation selects its own number of steps (only for that call, get_steps still reports the ones
+    // set by prepare_schedule, which are used again once the budget is disabled) and, if even ``min_steps`` would not fit with the current
+    // guidance policy, a cheaper one for that call; the choice is based on the costs of previous generations (see CostModel),
+    // until there are any the maximum number of steps is made
+    void set_latency_budget(LatencyBudget const& budget);
+    LatencyBudget const& get_latency_budget() const { return _latency_budget; }
+    CostModel const& get_cost_model() const { return _cost_model; }
 
     ErrorTable get_error_table() const { return _error_table; }
 
-    Buffer<unsigned char> allocate_output() const;
-    Buffer<unsigned char> reuse_buffer(unsigned char* buffer, unsigned int buffer_len) const;
+    void get_stats(const char* const*& names, const double*& values, unsigned int& count);
+
+    void start_recording(std::string const& path);
+    void stop_recording();
+
+    // gathers ranges of all inputs and outputs of the models during subsequent generations, see Calibrator
+    void start_calibration();
+    void save_calibration(std::string const& output_dir, unsigned int bitwidth, double percentile) const;
+    void stop_calibration();
+
+    // buffers for ``images`` images, decoded from latents of the given size (by default, the one the models use)
+    Buffer<unsigned char> allocate_output(unsigned int images = 1) const { return allocate_output(images, latent_spatial, latent_spatial); }
+    Buffer<unsigned char> allocate_output(unsigned int images, unsigned int latent_height, unsigned int latent_width) const;
+    Buffer<unsigned char> reuse_buffer(unsigned char* buffer, unsigned int buffer_len, unsigned int images = 1) const { return reuse_buffer(buffer, buffer_len, images, latent_spatial, latent_spatial); }
+    Buffer<unsigned char> reuse_buffer(unsigned char* buffer, unsigned int buffer_len, unsigned int images, unsigned int latent_height, unsigned int latent_width) const;
+    Buffer<float> allocate_latents(unsigned int count) const;
+    Buffer<float> reuse_latents_buffer(float* buffer, unsigned int buffer_len, unsigned int count) const;
 
     Logger& get_logger() { return _logger; }
     Logger const& get_logger() const { return _logger; }
@@ -56,16 +348,23 @@ private:
     unsigned int latent_channels;
     unsigned int latent_spatial;
     unsigned int upscale_factor;
-    bool use_htp;
+    QnnBackendType backend;
 
     bool _failed_and_gave_up = false;
     bool _qnn_initialized = false;
+    bool _batched_cfg = false;
 
     ErrorTable _error_table;
     Logger _logger;
 
-    std::mt19937 _random_gen;
-    std::normal_distribution<float> _normal;
+    Stats _setup_stats;
+    Stats _generate_stats;
+    std::vector<Sample> _exported_stats;
+    std::vector<const char*> _exported_names;
+    std::vector<double> _exported_values;
+
+    uint64_t _seed;
+    uint64_t _noise_streams = 0; // images generated since the seed was set
 
     std::optional<DPMSolver> _solver;
 
@@ -74,28 +373,88 @@ private:
     std::shared_ptr<QnnBackend> _qnn;
     std::optional<StableDiffusionModel> _model;
     std::optional<Tokenizer> _tokenizer;
+    std::shared_ptr<TraceWriter> _recorder;
+    std::shared_ptr<Calibrator> _calibrator;
 
-    std::vector<float> p_host;
-    std::vector<float> x_host;
-    std::vector<float> e_host;
-    std::vector<float> img_host;
     std::vector<float> tmp;
 
-    std::vector<std::vector<float>> t_embeddings; // sequence of encoded timesteps
+    std::vector<Schedule> _schedules;
+    Schedule* _schedule = nullptr; // the active one
+    uint64_t _schedule_clock = 0;
 
-    std::optional<QnnTensor> temb_in;
+    std::optional<QnnTensor> temb_in; // batched if the time embedding model allows, see prepare_schedule
     std::optional<QnnTensor> temb_out;
     std::optional<QnnTensor> tokens;
+    std::optional<QnnTensor> enc_in; // VAE encoder, if available
+    std::optional<QnnTensor> enc_out;
+    bool _enc_planar = false; // encoder input is NCHW rather than NHWC
     std::optional<QnnTensor> p;
-    std::optional<QnnTensor> x;
-    std::optional<QnnTensor> t;
-    std::optional<QnnTensor> p_cond;
-    std::optional<QnnTensor> p_uncond;
-    std::optional<QnnTensor> e;
-    std::optional<QnnTensor> y;
-    std::optional<QnnTensor> img;
+    std::optional<QnnTensor> p_uncond; // shared by both lanes
+    std::array<DenoisingLane, 2> _lanes;
+    std::vector<CachedPrompt> _prompt_cache;
+    std::mutex _prompt_cache_mutex;
+    uint64_t _prompt_cache_clock = 0;
+    DecoderType _decoder_type = DecoderType::FULL;
+    GuidancePolicy _guidance_policy;
+    StepSkipping _step_skipping;
+    unsigned int _feature_cache_interval = 1;
+    EarlyStopping _early_stopping;
+    LatencyBudget _latency_budget;
+    CostModel _cost_model;
+    GenerationCost _generation_cost; // of the ongoing generation
+    std::array<Decoder, 2> _decoders; // indexed by DecoderType, graph of the fast one is nullptr if the model is not available
 
     tensor_list other_tensors;
+
+    Schedule* _get_schedule(unsigned int steps);
+    void _compute_schedule(Schedule& schedule, unsigned int steps);
+    void _allocate_lane(DenoisingLane& lane, unsigned int unet_batch, bool activate);
+    QnnTensor _allocate_unet_input(unsigned int idx, unsigned int batch, bool activate);
+    void _allocate_features(UNetFeatures& features, unsigned int batch, bool activate);
+    void _generate_noise(GenerationRequest& request);
+    void _skipping_latents(std::vector<std::string> const& prompts, float guidance, StepSkipping const& skipping, std::vector<float>& latents);
+    void _sample_noise(DenoisingLane& lane, GenerationRequest const& request);
+    CachedPrompt* _acquire_prompt(std::string const& prompt, bool& hit);
+    void _release_prompt(GenerationRequest& request);
+    // selects the number of steps (and the guidance policy, which is returned) of a generation with a latency budget, see LatencyBudget
+    GuidancePolicy _plan_budget(unsigned int images, float guidance, unsigned int output, float strength, Schedule*& schedule);
+    unsigned int _count_unet_executions(unsigned int steps, unsigned int first_step, float guidance, GuidancePolicy const& policy) const;
+    unsigned int _submit_step(DenoisingLane& lane, unsigned int step, float guidance);
+    std::future<void> _submit_unet(UNetFeatures& features, unsigned int step);
+    void _finish_step(DenoisingLane& lane, unsigned int step);
+
+    // runs the pipeline, see generate; if ``images`` is nullptr, decoding is skipped and latents are written to ``latents`` instead
+    // ``init_images`` (and ``strength``) are only given for img2img
+    void _generate(std::vector<std::string> const& prompts, float guidance, unsigned char* images, float* latents,
+        std::vector<const unsigned char*> const* init_images = nullptr, float strength = 1.0f);
+
+    // pipeline stages, see generate, each returns the time it was busy (in ms)
+    double _tokenize_stage(std::vector<std::string> const& prompts, std::vector<const unsigned char*> const* init_images, Schedule* schedule, unsigned int first_step, uint64_t first_stream, request_queue& out);
+    double _encode_stage(request_queue& in, request_queue& out);
+    double _denoise_stage(request_queue& in, request_queue& out, float guidance);
+    double _decode_stage(request_queue& in, request_queue& out, Decoder& decoder);
+    double _output_stage(request_queue& in, unsigned char* output, std::vector<std::exception_ptr>& errors, Decoder const& decoder);
+    double _latents_output_stage(request_queue& in, float* output, std::vector<std::exception_ptr>& errors);
+
+    void _encode(GenerationRequest& request);
+    void _encode_image(GenerationRequest& request);
+    void _denoise(std::vector<GenerationRequest*> const& requests, float guidance);
+    void _prepare_decoder(Decoder& decoder, QnnGraph& graph);
+    Decoder& _select_decoder();
+    void _decode(std::vector<GenerationRequest*> const& requests, Decoder& decoder);
+    void _decode_tiled(Decoder& decoder, std::vector<float> const& latent, unsigned int latent_height, unsigned int latent_width, unsigned char* output);
+
+    void _report_time(const char* name, const char* stat, Stats::clock::time_point const& t1, Stats::clock::time_point const& t2);
+
+    void _add_observer(std::shared_ptr<ExecutionObserver> const& observer);
+    void _remove_observer(std::shared_ptr<ExecutionObserver> const& observer);
+
+    template <class Fn>
+    void _timed_phase(const char* name, Fn&& fn) {
+        auto&& tick = Stats::clock::now();
+        fn();
+        _setup_stats.record_time(format("setup.{}_ms", name), tick, Stats::clock::now());
+    }
 };
 
 }
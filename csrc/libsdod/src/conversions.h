@@ -0,0 +1,432 @@
+#ifndef LIBSDOD_CONVERSIONS_H
+#define LIBSDOD_CONVERSIONS_H
+
+#include "errors.h"
+#include "utils.h"
+
+#include <string>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <limits>
+#include <vector>
+#include <algorithm>
+#include <type_traits>
+#include <bit>
+
+#include <QnnTypes.h>
+
+
+namespace libsdod {
+
+std::string dtype_to_str(Qnn_DataType_t dtype);
+
+
+template <bool Accum, bool Scale, class T, class U>
+void tf2any(T* out, const U* in, int32_t offset, float scale, std::size_t elements, float accum_scale) {
+    static_assert(std::is_unsigned<U>::value, "tf2float supports only unsigned types!");
+    double offset_d = static_cast<double>(offset);
+    for (auto i : range(elements)) {
+        double quant = static_cast<double>(in[i]);
+        if constexpr (Accum && Scale)
+            out[i] += static_cast<T>(accum_scale * static_cast<float>((quant + offset_d) * scale));
+        else if constexpr (Accum)
+            out[i] += static_cast<T>((quant + offset_d) * scale);
+        else if constexpr (Scale)
+            out[i] = static_cast<T>(accum_scale * static_cast<float>((quant + offset_d) * scale));
+        else
+            out[i] = static_cast<T>((quant + offset_d) * scale);
+    }
+}
+
+template <bool Accum, bool Scale, class T, class U>
+void any2tf(T* out, const U* in, int32_t offset, float scale, std::size_t elements, float accum_scale) {
+    static_assert(std::is_unsigned<T>::value, "float2tf supports only unsigned types!");
+
+    std::size_t bits = sizeof(T) * 8;
+    double max_in = double((std::size_t(1) << bits) - 1);
+    double enc_min = offset * scale;
+    double enc_max = (max_in + offset) * scale;
+    double enc_range = enc_max - enc_min;
+    int lower = 0;
+    int upper = (int)max_in;
+
+    T quant_scale;
+    if constexpr (Scale) {
+        quant_scale = static_cast<T>(std::clamp<int>(std::round(max_in * (accum_scale - enc_min) / enc_range), lower, upper));
+    }
+
+    for (auto i : range(elements)) {
+        int quant = std::clamp<int>(std::round(max_in * (static_cast<double>(in[i]) - enc_min) / enc_range), lower, upper);
+        if constexpr (Accum && Scale)
+            out[i] += quant_scale * static_cast<T>(quant);
+        else if constexpr (Accum)
+            out[i] += static_cast<T>(quant);
+        else if constexpr (Scale)
+            out[i] = quant_scale * static_cast<T>(quant);
+        else
+            out[i] = static_cast<T>(quant);
+    }
+}
+
+template <bool Accum, bool Scale, class T, class U>
+void simple_cast(T* dst, const U* src, std::size_t elements, float scale) {
+    if constexpr (!Accum && !Scale && std::is_same<T, U>::value)
+        std::memcpy(dst, src, elements*sizeof(T));
+    else {
+        for (auto i : range(elements)) {
+            if constexpr (Accum && Scale)
+                dst[i] += static_cast<T>(static_cast<float>(src[i]) * scale);
+            else if constexpr (Accum)
+                dst[i] += static_cast<T>(src[i]);
+            else if constexpr (Scale)
+                dst[i] = static_cast<T>(static_cast<float>(src[i]) * scale);
+            else
+                dst[i] = static_cast<T>(src[i]);
+        }
+    }
+}
+
+
+
+//arguments are such that first is always qnn memory, second is always host
+template <bool Accum, bool Scale, class T>
+void qnn2host(const void* src, T* dst, unsigned int elements, const Qnn_Tensor_t& desc, float scale) {
+    switch (desc.v1.dataType) {
+    case QNN_DATATYPE_UFIXED_POINT_8:
+        tf2any<Accum, Scale>(dst, reinterpret_cast<const uint8_t*>(src), desc.v1.quantizeParams.scaleOffsetEncoding.offset, desc.v1.quantizeParams.scaleOffsetEncoding.scale, elements, scale);
+        break;
+
+    case QNN_DATATYPE_UFIXED_POINT_16:
+        tf2any<Accum, Scale>(dst, reinterpret_cast<const uint16_t*>(src), desc.v1.quantizeParams.scaleOffsetEncoding.offset, desc.v1.quantizeParams.scaleOffsetEncoding.scale, elements, scale);
+        break;
+
+    case QNN_DATATYPE_FLOAT_16: return simple_cast<Accum, Scale>(dst, reinterpret_cast<const __fp16*>(src), elements, scale);
+    case QNN_DATATYPE_FLOAT_32: return simple_cast<Accum, Scale>(dst, reinterpret_cast<const float*>(src), elements, scale);
+
+    case QNN_DATATYPE_UINT_8: return simple_cast<Accum, Scale>(dst, reinterpret_cast<const uint8_t*>(src), elements, scale);
+    case QNN_DATATYPE_UINT_16: return simple_cast<Accum, Scale>(dst, reinterpret_cast<const uint16_t*>(src), elements, scale);
+    case QNN_DATATYPE_UINT_32: return simple_cast<Accum, Scale>(dst, reinterpret_cast<const uint32_t*>(src), elements, scale);
+    case QNN_DATATYPE_UINT_64: return simple_cast<Accum, Scale>(dst, reinterpret_cast<const uint64_t*>(src), elements, scale);
+
+    case QNN_DATATYPE_INT_8: return simple_cast<Accum, Scale>(dst, reinterpret_cast<const int8_t*>(src), elements, scale);
+    case QNN_DATATYPE_INT_16: return simple_cast<Accum, Scale>(dst, reinterpret_cast<const int16_t*>(src), elements, scale);
+    case QNN_DATATYPE_INT_32: return simple_cast<Accum, Scale>(dst, reinterpret_cast<const int32_t*>(src), elements, scale);
+    case QNN_DATATYPE_INT_64: return simple_cast<Accum, Scale>(dst, reinterpret_cast<const int64_t*>(src), elements, scale);
+
+    default:
+        throw libsdod_exception(ErrorCode::INVALID_ARGUMENT, format("Unexpected source tensor data type when copying to a host buffer: {}", dtype_to_str(desc.v1.dataType)), __func__, __FILE__, STR(__LINE__));
+    }
+}
+
+
+template <bool Accum, bool Scale, class T>
+void host2qnn(void* dst, const T* src, unsigned int elements, const Qnn_Tensor_t& desc, float scale) {
+    switch (desc.v1.dataType) {
+    case QNN_DATATYPE_UFIXED_POINT_8:
+        any2tf<Accum, Scale>(reinterpret_cast<uint8_t*>(dst), src, desc.v1.quantizeParams.scaleOffsetEncoding.offset, desc.v1.quantizeParams.scaleOffsetEncoding.scale, elements, scale);
+        break;
+
+    case QNN_DATATYPE_UFIXED_POINT_16:
+        any2tf<Accum, Scale>(reinterpret_cast<uint16_t*>(dst), src, desc.v1.quantizeParams.scaleOffsetEncoding.offset, desc.v1.quantizeParams.scaleOffsetEncoding.scale, elements, scale);
+        break;
+
+    case QNN_DATATYPE_FLOAT_16: return simple_cast<Accum, Scale>(reinterpret_cast<__fp16*>(dst), src, elements, scale);
+    case QNN_DATATYPE_FLOAT_32: return simple_cast<Accum, Scale>(reinterpret_cast<float*>(dst), src, elements, scale);
+
+    case QNN_DATATYPE_UINT_8: return simple_cast<Accum, Scale>(reinterpret_cast<uint8_t*>(dst), src, elements, scale);
+    case QNN_DATATYPE_UINT_16: return simple_cast<Accum, Scale>(reinterpret_cast<uint16_t*>(dst), src, elements, scale);
+    case QNN_DATATYPE_UINT_32: return simple_cast<Accum, Scale>(reinterpret_cast<uint32_t*>(dst), src, elements, scale);
+    case QNN_DATATYPE_UINT_64: return simple_cast<Accum, Scale>(reinterpret_cast<uint64_t*>(dst), src, elements, scale);
+
+    case QNN_DATATYPE_INT_8: return simple_cast<Accum, Scale>(reinterpret_cast<int8_t*>(dst), src, elements, scale);
+    case QNN_DATATYPE_INT_16: return simple_cast<Accum, Scale>(reinterpret_cast<int16_t*>(dst), src, elements, scale);
+    case QNN_DATATYPE_INT_32: return simple_cast<Accum, Scale>(reinterpret_cast<int32_t*>(dst), src, elements, scale);
+    case QNN_DATATYPE_INT_64: return simple_cast<Accum, Scale>(reinterpret_cast<int64_t*>(dst), src, elements, scale);
+
+    default:
+        throw libsdod_exception(ErrorCode::INVALID_ARGUMENT, format("Unexpected destination tensor data type when copying a host buffer: {}", dtype_to_str(desc.v1.dataType)), __func__, __FILE__, STR(__LINE__));
+    }
+}
+
+
+// classifier-free guidance over two QNN buffers with the same encoding: dst = guidance * cond + (1 - guidance) * uncond
+template <class T>
+void tf_guided2float(float* dst, const T* cond, const T* uncond, int32_t offset, float scale, std::size_t elements, float guidance) {
+    static_assert(std::is_unsigned<T>::value, "tf_guided2float supports only unsigned types!");
+    float cond_scale = guidance * scale;
+    float uncond_scale = (1 - guidance) * scale;
+    float bias = offset * scale;
+    for (auto i : range(elements))
+        dst[i] = cond_scale * static_cast<float>(cond[i]) + uncond_scale * static_cast<float>(uncond[i]) + bias;
+}
+
+template <class T>
+void guided_cast(float* dst, const T* cond, const T* uncond, std::size_t elements, float guidance) {
+    for (auto i : range(elements))
+        dst[i] = guidance * static_cast<float>(cond[i]) + (1 - guidance) * static_cast<float>(uncond[i]);
+}
+
+inline void guided2host(const void* cond, const void* uncond, float* dst, unsigned int elements, const Qnn_Tensor_t& desc, float guidance) {
+    switch (desc.v1.dataType) {
+    case QNN_DATATYPE_UFIXED_POINT_8:
+        return tf_guided2float(dst, reinterpret_cast<const uint8_t*>(cond), reinterpret_cast<const uint8_t*>(uncond), desc.v1.quantizeParams.scaleOffsetEncoding.offset, desc.v1.quantizeParams.scaleOffsetEncoding.scale, elements, guidance);
+    case QNN_DATATYPE_UFIXED_POINT_16:
+        return tf_guided2float(dst, reinterpret_cast<const uint16_t*>(cond), reinterpret_cast<const uint16_t*>(uncond), desc.v1.quantizeParams.scaleOffsetEncoding.offset, desc.v1.quantizeParams.scaleOffsetEncoding.scale, elements, guidance);
+    case QNN_DATATYPE_FLOAT_16: return guided_cast(dst, reinterpret_cast<const __fp16*>(cond), reinterpret_cast<const __fp16*>(uncond), elements, guidance);
+    case QNN_DATATYPE_FLOAT_32: return guided_cast(dst, reinterpret_cast<const float*>(cond), reinterpret_cast<const float*>(uncond), elements, guidance);
+
+    default:
+        throw libsdod_exception(ErrorCode::INVALID_ARGUMENT, format("Unexpected source tensor data type when applying guidance: {}", dtype_to_str(desc.v1.dataType)), __func__, __FILE__, STR(__LINE__));
+    }
+}
+
+
+// (de)quantization of single elements, for kernels which fuse conversions with other computations
+//
+// Kernels can also work in the "raw" domain, i.e. directly on the stored integers (``real = (raw + offset) * scale``):
+// any linear combination of values with weights summing to 1 is then equal to ``raw_scale() * combination of raw values + raw_bias()``,
+// so scale and offset can be applied once at the end (or folded into other coefficients). For floating-point types the raw domain is
+// the same as the real one.
+template <class T, bool Quantized>
+struct ElementCodec {
+    using type = T;
+    static constexpr bool quantized = Quantized;
+
+    float scale = 1.0f;
+    float inv_scale = 1.0f;
+    float offset = 0.0f;
+
+    float decode(T value) const {
+        if constexpr (Quantized)
+            return (static_cast<float>(value) + offset) * scale;
+        else
+            return static_cast<float>(value);
+    }
+
+    T encode(float value) const {
+        // clamped value is non-negative so rounding can be done by truncation
+        if constexpr (Quantized)
+            return static_cast<T>(std::clamp(value * inv_scale - offset, 0.0f, static_cast<float>(std::numeric_limits<T>::max())) + 0.5f);
+        else
+            return static_cast<T>(value);
+    }
+
+    float raw(T value) const { return static_cast<float>(value); }
+    float raw_scale() const { return Quantized ? scale : 1.0f; }
+    float raw_bias() const { return Quantized ? offset * scale : 0.0f; }
+};
+
+// calls ``fn`` with an ElementCodec matching the data type of ``desc``, only floating-point types (incl. quantized) are supported
+template <class Fn>
+void visit_codec(const Qnn_Tensor_t& desc, Fn&& fn) {
+    auto&& q = desc.v1.quantizeParams.scaleOffsetEncoding;
+    switch (desc.v1.dataType) {
+    case QNN_DATATYPE_UFIXED_POINT_8: return fn(ElementCodec<uint8_t, true>{ .scale = q.scale, .inv_scale = 1 / q.scale, .offset = static_cast<float>(q.offset) });
+    case QNN_DATATYPE_UFIXED_POINT_16: return fn(ElementCodec<uint16_t, true>{ .scale = q.scale, .inv_scale = 1 / q.scale, .offset = static_cast<float>(q.offset) });
+    case QNN_DATATYPE_FLOAT_16: return fn(ElementCodec<__fp16, false>{});
+    case QNN_DATATYPE_FLOAT_32: return fn(ElementCodec<float, false>{});
+
+    default:
+        throw libsdod_exception(ErrorCode::INVALID_ARGUMENT, format("Unexpected tensor data type in a fused kernel: {}", dtype_to_str(desc.v1.dataType)), __func__, __FILE__, STR(__LINE__));
+    }
+}
+
+
+namespace details {
+
+// runs DPMSolver::update_fused with noise predictions given by ``eps_scale * eps(i) + eps_bias`` and writes the new latent
+// to ``x_batch`` consecutive copies at ``x_dst``, in the format described by ``x_desc``
+template <class Solver, class Eps>
+void solver_update_to(Solver const& solver, unsigned int step, std::vector<float>& x, std::vector<float>& history, Eps&& eps, float eps_scale, float eps_bias,
+    void* x_dst, const Qnn_Tensor_t& x_desc, unsigned int x_batch) {
+    auto elements = x.size();
+    visit_codec(x_desc, [&](auto x_codec) {
+        using X = typename decltype(x_codec)::type;
+        auto x_out = reinterpret_cast<X*>(x_dst);
+
+        // everything is captured by value, otherwise stores to x_out (which may be a byte type) would force
+        // the captured state to be reloaded in every iteration and prevent vectorization
+        solver.update_fused(step, x, history, eps, eps_scale, eps_bias, [x_out, x_codec](std::size_t i, float value) {
+            x_out[i] = x_codec.encode(value);
+        });
+
+        for (unsigned int b = 1; b < x_batch; ++b)
+            std::memcpy(x_out + b * elements, x_out, elements * sizeof(X));
+    });
+}
+
+// number of fractional bits of fixed-point weights used to combine 8-bit values, such that the combination fits in int32
+inline int fixed_point_bits(float max_weight) {
+    int bits = 30 - 8 - static_cast<int>(std::ceil(std::log2(std::max(max_weight, 1.0f) + 1.0f)));
+    return std::clamp(bits, 0, 20);
+}
+
+}
+
+
+// classifier-free guidance, solver update (see DPMSolver::update_fused) and conversion of the new latent fused in a single pass:
+// reads raw UNet outputs (``uncond`` can be nullptr if guidance is not used), updates ``x`` (kept in full precision,
+// together with the solver's ``history``) and writes it to ``x_batch`` consecutive copies at ``x_dst``, in the format described by ``x_desc``
+//
+// Quantized outputs are never dequantized: they are combined in the raw domain (8-bit ones in fixed point, 16-bit ones would overflow
+// int32 and are combined as floats) and their scale and offset are folded into the solver's coefficients.
+template <class Solver>
+void guided_solver_update(Solver const& solver, unsigned int step, std::vector<float>& x, std::vector<float>& history, const void* cond, const void* uncond, const Qnn_Tensor_t& e_desc, float guidance,
+    void* x_dst, const Qnn_Tensor_t& x_desc, unsigned int x_batch) {
+    visit_codec(e_desc, [&](auto e_codec) {
+        using E = typename decltype(e_codec)::type;
+        auto e_cond = reinterpret_cast<const E*>(cond);
+        auto e_uncond = reinterpret_cast<const E*>(uncond);
+        auto scale = e_codec.raw_scale();
+        auto bias = e_codec.raw_bias();
+        if (!e_uncond) {
+            details::solver_update_to(solver, step, x, history, [e_cond, e_codec](std::size_t i) { return e_codec.raw(e_cond[i]); }, scale, bias, x_dst, x_desc, x_batch);
+        } else if constexpr (decltype(e_codec)::quantized && sizeof(E) == 1) {
+            auto bits = details::fixed_point_bits(std::max(std::abs(guidance), std::abs(1 - guidance)));
+            auto one = static_cast<float>(1 << bits);
+            auto cond_w = static_cast<int32_t>(std::lround(guidance * one));
+            auto uncond_w = static_cast<int32_t>(std::lround((1 - guidance) * one));
+            // weights are rounded, the bias has to use their actual sum
+            bias *= static_cast<float>(cond_w + uncond_w) / one;
+            details::solver_update_to(solver, step, x, history, [e_cond, e_uncond, cond_w, uncond_w](std::size_t i) {
+                return static_cast<float>(cond_w * static_cast<int32_t>(e_cond[i]) + uncond_w * static_cast<int32_t>(e_uncond[i]));
+            }, scale / one, bias, x_dst, x_desc, x_batch);
+        } else {
+            details::solver_update_to(solver, step, x, history, [e_cond, e_uncond, e_codec, cond_w = guidance, uncond_w = 1 - guidance](std::size_t i) {
+                return cond_w * e_codec.raw(e_cond[i]) + uncond_w * e_codec.raw(e_uncond[i]);
+            }, scale, bias, x_dst, x_desc, x_batch);
+        }
+    });
+}
+
+// converts the conditional output to the raw domain (see ElementCodec) scaled by ``guidance``, to be used with
+// the variant of guided_solver_update below (e.g. while the unconditional output is still being computed)
+inline void prescale_cond(const void* cond, const Qnn_Tensor_t& e_desc, float guidance, std::vector<float>& dst) {
+    visit_codec(e_desc, [&](auto e_codec) {
+        using E = typename decltype(e_codec)::type;
+        auto e_cond = reinterpret_cast<const E*>(cond);
+        for (auto i : range(dst.size()))
+            dst[i] = guidance * e_codec.raw(e_cond[i]);
+    });
+}
+
+// same as above, but the conditional prediction has already been converted by prescale_cond
+template <class Solver>
+void guided_solver_update(Solver const& solver, unsigned int step, std::vector<float>& x, std::vector<float>& history, std::vector<float> const& scaled_cond, const void* uncond, const Qnn_Tensor_t& e_desc, float guidance,
+    void* x_dst, const Qnn_Tensor_t& x_desc, unsigned int x_batch) {
+    visit_codec(e_desc, [&](auto e_codec) {
+        using E = typename decltype(e_codec)::type;
+        auto e_uncond = reinterpret_cast<const E*>(uncond);
+        details::solver_update_to(solver, step, x, history, [cond = scaled_cond.data(), e_uncond, e_codec, uncond_w = 1 - guidance](std::size_t i) {
+            return cond[i] + uncond_w * e_codec.raw(e_uncond[i]);
+        }, e_codec.raw_scale(), e_codec.raw_bias(), x_dst, x_desc, x_batch);
+    });
+}
+
+
+// converts ``elements`` values between two (floating-point or quantized) tensor formats in a single pass,
+// e.g. to pass outputs of one graph to another one which uses different quantization
+inline void convert_elements(const void* src, const Qnn_Tensor_t& src_desc, void* dst, const Qnn_Tensor_t& dst_desc, std::size_t elements) {
+    visit_codec(src_desc, [&](auto src_codec) {
+        visit_codec(dst_desc, [&](auto dst_codec) {
+            auto in = reinterpret_cast<const typename decltype(src_codec)::type*>(src);
+            auto out = reinterpret_cast<typename decltype(dst_codec)::type*>(dst);
+            for (auto i : range(elements))
+                out[i] = dst_codec.encode(src_codec.decode(in[i]));
+        });
+    });
+}
+
+
+// image post-processing: [0,1] floats to [0,255] pixels
+inline uint8_t float2pixel(float value) {
+    return static_cast<uint8_t>(std::clamp(255 * value, 0.0f, 255.0f));
+}
+
+inline void float2uint8(uint8_t* dst, const float* src, std::size_t elements) {
+    for (auto i : range(elements))
+        dst[i] = float2pixel(src[i]);
+}
+
+
+namespace details {
+
+// without hardware support, every conversion from half precision is a library call
+#if defined(__ARM_FP16_FORMAT_IEEE) || defined(__F16C__)
+constexpr bool native_fp16 = true;
+#else
+constexpr bool native_fp16 = false;
+#endif
+
+template <class T, class Fn>
+void to_pixels(uint8_t* dst, const T* src, std::size_t pixels, unsigned int channels, bool planar, Fn fn) {
+    if (!planar || channels == 1) {
+        for (auto i : range(pixels * channels))
+            dst[i] = fn(src[i]);
+    } else if (channels == 3) {
+        // blocks of each plane are converted first, so that the conversion can be vectorized, then interleaved
+        constexpr std::size_t block = 1024;
+        uint8_t planes[3][block];
+        for (std::size_t start = 0; start < pixels; start += block) {
+            auto len = std::min(block, pixels - start);
+            for (auto c : range(3u))
+                for (auto i : range(len))
+                    planes[c][i] = fn(src[c * pixels + start + i]);
+            auto out = dst + 3 * start;
+            for (auto i : range(len)) {
+                out[3 * i] = planes[0][i];
+                out[3 * i + 1] = planes[1][i];
+                out[3 * i + 2] = planes[2][i];
+            }
+        }
+    } else {
+        for (auto i : range(pixels))
+            for (auto c : range(channels))
+                dst[i * channels + c] = fn(src[c * pixels + i]);
+    }
+}
+
+}
+
+
+// table of pixels for all possible values of data stored as described by ``desc``, used by qnn2uint8 for 16- and 8-bit
+// values (fixed-point, or half precision if it has to be emulated); empty if the values are converted directly; the
+// encoding of a tensor does not change, so the table is built once per tensor rather than per image
+inline std::vector<uint8_t> pixel_lut(const Qnn_Tensor_t& desc) {
+    std::vector<uint8_t> lut;
+    visit_codec(desc, [&](auto codec) {
+        using T = typename decltype(codec)::type;
+        if constexpr (decltype(codec)::quantized || (std::is_same_v<T, __fp16> && !details::native_fp16)) {
+            using bits_type = std::conditional_t<sizeof(T) == 1, uint8_t, uint16_t>;
+            lut.resize(std::size_t(std::numeric_limits<bits_type>::max()) + 1);
+            for (auto i : range(lut.size())) {
+                auto value = codec.decode(std::bit_cast<T>(static_cast<bits_type>(i)));
+                lut[i] = float2pixel(std::isnan(value) ? 0.0f : value);
+            }
+        }
+    });
+    return lut;
+}
+
+
+// same as float2uint8, but works directly on data stored as described by ``desc`` (e.g. decoder outputs), without converting it
+// to floats first: values which need a table are looked up in ``lut``, which must come from pixel_lut(desc); the result
+// is always interleaved (HWC), ``planar`` (CHW) data is reordered on the fly
+inline void qnn2uint8(uint8_t* dst, const void* src, const Qnn_Tensor_t& desc, std::vector<uint8_t> const& lut, std::size_t pixels, unsigned int channels, bool planar) {
+    visit_codec(desc, [&](auto codec) {
+        using T = typename decltype(codec)::type;
+        if constexpr (decltype(codec)::quantized || (std::is_same_v<T, __fp16> && !details::native_fp16)) {
+            using bits_type = std::conditional_t<sizeof(T) == 1, uint8_t, uint16_t>;
+            if (lut.size() != std::size_t(std::numeric_limits<bits_type>::max()) + 1)
+                throw libsdod_exception(ErrorCode::INTERNAL_ERROR, format("Pixel table has {} entries, expected: {}", lut.size(), std::size_t(std::numeric_limits<bits_type>::max()) + 1), __func__, __FILE__, STR(__LINE__));
+            details::to_pixels(dst, reinterpret_cast<const bits_type*>(src), pixels, channels, planar, [table = lut.data()](bits_type value) { return table[value]; });
+        } else {
+            details::to_pixels(dst, reinterpret_cast<const T*>(src), pixels, channels, planar, [](T value) { return float2pixel(static_cast<float>(value)); });
+        }
+    });
+}
+
+}
+
+#endif // LIBSDOD_CONVERSIONS_H
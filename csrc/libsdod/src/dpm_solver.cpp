@@ -69,9 +69,9 @@ void accumulate(std::vector<T>& v1, std::vector<T> const& v2, T a) {
 
 
 template <class T>
-void normalize(std::vector<T>& out, std::vector<T> const& v1, std::vector<T> const& v2, T a, T b) {
+void normalize(std::vector<T>& out, std::vector<T> const& v1, std::vector<T> const& v2, T a, T inv_b) {
     for (auto i : range(v1.size()))
-        out[i] = (v1[i] + a*v2[i]) / b;
+        out[i] = (v1[i] + a*v2[i]) * inv_b;
 }
 
 
@@ -133,12 +133,35 @@ void DPMSolver::prepare(unsigned int steps, std::vector<float>& model_ts) {
 using fs = std::initializer_list<DPMSolver::value_type>;
 
 
+DPMSolver::StepCoefficients DPMSolver::get_coefficients(unsigned int step, bool first) const {
+    auto order = (step == 0 || first ? 1 : (step < 10 ? std::min<unsigned int>(2, ts.size() - step) : 2));
+    StepCoefficients ret{ .order = order, .sigma = sigmas[step], .inv_alpha = 1 / alphas[step], .x_scale = sigmas[step+1]/sigmas[step] };
+
+    switch (order) {
+    case 1:
+        ret.y_scale = -alphas[step+1]*phis[step+1];
+        ret.prev_y_scale = 0;
+        break;
+
+    case 2:
+        ret.y_scale = -alphas[step+1]*phis[step+1]*(1 + i2rs[step+1]);
+        ret.prev_y_scale = alphas[step+1]*phis[step+1]*i2rs[step+1];
+        break;
+
+    default:
+        throw libsdod_exception(ErrorCode::INTERNAL_ERROR, "Unreachable", __func__, __FILE__, STR(__LINE__));
+    }
+
+    return ret;
+}
+
+
 void DPMSolver::update(unsigned int step, std::vector<float>& x,  std::vector<float>& y) {
-    auto order = (step == 0 ? 1 : (step < 10 ? std::min<unsigned int>(2, ts.size() - step) : 2));
+    auto&& c = get_coefficients(step, prev_y.size() != x.size());
     // switch from noise prediction to data prediction
-    normalize<float>(y, x, y, -sigmas[step], alphas[step]); // y = (x + (-sigma)*y) / /alpha
+    normalize<float>(y, x, y, -c.sigma, c.inv_alpha); // y = (x + (-sigma)*y) * (1/alpha)
 
-    switch (order) {
+    switch (c.order) {
     case 1:
 #if defined(LIBSDOD_DEBUG)
         std::cout << format("SS DPM, t: {}, lambda: {}, log(a): {}, sigma: {}, alpha: {}, phi: {}",
@@ -150,8 +173,8 @@ void DPMSolver::update(unsigned int step, std::vector<float>& x,  std::vector<fl
             phis[step+1]) << std::endl;
         std::cout << format("    x: {}", std::span(x.data(), 15)) << std::endl << format("    y: {}", std::span(y.data(), 15)) << std::endl;
 #endif
-        scale<float>(x, sigmas[step+1]/sigmas[step]);
-        accumulate<float>(x, y, -alphas[step+1]*phis[step+1]);
+        scale<float>(x, c.x_scale);
+        accumulate<float>(x, y, c.y_scale);
         break;
 
     case 2:
@@ -165,16 +188,16 @@ void DPMSolver::update(unsigned int step, std::vector<float>& x,  std::vector<fl
             phis[step+1],
             i2rs[step+1]) << std::endl;
 #endif
-        scale<float>(x, sigmas[step+1]/sigmas[step]);
-        accumulate<float>(x, prev_y, alphas[step+1]*phis[step+1]*i2rs[step+1]);
-        accumulate<float>(x, y, -alphas[step+1]*phis[step+1]*(1 + i2rs[step+1]));
+        scale<float>(x, c.x_scale);
+        accumulate<float>(x, prev_y, c.prev_y_scale);
+        accumulate<float>(x, y, c.y_scale);
         break;
 
     default:
         throw libsdod_exception(ErrorCode::INTERNAL_ERROR, "Unreachable", __func__, __FILE__, STR(__LINE__));
     }
 
-    if (prev_y.empty())
+    if (prev_y.size() != y.size())
         prev_y = y;
     else
         std::swap(y, prev_y);
@@ -1,6 +1,9 @@
 #ifndef LIBSDOD_DPM_SOLVER_H
 #define LIBSDOD_DPM_SOLVER_H
 
+#include "utils.h"
+#include "errors.h"
+
 #include <list>
 #include <cmath>
 #include <vector>
@@ -12,12 +15,47 @@ class DPMSolver {
 public:
     using value_type = float;
 
+    // a single step expressed as: y = (x - sigma * e) * inv_alpha; x' = x_scale * x + y_scale * y + prev_y_scale * prev_y
+    struct StepCoefficients {
+        unsigned int order;
+        value_type sigma;
+        value_type inv_alpha;
+        value_type x_scale;
+        value_type y_scale;
+        value_type prev_y_scale;
+    };
+
 public:
     DPMSolver(unsigned int timesteps, value_type lin_start, value_type lin_end);
 
     void prepare(unsigned int steps, std::vector<float>& model_ts);
     void update(unsigned int step, std::vector<float>& x,  std::vector<float>& y);
 
+    // same as update, but done in a single pass without intermediate buffers: ``eps(i)`` should return the model output
+    // for the i-th element and ``out(i, value)`` is called with the new value of x[i] (e.g. to write it to the next model input)
+    template <class Eps, class Out>
+    void update_fused(unsigned int step, std::vector<float>& x, Eps&& eps, Out&& out) { update_fused(step, x, prev_y, eps, out); }
+
+    // as above, but the state of the multistep method is kept in ``history`` rather than in the solver,
+    // so a single solver can be used to denoise several images at the same time; the first step made with
+    // an empty history is always a first-order one, so denoising can also start in the middle of the schedule (e.g. img2img)
+    template <class Eps, class Out>
+    void update_fused(unsigned int step, std::vector<float>& x, std::vector<float>& history, Eps&& eps, Out&& out) const { update_fused(step, x, history, eps, 1.0f, 0.0f, out); }
+
+    // as above, but ``eps(i)`` returns the model output up to an affine transformation (``eps_scale * eps(i) + eps_bias``),
+    // which is folded into the step coefficients - e.g. to work with quantized outputs without dequantizing them first
+    template <class Eps, class Out>
+    void update_fused(unsigned int step, std::vector<float>& x, std::vector<float>& history, Eps&& eps, float eps_scale, float eps_bias, Out&& out) const;
+
+    // a step made without evaluating the model, for which the data prediction is estimated from the previous ones: the last one (``history``)
+    // is reused as is or, if ``prev_history`` holds the one before it, extrapolated linearly in lambda; ``history`` has to hold at least one
+    // prediction (i.e. this cannot be the first step made), ``out`` is called as by update_fused
+    template <class Out>
+    void update_estimated(unsigned int step, std::vector<float>& x, std::vector<float>& history, std::vector<float> const& prev_history, Out&& out) const;
+
+    // ``first`` should be set if no step has been made yet, otherwise only the very first step of the schedule is a first-order one
+    StepCoefficients get_coefficients(unsigned int step, bool first = false) const;
+
     auto& get_all_t() const { return all_t; }
     auto& get_all_log_alpha() const { return all_log_alpha; }
     auto& get_ts() const { return ts; }
@@ -47,6 +85,67 @@ private:
     std::vector<float> prev_y;
 };
 
+
+template <class Eps, class Out>
+void DPMSolver::update_fused(unsigned int step, std::vector<float>& x, std::vector<float>& history, Eps&& eps, float eps_scale, float eps_bias, Out&& out) const {
+    auto&& c = get_coefficients(step, history.empty());
+    history.resize(x.size(), 0.0f); // not used by the first-order step
+
+    // y = (x - sigma * (eps_scale * eps + eps_bias)) * inv_alpha
+    // plain locals, so the compiler does not have to assume they alias x or history
+    const float y_x = c.inv_alpha, y_eps = -c.sigma * c.inv_alpha * eps_scale, y_bias = -c.sigma * c.inv_alpha * eps_bias;
+    const float x_scale = c.x_scale, y_scale = c.y_scale, prev_y_scale = c.prev_y_scale;
+    float* xp = x.data();
+    float* yp = history.data();
+
+    // done in blocks small enough to stay in L1: reading the model output, the update itself and writing the result are
+    // separate loops over each block, so that each of them can be vectorized (a single loop calling both callbacks is not)
+    constexpr std::size_t block = 256;
+    float eps_block[block];
+    float next_block[block];
+    for (std::size_t start = 0; start < x.size(); start += block) {
+        auto len = std::min(block, x.size() - start);
+        for (std::size_t i = 0; i < len; ++i)
+            eps_block[i] = eps(start + i);
+        float* xb = xp + start;
+        float* yb = yp + start;
+        for (std::size_t i = 0; i < len; ++i) {
+            float y = y_x * xb[i] + y_eps * eps_block[i] + y_bias;
+            float next = x_scale * xb[i] + y_scale * y + prev_y_scale * yb[i];
+            yb[i] = y;
+            xb[i] = next;
+            next_block[i] = next;
+        }
+        for (std::size_t i = 0; i < len; ++i)
+            out(start + i, next_block[i]);
+    }
+}
+
+
+template <class Out>
+void DPMSolver::update_estimated(unsigned int step, std::vector<float>& x, std::vector<float>& history, std::vector<float> const& prev_history, Out&& out) const {
+    if (history.size() != x.size() || !step)
+        throw libsdod_exception(ErrorCode::INTERNAL_ERROR, format("Cannot estimate the data prediction of step {} without a previous one", step), __func__, __FILE__, STR(__LINE__));
+    auto&& c = get_coefficients(step);
+
+    // y = y1 + r * (y1 - y0), r = 0 when reusing
+    float r = 0.0f;
+    if (step >= 2 && prev_history.size() == x.size())
+        r = (lambdas[step] - lambdas[step-1]) / (lambdas[step-1] - lambdas[step-2]);
+    const float y1_scale = 1.0f + r, y0_scale = -r;
+    const float x_scale = c.x_scale, y_scale = c.y_scale, prev_y_scale = c.prev_y_scale;
+    const float* y0p = (r != 0.0f ? prev_history.data() : nullptr);
+    float* xp = x.data();
+    float* yp = history.data();
+    for (auto i : range(x.size())) {
+        float y = y1_scale * yp[i] + (y0p ? y0_scale * y0p[i] : 0.0f);
+        float next = x_scale * xp[i] + y_scale * y + prev_y_scale * yp[i];
+        yp[i] = y;
+        xp[i] = next;
+        out(i, next);
+    }
+}
+
 }
 
 #endif // LIBSDOD_DPM_SOLVER_H
@@ -11,7 +11,7 @@
 #define LIBSDOD_VERSION_MINOR 0
 #define LIBSDOD_VERSION_PATCH 0
 
-#define LIBSDOD_VERSION_STR (#LIBSDOD_VERSION_MAJOR "." #LIBSDOD_VERSION_MINOR "." #LIBSDOD_VERSION_PATCH)
+#define LIBSDOD_VERSION_STR (STR(LIBSDOD_VERSION_MAJOR) "." STR(LIBSDOD_VERSION_MINOR) "." STR(LIBSDOD_VERSION_PATCH))
 #define LIBSDOD_VERSION_INT (LIBSDOD_VERSION_MAJOR*10000 + LIBSDOD_VERSION_MINOR*100 + LIBSDOD_VERSION_PATCH)
 #define LIBSDOD_CONTEXT_MAGIC_HEADER 0x00534443
 #define LIBSDOD_DEFAULT_CONTEXT_VERSION 1
@@ -63,7 +63,18 @@ ErrorCode _error(ErrorCode code, Context* c, T&& message, const char* func, cons
     (void)_logger_scope
 
 
-static ErrorCode setup_impl(void** context, const char* models_dir, unsigned int latent_channels, unsigned int latent_spatial, unsigned int upscale_factor, unsigned int steps, unsigned int log_level, bool use_htp) {
+static std::optional<QnnBackendType> get_backend_type(int backend) {
+    switch (backend) {
+    case LIBSDOD_BACKEND_GPU: return QnnBackendType::GPU;
+    case LIBSDOD_BACKEND_HTP: return QnnBackendType::HTP;
+    case LIBSDOD_BACKEND_CPU: return QnnBackendType::CPU;
+    default:
+        return std::nullopt;
+    }
+}
+
+
+static ErrorCode setup_impl(void** context, const char* models_dir, unsigned int latent_channels, unsigned int latent_spatial, unsigned int upscale_factor, unsigned int steps, unsigned int log_level, int backend) {
     Context* cptr = nullptr;
     if (context == nullptr)
         return ERROR(ErrorCode::INVALID_ARGUMENT, "Context argument should not be nullptr!");
@@ -74,12 +85,16 @@ static ErrorCode setup_impl(void** context, const char* models_dir, unsigned int
     if (!is_valid_log_level(log_level))
         return ERROR(ErrorCode::INVALID_ARGUMENT, "Invalid log_level");
 
+    auto&& backend_type = get_backend_type(backend);
+    if (!backend_type)
+        return ERROR(ErrorCode::INVALID_ARGUMENT, "Invalid backend");
+
     CAPI_Context_Handler* hnd = new (std::nothrow) CAPI_Context_Handler;
     if (hnd == nullptr)
         return ERROR(ErrorCode::FAILED_ALLOCATION, "Could not create a new CAPI_Context_Handler object");
 
     hnd->ref_count += 1;
-    hnd->cptr = new (std::nothrow) Context(models_dir, latent_channels, latent_spatial, upscale_factor, static_cast<LogLevel>(log_level), use_htp);
+    hnd->cptr = new (std::nothrow) Context(models_dir, latent_channels, latent_spatial, upscale_factor, static_cast<LogLevel>(log_level), backend_type.value());
     if (hnd->cptr == nullptr)
         return ERROR(ErrorCode::FAILED_ALLOCATION, "COuld not create a new Context object");
 
@@ -92,12 +107,7 @@ static ErrorCode setup_impl(void** context, const char* models_dir, unsigned int
 #if !defined(NOTHREADS) && !defined(LIBSDOD_DEBUG)
         cptr->init_mt(steps);
 #else
-        cptr->initialize_qnn();
-        cptr->load_models();
-        cptr->load_tokenizer();
-        cptr->prepare_solver();
-        cptr->prepare_buffers();
-        cptr->prepare_schedule(steps);
+        cptr->init(steps);
 #endif
     } catch (libsdod_exception const& e) {
         return _error(e.code(), cptr, e.reason(), e.func(), e.file(), e.line());
@@ -143,6 +153,156 @@ static ErrorCode set_log_level_impl(void* context, unsigned int log_level) {
     return ErrorCode::NO_ERROR;
 }
 
+static ErrorCode set_decoder_impl(void* context, int decoder) {
+    TRY_RETRIEVE_CONTEXT;
+    if (decoder != LIBSDOD_DECODER_FULL && decoder != LIBSDOD_DECODER_FAST)
+        return ERROR(ErrorCode::INVALID_ARGUMENT, "Invalid decoder");
+
+    try {
+        cptr->set_decoder(decoder == LIBSDOD_DECODER_FAST ? DecoderType::FAST : DecoderType::FULL);
+    } catch (libsdod_exception const& e) {
+        return _error(e.code(), cptr, e.reason(), e.func(), e.file(), e.line());
+    } catch (std::exception const& e) {
+        return ERROR(ErrorCode::INTERNAL_ERROR, e.what());
+    } catch (...) {
+        return ERROR(ErrorCode::INTERNAL_ERROR, "Unspecified error");
+    }
+
+    return ErrorCode::NO_ERROR;
+}
+
+static ErrorCode set_guidance_policy_impl(void* context, int policy, float start, float end, unsigned int uncond_interval) {
+    TRY_RETRIEVE_CONTEXT;
+    if (policy < LIBSDOD_GUIDANCE_FULL || policy > LIBSDOD_GUIDANCE_REUSE_UNCOND)
+        return ERROR(ErrorCode::INVALID_ARGUMENT, "Invalid guidance policy");
+
+    try {
+        cptr->set_guidance_policy(GuidancePolicy{ .mode = static_cast<GuidanceMode>(policy), .start = start, .end = end, .uncond_interval = uncond_interval });
+    } catch (libsdod_exception const& e) {
+        return _error(e.code(), cptr, e.reason(), e.func(), e.file(), e.line());
+    } catch (std::exception const& e) {
+        return ERROR(ErrorCode::INTERNAL_ERROR, e.what());
+    } catch (...) {
+        return ERROR(ErrorCode::INTERNAL_ERROR, "Unspecified error");
+    }
+
+    return ErrorCode::NO_ERROR;
+}
+
+static ErrorCode set_step_skipping_impl(void* context, int mode, const unsigned int* steps, unsigned int num_steps) {
+    TRY_RETRIEVE_CONTEXT;
+    if (mode != LIBSDOD_SKIP_REUSE && mode != LIBSDOD_SKIP_EXTRAPOLATE)
+        return ERROR(ErrorCode::INVALID_ARGUMENT, "Invalid step skipping mode");
+    if (steps == nullptr && num_steps)
+        return ERROR(ErrorCode::INVALID_ARGUMENT, "steps is nullptr");
+
+    try {
+        cptr->set_step_skipping(StepSkipping{ .mode = static_cast<StepSkipMode>(mode), .steps = std::vector<unsigned int>(steps, steps + num_steps) });
+    } catch (libsdod_exception const& e) {
+        return _error(e.code(), cptr, e.reason(), e.func(), e.file(), e.line());
+    } catch (std::exception const& e) {
+        return ERROR(ErrorCode::INTERNAL_ERROR, e.what());
+    } catch (...) {
+        return ERROR(ErrorCode::INTERNAL_ERROR, "Unspecified error");
+    }
+
+    return ErrorCode::NO_ERROR;
+}
+
+static ErrorCode set_feature_cache_impl(void* context, unsigned int interval) {
+    TRY_RETRIEVE_CONTEXT;
+    try {
+        cptr->set_feature_cache_interval(interval);
+    } catch (libsdod_exception const& e) {
+        return _error(e.code(), cptr, e.reason(), e.func(), e.file(), e.line());
+    } catch (std::exception const& e) {
+        return ERROR(ErrorCode::INTERNAL_ERROR, e.what());
+    } catch (...) {
+        return ERROR(ErrorCode::INTERNAL_ERROR, "Unspecified error");
+    }
+
+    return ErrorCode::NO_ERROR;
+}
+
+static ErrorCode set_early_stopping_impl(void* context, float threshold, unsigned int patience) {
+    TRY_RETRIEVE_CONTEXT;
+    try {
+        cptr->set_early_stopping(EarlyStopping{ .threshold = threshold, .patience = patience });
+    } catch (libsdod_exception const& e) {
+        return _error(e.code(), cptr, e.reason(), e.func(), e.file(), e.line());
+    } catch (std::exception const& e) {
+        return ERROR(ErrorCode::INTERNAL_ERROR, e.what());
+    } catch (...) {
+        return ERROR(ErrorCode::INTERNAL_ERROR, "Unspecified error");
+    }
+
+    return ErrorCode::NO_ERROR;
+}
+
+static ErrorCode set_latency_budget_impl(void* context, float budget_ms, unsigned int min_steps, unsigned int max_steps) {
+    TRY_RETRIEVE_CONTEXT;
+    try {
+        cptr->set_latency_budget(LatencyBudget{ .ms = budget_ms, .min_steps = min_steps, .max_steps = max_steps });
+    } catch (libsdod_exception const& e) {
+        return _error(e.code(), cptr, e.reason(), e.func(), e.file(), e.line());
+    } catch (std::exception const& e) {
+        return ERROR(ErrorCode::INTERNAL_ERROR, e.what());
+    } catch (...) {
+        return ERROR(ErrorCode::INTERNAL_ERROR, "Unspecified error");
+    }
+
+    return ErrorCode::NO_ERROR;
+}
+
+static ErrorCode calibrate_step_skipping_impl(void* context, const char* const* prompts, unsigned int num_prompts, float guidance_scale, int mode, float* deviations, unsigned int num_deviations) {
+    TRY_RETRIEVE_CONTEXT;
+    if (prompts == nullptr)
+        return ERROR(ErrorCode::INVALID_ARGUMENT, "prompts is nullptr");
+    if (num_prompts == 0)
+        return ERROR(ErrorCode::INVALID_ARGUMENT, "num_prompts is 0");
+    if (mode != LIBSDOD_SKIP_REUSE && mode != LIBSDOD_SKIP_EXTRAPOLATE)
+        return ERROR(ErrorCode::INVALID_ARGUMENT, "Invalid step skipping mode");
+    if (deviations == nullptr)
+        return ERROR(ErrorCode::INVALID_ARGUMENT, "deviations is nullptr");
+    if (num_deviations < cptr->get_steps())
+        return ERROR(ErrorCode::INVALID_ARGUMENT, format("deviations holds {} elements, expected at least {}", num_deviations, cptr->get_steps()));
+
+    try {
+        std::vector<std::string> prompts_str;
+        for (auto i : range(num_prompts)) {
+            if (prompts[i] == nullptr)
+                return ERROR(ErrorCode::INVALID_ARGUMENT, format("prompts[{}] is nullptr", i));
+            prompts_str.emplace_back(prompts[i]);
+        }
+
+        auto&& ret = cptr->calibrate_step_skipping(prompts_str, guidance_scale, static_cast<StepSkipMode>(mode));
+        std::copy(ret.begin(), ret.end(), deviations);
+    } catch (libsdod_exception const& e) {
+        return _error(e.code(), cptr, e.reason(), e.func(), e.file(), e.line());
+    } catch (std::exception const& e) {
+        return ERROR(ErrorCode::INTERNAL_ERROR, e.what());
+    } catch (...) {
+        return ERROR(ErrorCode::INTERNAL_ERROR, "Unspecified error");
+    }
+
+    return ErrorCode::NO_ERROR;
+}
+
+static ErrorCode set_seed_impl(void* context, unsigned int seed) {
+    TRY_RETRIEVE_CONTEXT;
+    try {
+        cptr->set_seed(seed);
+    } catch (libsdod_exception const& e) {
+        return _error(e.code(), cptr, e.reason(), e.func(), e.file(), e.line());
+    } catch (std::exception const& e) {
+        return ERROR(ErrorCode::INTERNAL_ERROR, e.what());
+    } catch (...) {
+        return ERROR(ErrorCode::INTERNAL_ERROR, "Unspecified error");
+    }
+
+    return ErrorCode::NO_ERROR;
+}
+
 static ErrorCode ref_context_impl(void* context) {
     TRY_RETRIEVE_CONTEXT;
     ++hnd->ref_count;
@@ -184,6 +344,286 @@ static ErrorCode generate_image_impl(void* context, const char* prompt, float gu
     return ErrorCode::NO_ERROR;
 }
 
+static ErrorCode generate_images_impl(void* context, const char* const* prompts, unsigned int num_prompts, float guidance_scale, unsigned char** images_out, unsigned int* images_buffer_size) {
+    TRY_RETRIEVE_CONTEXT;
+    if (prompts == nullptr)
+        return ERROR(ErrorCode::INVALID_ARGUMENT, "prompts is nullptr");
+    if (num_prompts == 0)
+        return ERROR(ErrorCode::INVALID_ARGUMENT, "num_prompts is 0");
+    if (images_out == nullptr)
+        return ERROR(ErrorCode::INVALID_ARGUMENT, "images_out is nullptr");
+    if (images_buffer_size == nullptr)
+        return ERROR(ErrorCode::INVALID_ARGUMENT, "images_buffer_size is nullptr");
+
+    try {
+        std::vector<std::string> prompts_str;
+        for (auto i : range(num_prompts)) {
+            if (prompts[i] == nullptr)
+                return ERROR(ErrorCode::INVALID_ARGUMENT, format("prompts[{}] is nullptr", i));
+            prompts_str.emplace_back(prompts[i]);
+        }
+
+        auto out = (*images_out == nullptr) ? cptr->allocate_output(num_prompts) : cptr->reuse_buffer(*images_out, *images_buffer_size, num_prompts);
+        cptr->generate(prompts_str, guidance_scale, out);
+        *images_out = out.data_ptr();
+        *images_buffer_size = out.data_len();
+        out.own(false);
+    } catch (libsdod_exception const& e) {
+        return _error(e.code(), cptr, e.reason(), e.func(), e.file(), e.line());
+    } catch (std::exception const& e) {
+        return ERROR(ErrorCode::INTERNAL_ERROR, e.what());
+    } catch (...) {
+        return ERROR(ErrorCode::INTERNAL_ERROR, "Unspecified error");
+    }
+
+    return ErrorCode::NO_ERROR;
+}
+
+static ErrorCode generate_images_from_impl(void* context, const char* const* prompts, const unsigned char* const* init_images, unsigned int num_prompts, float strength, float guidance_scale, unsigned char** images_out, unsigned int* images_buffer_size) {
+    TRY_RETRIEVE_CONTEXT;
+    if (prompts == nullptr)
+        return ERROR(ErrorCode::INVALID_ARGUMENT, "prompts is nullptr");
+    if (init_images == nullptr)
+        return ERROR(ErrorCode::INVALID_ARGUMENT, "init_images is nullptr");
+    if (num_prompts == 0)
+        return ERROR(ErrorCode::INVALID_ARGUMENT, "num_prompts is 0");
+    if (images_out == nullptr)
+        return ERROR(ErrorCode::INVALID_ARGUMENT, "images_out is nullptr");
+    if (images_buffer_size == nullptr)
+        return ERROR(ErrorCode::INVALID_ARGUMENT, "images_buffer_size is nullptr");
+
+    try {
+        std::vector<std::string> prompts_str;
+        std::vector<const unsigned char*> init_images_vec;
+        for (auto i : range(num_prompts)) {
+            if (prompts[i] == nullptr)
+                return ERROR(ErrorCode::INVALID_ARGUMENT, format("prompts[{}] is nullptr", i));
+            if (init_images[i] == nullptr)
+                return ERROR(ErrorCode::INVALID_ARGUMENT, format("init_images[{}] is nullptr", i));
+            prompts_str.emplace_back(prompts[i]);
+            init_images_vec.push_back(init_images[i]);
+        }
+
+        auto out = (*images_out == nullptr) ? cptr->allocate_output(num_prompts) : cptr->reuse_buffer(*images_out, *images_buffer_size, num_prompts);
+        cptr->generate(prompts_str, init_images_vec, strength, guidance_scale, out);
+        *images_out = out.data_ptr();
+        *images_buffer_size = out.data_len();
+        out.own(false);
+    } catch (libsdod_exception const& e) {
+        return _error(e.code(), cptr, e.reason(), e.func(), e.file(), e.line());
+    } catch (std::exception const& e) {
+        return ERROR(ErrorCode::INTERNAL_ERROR, e.what());
+    } catch (...) {
+        return ERROR(ErrorCode::INTERNAL_ERROR, "Unspecified error");
+    }
+
+    return ErrorCode::NO_ERROR;
+}
+
+static ErrorCode generate_latents_impl(void* context, const char* const* prompts, unsigned int num_prompts, float guidance_scale, float** latents_out, unsigned int* latents_buffer_size) {
+    TRY_RETRIEVE_CONTEXT;
+    if (prompts == nullptr)
+        return ERROR(ErrorCode::INVALID_ARGUMENT, "prompts is nullptr");
+    if (num_prompts == 0)
+        return ERROR(ErrorCode::INVALID_ARGUMENT, "num_prompts is 0");
+    if (latents_out == nullptr)
+        return ERROR(ErrorCode::INVALID_ARGUMENT, "latents_out is nullptr");
+    if (latents_buffer_size == nullptr)
+        return ERROR(ErrorCode::INVALID_ARGUMENT, "latents_buffer_size is nullptr");
+
+    try {
+        std::vector<std::string> prompts_str;
+        for (auto i : range(num_prompts)) {
+            if (prompts[i] == nullptr)
+                return ERROR(ErrorCode::INVALID_ARGUMENT, format("prompts[{}] is nullptr", i));
+            prompts_str.emplace_back(prompts[i]);
+        }
+
+        auto out = (*latents_out == nullptr) ? cptr->allocate_latents(num_prompts) : cptr->reuse_latents_buffer(*latents_out, *latents_buffer_size, num_prompts);
+        cptr->generate_latents(prompts_str, guidance_scale, out);
+        *latents_out = out.data_ptr();
+        *latents_buffer_size = out.data_len();
+        out.own(false);
+    } catch (libsdod_exception const& e) {
+        return _error(e.code(), cptr, e.reason(), e.func(), e.file(), e.line());
+    } catch (std::exception const& e) {
+        return ERROR(ErrorCode::INTERNAL_ERROR, e.what());
+    } catch (...) {
+        return ERROR(ErrorCode::INTERNAL_ERROR, "Unspecified error");
+    }
+
+    return ErrorCode::NO_ERROR;
+}
+
+static ErrorCode decode_latents_impl(void* context, const float* const* latents, unsigned int num_latents, unsigned char** images_out, unsigned int* images_buffer_size) {
+    TRY_RETRIEVE_CONTEXT;
+    if (latents == nullptr)
+        return ERROR(ErrorCode::INVALID_ARGUMENT, "latents is nullptr");
+    if (num_latents == 0)
+        return ERROR(ErrorCode::INVALID_ARGUMENT, "num_latents is 0");
+    if (images_out == nullptr)
+        return ERROR(ErrorCode::INVALID_ARGUMENT, "images_out is nullptr");
+    if (images_buffer_size == nullptr)
+        return ERROR(ErrorCode::INVALID_ARGUMENT, "images_buffer_size is nullptr");
+
+    try {
+        std::vector<const float*> latents_vec;
+        for (auto i : range(num_latents)) {
+            if (latents[i] == nullptr)
+                return ERROR(ErrorCode::INVALID_ARGUMENT, format("latents[{}] is nullptr", i));
+            latents_vec.push_back(latents[i]);
+        }
+
+        auto out = (*images_out == nullptr) ? cptr->allocate_output(num_latents) : cptr->reuse_buffer(*images_out, *images_buffer_size, num_latents);
+        cptr->decode_latents(latents_vec, out);
+        *images_out = out.data_ptr();
+        *images_buffer_size = out.data_len();
+        out.own(false);
+    } catch (libsdod_exception const& e) {
+        return _error(e.code(), cptr, e.reason(), e.func(), e.file(), e.line());
+    } catch (std::exception const& e) {
+        return ERROR(ErrorCode::INTERNAL_ERROR, e.what());
+    } catch (...) {
+        return ERROR(ErrorCode::INTERNAL_ERROR, "Unspecified error");
+    }
+
+    return ErrorCode::NO_ERROR;
+}
+
+static ErrorCode decode_latent_impl(void* context, const float* latent, unsigned int latent_height, unsigned int latent_width, unsigned char** image_out, unsigned int* image_buffer_size) {
+    TRY_RETRIEVE_CONTEXT;
+    if (latent == nullptr)
+        return ERROR(ErrorCode::INVALID_ARGUMENT, "latent is nullptr");
+    if (image_out == nullptr)
+        return ERROR(ErrorCode::INVALID_ARGUMENT, "image_out is nullptr");
+    if (image_buffer_size == nullptr)
+        return ERROR(ErrorCode::INVALID_ARGUMENT, "image_buffer_size is nullptr");
+
+    try {
+        std::vector<float> latent_vec(latent, latent + std::size_t(latent_height) * latent_width * cptr->get_latent_channels());
+        auto out = (*image_out == nullptr) ? cptr->allocate_output(1, latent_height, latent_width) : cptr->reuse_buffer(*image_out, *image_buffer_size, 1, latent_height, latent_width);
+        cptr->decode(latent_vec, latent_height, latent_width, out);
+        *image_out = out.data_ptr();
+        *image_buffer_size = out.data_len();
+        out.own(false);
+    } catch (libsdod_exception const& e) {
+        return _error(e.code(), cptr, e.reason(), e.func(), e.file(), e.line());
+    } catch (std::exception const& e) {
+        return ERROR(ErrorCode::INTERNAL_ERROR, e.what());
+    } catch (...) {
+        return ERROR(ErrorCode::INTERNAL_ERROR, "Unspecified error");
+    }
+
+    return ErrorCode::NO_ERROR;
+}
+
+static ErrorCode get_stats_impl(void* context, const char* const** names, const double** values, unsigned int* count) {
+    TRY_RETRIEVE_CONTEXT;
+    if (names == nullptr)
+        return ERROR(ErrorCode::INVALID_ARGUMENT, "names is nullptr");
+    if (values == nullptr)
+        return ERROR(ErrorCode::INVALID_ARGUMENT, "values is nullptr");
+    if (count == nullptr)
+        return ERROR(ErrorCode::INVALID_ARGUMENT, "count is nullptr");
+
+    try {
+        cptr->get_stats(*names, *values, *count);
+    } catch (libsdod_exception const& e) {
+        return _error(e.code(), cptr, e.reason(), e.func(), e.file(), e.line());
+    } catch (std::exception const& e) {
+        return ERROR(ErrorCode::INTERNAL_ERROR, e.what());
+    } catch (...) {
+        return ERROR(ErrorCode::INTERNAL_ERROR, "Unspecified error");
+    }
+
+    return ErrorCode::NO_ERROR;
+}
+
+static ErrorCode start_recording_impl(void* context, const char* trace_path) {
+    TRY_RETRIEVE_CONTEXT;
+    if (trace_path == nullptr)
+        return ERROR(ErrorCode::INVALID_ARGUMENT, "trace_path is nullptr");
+
+    try {
+        cptr->start_recording(trace_path);
+    } catch (libsdod_exception const& e) {
+        return _error(e.code(), cptr, e.reason(), e.func(), e.file(), e.line());
+    } catch (std::exception const& e) {
+        return ERROR(ErrorCode::INTERNAL_ERROR, e.what());
+    } catch (...) {
+        return ERROR(ErrorCode::INTERNAL_ERROR, "Unspecified error");
+    }
+
+    return ErrorCode::NO_ERROR;
+}
+
+static ErrorCode stop_recording_impl(void* context) {
+    TRY_RETRIEVE_CONTEXT;
+    try {
+        cptr->stop_recording();
+    } catch (libsdod_exception const& e) {
+        return _error(e.code(), cptr, e.reason(), e.func(), e.file(), e.line());
+    } catch (std::exception const& e) {
+        return ERROR(ErrorCode::INTERNAL_ERROR, e.what());
+    } catch (...) {
+        return ERROR(ErrorCode::INTERNAL_ERROR, "Unspecified error");
+    }
+
+    return ErrorCode::NO_ERROR;
+}
+
+static ErrorCode start_calibration_impl(void* context) {
+    TRY_RETRIEVE_CONTEXT;
+    try {
+        cptr->start_calibration();
+    } catch (libsdod_exception const& e) {
+        return _error(e.code(), cptr, e.reason(), e.func(), e.file(), e.line());
+    } catch (std::exception const& e) {
+        return ERROR(ErrorCode::INTERNAL_ERROR, e.what());
+    } catch (...) {
+        return ERROR(ErrorCode::INTERNAL_ERROR, "Unspecified error");
+    }
+
+    return ErrorCode::NO_ERROR;
+}
+
+static ErrorCode save_calibration_impl(void* context, const char* output_dir, unsigned int bitwidth, float percentile) {
+    TRY_RETRIEVE_CONTEXT;
+    if (output_dir == nullptr)
+        return ERROR(ErrorCode::INVALID_ARGUMENT, "output_dir is nullptr");
+    if (bitwidth < 1 || bitwidth > 16)
+        return ERROR(ErrorCode::INVALID_ARGUMENT, format("bitwidth should be between 1 and 16, got: {}", bitwidth));
+    if (!(percentile > 0.0f && percentile <= 100.0f))
+        return ERROR(ErrorCode::INVALID_ARGUMENT, format("percentile should be in range (0, 100], got: {}", percentile));
+
+    try {
+        cptr->save_calibration(output_dir, bitwidth, percentile);
+    } catch (libsdod_exception const& e) {
+        return _error(e.code(), cptr, e.reason(), e.func(), e.file(), e.line());
+    } catch (std::exception const& e) {
+        return ERROR(ErrorCode::INTERNAL_ERROR, e.what());
+    } catch (...) {
+        return ERROR(ErrorCode::INTERNAL_ERROR, "Unspecified error");
+    }
+
+    return ErrorCode::NO_ERROR;
+}
+
+static ErrorCode stop_calibration_impl(void* context) {
+    TRY_RETRIEVE_CONTEXT;
+    try {
+        cptr->stop_calibration();
+    } catch (libsdod_exception const& e) {
+        return _error(e.code(), cptr, e.reason(), e.func(), e.file(), e.line());
+    } catch (std::exception const& e) {
+        return ERROR(ErrorCode::INTERNAL_ERROR, e.what());
+    } catch (...) {
+        return ERROR(ErrorCode::INTERNAL_ERROR, "Unspecified error");
+    }
+
+    return ErrorCode::NO_ERROR;
+}
+
 static const char* get_error_description_impl(int errorcode) {
     if (!is_valid_error_code(errorcode))
         return nullptr;
@@ -212,8 +652,8 @@ static const char* get_last_error_extra_info_impl(int errorcode, void* context)
 
 extern "C" {
 
-LIBSDOD_API int libsdod_setup(void** context, const char* models_dir, unsigned int latent_channels, unsigned int latent_spatial, unsigned int upscale_factor, unsigned int steps, unsigned int log_level, int use_htp) {
-    return static_cast<int>(libsdod::setup_impl(context, models_dir, latent_channels, latent_spatial, upscale_factor, steps, log_level, static_cast<bool>(use_htp)));
+LIBSDOD_API int libsdod_setup(void** context, const char* models_dir, unsigned int latent_channels, unsigned int latent_spatial, unsigned int upscale_factor, unsigned int steps, unsigned int log_level, int backend) {
+    return static_cast<int>(libsdod::setup_impl(context, models_dir, latent_channels, latent_spatial, upscale_factor, steps, log_level, backend));
 }
 
 LIBSDOD_API int libsdod_set_steps(void* context, unsigned int steps) {
@@ -224,6 +664,38 @@ LIBSDOD_API int libsdod_set_log_level(void* context, unsigned int log_level) {
     return static_cast<int>(libsdod::set_log_level_impl(context, log_level));
 }
 
+LIBSDOD_API int libsdod_set_decoder(void* context, int decoder) {
+    return static_cast<int>(libsdod::set_decoder_impl(context, decoder));
+}
+
+LIBSDOD_API int libsdod_set_guidance_policy(void* context, int policy, float start, float end, unsigned int uncond_interval) {
+    return static_cast<int>(libsdod::set_guidance_policy_impl(context, policy, start, end, uncond_interval));
+}
+
+LIBSDOD_API int libsdod_set_step_skipping(void* context, int mode, const unsigned int* steps, unsigned int num_steps) {
+    return static_cast<int>(libsdod::set_step_skipping_impl(context, mode, steps, num_steps));
+}
+
+LIBSDOD_API int libsdod_calibrate_step_skipping(void* context, const char* const* prompts, unsigned int num_prompts, float guidance_scale, int mode, float* deviations, unsigned int num_deviations) {
+    return static_cast<int>(libsdod::calibrate_step_skipping_impl(context, prompts, num_prompts, guidance_scale, mode, deviations, num_deviations));
+}
+
+LIBSDOD_API int libsdod_set_feature_cache(void* context, unsigned int interval) {
+    return static_cast<int>(libsdod::set_feature_cache_impl(context, interval));
+}
+
+LIBSDOD_API int libsdod_set_early_stopping(void* context, float threshold, unsigned int patience) {
+    return static_cast<int>(libsdod::set_early_stopping_impl(context, threshold, patience));
+}
+
+LIBSDOD_API int libsdod_set_latency_budget(void* context, float budget_ms, unsigned int min_steps, unsigned int max_steps) {
+    return static_cast<int>(libsdod::set_latency_budget_impl(context, budget_ms, min_steps, max_steps));
+}
+
+LIBSDOD_API int libsdod_set_seed(void* context, unsigned int seed) {
+    return static_cast<int>(libsdod::set_seed_impl(context, seed));
+}
+
 LIBSDOD_API int libsdod_ref_context(void* context) {
     return static_cast<int>(libsdod::ref_context_impl(context));
 }
@@ -236,6 +708,54 @@ LIBSDOD_API int libsdod_generate_image(void* context, const char* prompt, float
     return static_cast<int>(libsdod::generate_image_impl(context, prompt, guidance_scale, image_out, image_buffer_size));
 }
 
+LIBSDOD_API int libsdod_generate_images(void* context, const char* const* prompts, unsigned int num_prompts, float guidance_scale, unsigned char** images_out, unsigned int* images_buffer_size) {
+    return static_cast<int>(libsdod::generate_images_impl(context, prompts, num_prompts, guidance_scale, images_out, images_buffer_size));
+}
+
+LIBSDOD_API int libsdod_generate_images_from(void* context, const char* const* prompts, const unsigned char* const* init_images, unsigned int num_prompts, float strength, float guidance_scale, unsigned char** images_out, unsigned int* images_buffer_size) {
+    return static_cast<int>(libsdod::generate_images_from_impl(context, prompts, init_images, num_prompts, strength, guidance_scale, images_out, images_buffer_size));
+}
+
+LIBSDOD_API int libsdod_generate_latents(void* context, const char* const* prompts, unsigned int num_prompts, float guidance_scale, float** latents_out, unsigned int* latents_buffer_size) {
+    return static_cast<int>(libsdod::generate_latents_impl(context, prompts, num_prompts, guidance_scale, latents_out, latents_buffer_size));
+}
+
+LIBSDOD_API int libsdod_decode_latents(void* context, const float* const* latents, unsigned int num_latents, unsigned char** images_out, unsigned int* images_buffer_size) {
+    return static_cast<int>(libsdod::decode_latents_impl(context, latents, num_latents, images_out, images_buffer_size));
+}
+
+LIBSDOD_API int libsdod_decode_latent(void* context, const float* latent, unsigned int latent_height, unsigned int latent_width, unsigned char** image_out, unsigned int* image_buffer_size) {
+    return static_cast<int>(libsdod::decode_latent_impl(context, latent, latent_height, latent_width, image_out, image_buffer_size));
+}
+
+LIBSDOD_API int libsdod_get_stats(void* context, const char* const** names, const double** values, unsigned int* count) {
+    return static_cast<int>(libsdod::get_stats_impl(context, names, values, count));
+}
+
+LIBSDOD_API int libsdod_start_recording(void* context, const char* trace_path) {
+    return static_cast<int>(libsdod::start_recording_impl(context, trace_path));
+}
+
+LIBSDOD_API int libsdod_stop_recording(void* context) {
+    return static_cast<int>(libsdod::stop_recording_impl(context));
+}
+
+LIBSDOD_API int libsdod_start_calibration(void* context) {
+    return static_cast<int>(libsdod::start_calibration_impl(context));
+}
+
+LIBSDOD_API int libsdod_save_calibration(void* context, const char* output_dir, unsigned int bitwidth, float percentile) {
+    return static_cast<int>(libsdod::save_calibration_impl(context, output_dir, bitwidth, percentile));
+}
+
+LIBSDOD_API int libsdod_stop_calibration(void* context) {
+    return static_cast<int>(libsdod::stop_calibration_impl(context));
+}
+
+LIBSDOD_API const char* libsdod_get_version() {
+    return LIBSDOD_VERSION_STR;
+}
+
 LIBSDOD_API const char* libsdod_get_error_description(int errorcode) {
     return libsdod::get_error_description_impl(errorcode);
 }
@@ -0,0 +1,82 @@
+#ifndef LIBSDOD_NOISE_H
+#define LIBSDOD_NOISE_H
+
+#include <cmath>
+#include <cstdint>
+#include <cstddef>
+#include <algorithm>
+#include <numbers>
+
+
+namespace libsdod {
+
+// Philox4x32-10 counter-based generator (Salmon et al., "Parallel random numbers: as easy as 1, 2, 3"): each output block
+// is a function of its 128-bit counter and a 64-bit key only, so any part of a stream can be generated independently of the rest
+constexpr unsigned int philox_rounds = 10;
+
+// blocks processed together, the rounds are written over arrays of counters so that the compiler can vectorize them
+constexpr std::size_t philox_lanes = 16;
+
+inline void philox4x32(uint32_t* c0, uint32_t* c1, uint32_t* c2, uint32_t* c3, uint32_t k0, uint32_t k1) {
+    constexpr uint64_t m0 = 0xD2511F53, m1 = 0xCD9E8D57;
+    constexpr uint32_t w0 = 0x9E3779B9, w1 = 0xBB67AE85;
+    for (unsigned int r = 0; r < philox_rounds; ++r) {
+        for (std::size_t l = 0; l < philox_lanes; ++l) {
+            uint64_t p0 = m0 * c0[l];
+            uint64_t p1 = m1 * c2[l];
+            uint32_t n0 = static_cast<uint32_t>(p1 >> 32) ^ c1[l] ^ k0;
+            uint32_t n2 = static_cast<uint32_t>(p0 >> 32) ^ c3[l] ^ k1;
+            c1[l] = static_cast<uint32_t>(p1);
+            c3[l] = static_cast<uint32_t>(p0);
+            c0[l] = n0;
+            c2[l] = n2;
+        }
+        k0 += w0;
+        k1 += w1;
+    }
+}
+
+
+// fills ``out`` with standard normal noise: element ``i`` of stream ``stream`` (e.g. an image) of generator ``seed`` is always the same value,
+// no matter how the stream is split between calls or threads; ``first`` is the index of ``out[0]`` within the stream.
+// Each block of 4 random words gives 4 elements, as 2 pairs of the Box-Muller transform.
+inline void normal_noise(float* out, std::size_t elements, uint64_t seed, uint64_t stream, std::size_t first = 0) {
+    constexpr std::size_t block_elements = 4 * philox_lanes;
+    constexpr float to_unit = 0x1p-24f;
+    constexpr float two_pi = 2.0f * std::numbers::pi_v<float>;
+
+    uint32_t c0[philox_lanes], c1[philox_lanes], c2[philox_lanes], c3[philox_lanes];
+    float radius[2 * philox_lanes], angle[2 * philox_lanes];
+    float values[block_elements];
+
+    auto end = first + elements;
+    for (auto block = first / 4; block * 4 < end; block += philox_lanes) {
+        for (std::size_t l = 0; l < philox_lanes; ++l) {
+            c0[l] = static_cast<uint32_t>(block + l);
+            c1[l] = static_cast<uint32_t>((block + l) >> 32);
+            c2[l] = static_cast<uint32_t>(stream);
+            c3[l] = static_cast<uint32_t>(stream >> 32);
+        }
+        philox4x32(c0, c1, c2, c3, static_cast<uint32_t>(seed), static_cast<uint32_t>(seed >> 32));
+
+        // 24 bits of each word, the first of a pair in (0, 1] so that its log is finite
+        for (std::size_t l = 0; l < philox_lanes; ++l) {
+            radius[2 * l] = std::sqrt(-2.0f * std::log(((c0[l] >> 8) + 1) * to_unit));
+            angle[2 * l] = two_pi * ((c1[l] >> 8) * to_unit);
+            radius[2 * l + 1] = std::sqrt(-2.0f * std::log(((c2[l] >> 8) + 1) * to_unit));
+            angle[2 * l + 1] = two_pi * ((c3[l] >> 8) * to_unit);
+        }
+        for (std::size_t p = 0; p < 2 * philox_lanes; ++p) {
+            values[2 * p] = radius[p] * std::cos(angle[p]);
+            values[2 * p + 1] = radius[p] * std::sin(angle[p]);
+        }
+
+        auto lo = std::max(first, block * 4);
+        auto hi = std::min(end, block * 4 + block_elements);
+        std::copy(values + (lo - block * 4), values + (hi - block * 4), out + (lo - first));
+    }
+}
+
+}
+
+#endif // LIBSDOD_NOISE_H
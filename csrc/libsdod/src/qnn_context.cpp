@@ -2,6 +2,7 @@
 #include "errors.h"
 #include "utils.h"
 #include "logging.h"
+#include "conversions.h"
 
 #include <map>
 #include <string>
@@ -9,6 +10,7 @@
 #include <cassert>
 #include <cstring>
 #include <cmath>
+#include <chrono>
 #include <type_traits>
 #include <algorithm>
 
@@ -109,32 +111,6 @@ std::string _format_to_str(Qnn_TensorDataFormat_t tformat) {
     return format("unk({})", hex(tformat));
 }
 
-std::string _dtype_to_str(Qnn_DataType_t dtype) {
-    static const char* _names[] = {
-        "int8", "int16", "int32", "int64",
-        "uint8", "uint16", "uint32", "uint64",
-        "unk(0x0208)", "float16", "float32", "unk(0x0264)",
-        "sq8", "sq16", "sq32", "unk(0x0364)",
-        "uq8", "uq16", "uq32", "unk(0x0464)",
-        "bool"
-    };
-
-
-    uint8_t group = (dtype >> 8);
-    if (group > 5 || dtype > 0x0508)
-        return format("unk({})", hex(dtype));
-
-    uint8_t bits = (dtype & 0xFF);
-    if (bits != 0x08 && bits != 0x16 && bits != 0x32 && bits != 0x64)
-        return format("unk({})", hex(dtype));
-
-    bits = (bits >> 4 & 0x01) + (bits >> 5 & 0x01) + (bits >> 5 & 0x02);
-    assert(bits >= 0 && bits <= 3);
-    assert(group <= 5);
-    assert(group < 5 || bits == 0);
-    return _names[group*4 + bits];
-}
-
 std::string _ttype_to_str(Qnn_TensorType_t ttype) {
     switch (ttype) {
     case QNN_TENSOR_TYPE_APP_WRITE: return "w";
@@ -159,6 +135,9 @@ std::string _get_quant_data(Qnn_DataType_t dtype, Qnn_QuantizeParams_t qparam) {
 struct _notify_fn_internal_workload {
     std::function<void(void*, Qnn_NotifyStatus_t)> fn;
     void* param;
+    // descriptors passed to the backend, owned by the request (the graph's own ones are rewritten by activate), see QnnGraph::execute_async
+    std::vector<Qnn_Tensor_t> inputs;
+    std::vector<Qnn_Tensor_t> outputs;
 };
 
 
@@ -166,7 +145,8 @@ void _notify_fn_internal(void* param, Qnn_NotifyStatus_t status) {
     auto* _workload = reinterpret_cast<_notify_fn_internal_workload*>(param);
     auto&& _guard = scope_guard([_workload](){ delete _workload; });
     (void)_guard;
-    _workload->fn(_workload->param, status);
+    if (_workload->fn)
+        _workload->fn(_workload->param, status);
 }
 
 
@@ -185,16 +165,30 @@ bool _span_equal(std::span<T, TE> const& s1, std::span<U, UE> const& s2) {
 } // anonymous
 
 
-namespace libsdod {
+std::string libsdod::dtype_to_str(Qnn_DataType_t dtype) {
+    static const char* _names[] = {
+        "int8", "int16", "int32", "int64",
+        "uint8", "uint16", "uint32", "uint64",
+        "unk(0x0208)", "float16", "float32", "unk(0x0264)",
+        "sq8", "sq16", "sq32", "unk(0x0364)",
+        "uq8", "uq16", "uq32", "unk(0x0464)",
+        "bool"
+    };
+
 
-// defined at the end of this file
-//arguments are such that first is always qnn memory, second is always host
-template <bool Accum, bool Scale, class T>
-void qnn2host(const void* src, T* dst, unsigned int elements, const Qnn_Tensor_t& desc, float scale);
+    uint8_t group = (dtype >> 8);
+    if (group > 5 || dtype > 0x0508)
+        return format("unk({})", hex(dtype));
 
-template <bool Accum, bool Scale, class T>
-void host2qnn(void* dst, const T* src, unsigned int elements, const Qnn_Tensor_t& desc, float scale);
+    uint8_t bits = (dtype & 0xFF);
+    if (bits != 0x08 && bits != 0x16 && bits != 0x32 && bits != 0x64)
+        return format("unk({})", hex(dtype));
 
+    bits = (bits >> 4 & 0x01) + (bits >> 5 & 0x01) + (bits >> 5 & 0x02);
+    assert(bits >= 0 && bits <= 3);
+    assert(group <= 5);
+    assert(group < 5 || bits == 0);
+    return _names[group*4 + bits];
 }
 
 
@@ -456,7 +450,7 @@ void QnnApi::execute_graph_async(Qnn_GraphHandle_t graph, std::span<Qnn_Tensor_t
 }
 
 
-QnnTensor::QnnTensor(QnnTensor&& other) : is_ion(other.is_ion), batch_size(other.batch_size), data(std::move(other.data)), data_size(other.data_size), data_fd(other.data_fd), data_hnd(std::move(other.data_hnd)), slot(other.slot) {
+QnnTensor::QnnTensor(QnnTensor&& other) : is_ion(other.is_ion), batch_size(other.batch_size), data(std::move(other.data)), data_size(other.data_size), data_fd(other.data_fd), data_hnd(std::move(other.data_hnd)), slot(other.slot), links(std::move(other.links)) {
     if (slot.current_tensor == &other)
         slot.current_tensor = this;
 }
@@ -502,10 +496,22 @@ bool QnnTensor::is_floating_point(Qnn_Tensor_t const& t) {
 }
 
 
+bool QnnTensor::same_encoding(Qnn_Tensor_t const& a, Qnn_Tensor_t const& b) {
+    if (a.v1.dataType != b.v1.dataType)
+        return false;
+    if (!is_quantized(a))
+        return true;
+    return a.v1.quantizeParams.scaleOffsetEncoding.scale == b.v1.quantizeParams.scaleOffsetEncoding.scale &&
+        a.v1.quantizeParams.scaleOffsetEncoding.offset == b.v1.quantizeParams.scaleOffsetEncoding.offset;
+}
+
+
 void QnnTensor::activate() const {
     if (!batch_size)
         throw libsdod_exception(ErrorCode::INTERNAL_ERROR, "Cannot activate QnnTensor with batch_size==0!", __func__, __FILE__, STR(__LINE__));
 
+    for (auto&& l : links)
+        l.activate();
     if (slot.current_tensor == this)
         return;
 
@@ -530,6 +536,8 @@ void QnnTensor::deactivate() const {
     if (!batch_size)
         return;
 
+    for (auto&& l : links)
+        l.deactivate();
     if (slot.current_tensor != this)
         return;
 
@@ -560,14 +568,14 @@ QnnTensor::QnnTensor(QnnApi& api, Qnn_ContextHandle_t ctx, graph_slot& slot, uns
         desc.ionInfo.fd = data_fd;
         data_hnd = api.mem_register(ctx, desc);
         is_ion = true;
-        debug("New ION tensor allocated: {}; target: {}, {}, {}", data.get(), get_slot_name(), _dtype_to_str(slot.target.v1.dataType), std::span(slot.target.v1.dimensions, slot.target.v1.rank));
+        debug("New ION tensor allocated: {}; target: {}, {}, {}", data.get(), get_slot_name(), dtype_to_str(slot.target.v1.dataType), std::span(slot.target.v1.dimensions, slot.target.v1.rank));
     } else {
         data = std::shared_ptr<void>(new uint8_t[data_size], [](void* ptr) {
             debug("Freeing memory: {}", ptr);
         });
         debug("Memory allocated: {}, {}", data.get(), data_size);
         is_ion = false;
-        debug("New standard tensor allocated: {}; target: {}, {}, {}", data.get(), get_slot_name(), _dtype_to_str(slot.target.v1.dataType), std::span(slot.target.v1.dimensions, slot.target.v1.rank));
+        debug("New standard tensor allocated: {}; target: {}, {}, {}", data.get(), get_slot_name(), dtype_to_str(slot.target.v1.dataType), std::span(slot.target.v1.dimensions, slot.target.v1.rank));
     }
 }
 
@@ -575,7 +583,7 @@ QnnTensor::QnnTensor(QnnApi& api, Qnn_ContextHandle_t ctx, graph_slot& slot, uns
 QnnTensor::QnnTensor(QnnTensor const& other, graph_slot& slot, bool strict_shape) : is_ion(other.is_ion), batch_size(other.batch_size),
     data(other.data), data_size(other.data_size), data_fd(other.data_fd), data_hnd(other.data_hnd), slot(slot) {
     if (slot.target.v1.dataFormat != other.slot.target.v1.dataFormat ||
-        slot.target.v1.dataType != other.slot.target.v1.dataType ||
+        !same_encoding(slot.target, other.slot.target) ||
         (
             !_span_equal(std::span(slot.target.v1.dimensions, slot.target.v1.rank), std::span(other.slot.target.v1.dimensions, other.slot.target.v1.rank)) &&
             (strict_shape || get_num_elements(1) != other.get_num_elements(1)))
@@ -585,6 +593,13 @@ QnnTensor::QnnTensor(QnnTensor const& other, graph_slot& slot, bool strict_shape
 }
 
 
+void QnnTensor::link(QnnTensor&& alias) {
+    if (alias.data != data)
+        throw libsdod_exception(ErrorCode::INTERNAL_ERROR, format("Tensor targeting {} is not an alias of the tensor targeting {}", alias.get_slot_name(), get_slot_name()), __func__, __FILE__, STR(__LINE__));
+    links.push_back(std::move(alias));
+}
+
+
 #define _GENERIC_DATA_COPY(fn, scale, scale_arg) \
     auto needed = get_num_elements(batch_size); \
     if (needed > buffer.size()) \
@@ -608,6 +623,65 @@ void QnnTensor::get_data(std::vector<float>& buffer, float scale, bool accum) co
 std::string QnnTensor::get_slot_name() const { return format("{}:{}", slot.graph.get_name(), slot.target.v1.name); }
 
 
+uint32_t QnnTensor::_check_batch_access(unsigned int idx, std::size_t buffer_size) const {
+    if (idx >= batch_size)
+        throw libsdod_exception(ErrorCode::INVALID_ARGUMENT, format("Batch index {} out of range for tensor {} with batch size {}", idx, get_slot_name(), batch_size), __func__, __FILE__, STR(__LINE__));
+    auto needed = get_num_elements(1);
+    if (needed > buffer_size)
+        throw libsdod_exception(ErrorCode::INVALID_ARGUMENT, format("Insufficient host vector! Got: {}, requires: {}", buffer_size, needed), __func__, __FILE__, STR(__LINE__));
+    return needed;
+}
+
+
+void QnnTensor::set_batch_data(unsigned int idx, std::vector<float> const& buffer) {
+    auto elements = _check_batch_access(idx, buffer.size());
+    auto dst = reinterpret_cast<uint8_t*>(data.get()) + std::size_t(idx) * elements * get_element_size();
+    host2qnn<false, false>(dst, buffer.data(), elements, slot.target, 0.0f);
+}
+
+
+void QnnTensor::get_batch_data(unsigned int idx, std::vector<float>& buffer) const {
+    auto elements = _check_batch_access(idx, buffer.size());
+    auto src = reinterpret_cast<const uint8_t*>(data.get()) + std::size_t(idx) * elements * get_element_size();
+    qnn2host<false, false>(src, buffer.data(), elements, slot.target, 0.0f);
+}
+
+
+void QnnTensor::broadcast_batch(unsigned int src) {
+    if (src >= batch_size)
+        throw libsdod_exception(ErrorCode::INVALID_ARGUMENT, format("Batch index {} out of range for tensor {} with batch size {}", src, get_slot_name(), batch_size), __func__, __FILE__, STR(__LINE__));
+    auto bytes = std::size_t(get_num_elements(1)) * get_element_size();
+    auto base = reinterpret_cast<uint8_t*>(data.get());
+    for (auto i : range(batch_size))
+        if (i != src)
+            std::memcpy(base + i * bytes, base + src * bytes, bytes);
+}
+
+
+void QnnTensor::get_guided_data(std::vector<float>& buffer, float guidance) const {
+    if (batch_size != 2)
+        throw libsdod_exception(ErrorCode::INVALID_ARGUMENT, format("Guidance requires a tensor with batch size 2, tensor {} has: {}", get_slot_name(), batch_size), __func__, __FILE__, STR(__LINE__));
+    auto elements = _check_batch_access(0, buffer.size());
+    auto cond = reinterpret_cast<const uint8_t*>(data.get());
+    guided2host(cond, cond + std::size_t(elements) * get_element_size(), buffer.data(), elements, slot.target, guidance);
+}
+
+
+void QnnTensor::copy_to(QnnTensor& dst, unsigned int dst_idx) const {
+    auto elements = get_num_elements(1);
+    if (elements != dst.get_num_elements(1) || dst_idx + batch_size > dst.batch_size)
+        throw libsdod_exception(ErrorCode::INVALID_ARGUMENT, format("Cannot copy tensor {} (batch size {}) to tensor {} (batch size {}) at batch index {}", get_slot_name(), batch_size, dst.get_slot_name(), dst.batch_size, dst_idx), __func__, __FILE__, STR(__LINE__));
+
+    auto total = std::size_t(elements) * batch_size;
+    auto out = reinterpret_cast<uint8_t*>(dst.data.get()) + std::size_t(dst_idx) * elements * dst.get_element_size();
+    if (same_encoding(slot.target, dst.slot.target)) {
+        if (out != data.get()) // nothing to do if dst aliases this tensor
+            std::memcpy(out, data.get(), total * get_element_size());
+    } else
+        convert_elements(data.get(), slot.target, out, dst.slot.target, total);
+}
+
+
 QnnGraph::QnnGraph(QnnGraph::CtorToken&& token)
     : orig_name(token.orig_name), inputs(token.inputs), outputs(token.outputs), 
       graph(token.graph), ctx(std::move(token.ctx)), api(std::move(token.api)), name(token.orig_name) {
@@ -615,11 +689,11 @@ QnnGraph::QnnGraph(QnnGraph::CtorToken&& token)
         debug("New graph: {} @ {}", orig_name, this);
         debug("    Num inputs: {}", inputs.size());
         for (auto&& t : this->inputs) {
-            debug("        {}: {}, {}, {}, {} {}", t.v1.name, _format_to_str(t.v1.dataFormat), _dtype_to_str(t.v1.dataType), _ttype_to_str(t.v1.type), std::span(t.v1.dimensions, t.v1.rank), _get_quant_data(t.v1.dataType, t.v1.quantizeParams));
+            debug("        {}: {}, {}, {}, {} {}", t.v1.name, _format_to_str(t.v1.dataFormat), dtype_to_str(t.v1.dataType), _ttype_to_str(t.v1.type), std::span(t.v1.dimensions, t.v1.rank), _get_quant_data(t.v1.dataType, t.v1.quantizeParams));
         }
         debug("    Num outputs: {}", outputs.size());
         for (auto&& t : this->outputs) {
-            debug("        {}: {}, {}, {}, {} {}", t.v1.name, _format_to_str(t.v1.dataFormat), _dtype_to_str(t.v1.dataType), _ttype_to_str(t.v1.type), std::span(t.v1.dimensions, t.v1.rank), _get_quant_data(t.v1.dataType, t.v1.quantizeParams));
+            debug("        {}: {}, {}, {}, {} {}", t.v1.name, _format_to_str(t.v1.dataFormat), dtype_to_str(t.v1.dataType), _ttype_to_str(t.v1.type), std::span(t.v1.dimensions, t.v1.rank), _get_quant_data(t.v1.dataType, t.v1.quantizeParams));
         }
     }
 
@@ -708,20 +782,145 @@ void QnnGraph::verify() {
 }
 
 
+std::vector<TraceTensor> QnnGraph::_describe_slots(graph_slots const& slots) const {
+    std::vector<TraceTensor> ret;
+    for (auto&& s : slots) {
+        auto&& t = s.target.v1;
+        ret.emplace_back(TraceTensor{
+            .name = t.name,
+            .dtype = t.dataType,
+            .dims = std::vector<uint32_t>(t.dimensions, t.dimensions + t.rank),
+            .scale = t.quantizeParams.scaleOffsetEncoding.scale,
+            .offset = t.quantizeParams.scaleOffsetEncoding.offset,
+            .data = (s.current_tensor ? s.current_tensor->get_raw_data() : std::span<const uint8_t>())
+        });
+    }
+    return ret;
+}
+
+
+void QnnGraph::add_observer(std::shared_ptr<ExecutionObserver> observer) {
+    if (!observer)
+        throw libsdod_exception(ErrorCode::INVALID_ARGUMENT, "observer is nullptr", __func__, __FILE__, STR(__LINE__));
+    if (std::find(observers.begin(), observers.end(), observer) == observers.end())
+        observers.push_back(std::move(observer));
+}
+
+
+void QnnGraph::remove_observer(std::shared_ptr<ExecutionObserver> const& observer) {
+    std::erase(observers, observer);
+}
+
+
 void QnnGraph::execute() {
+    if (observers.empty())
+        return api->execute_graph(graph, inputs, outputs);
+
+    // inputs are copied in case they share memory with outputs
+    auto&& observed_inputs = _describe_slots(input_slots);
+    std::list<std::vector<uint8_t>> inputs_copy;
+    for (auto&& t : observed_inputs)
+        t.data = inputs_copy.emplace_back(t.data.begin(), t.data.end());
+
+    auto&& tick = std::chrono::high_resolution_clock::now();
     api->execute_graph(graph, inputs, outputs);
+    auto&& tock = std::chrono::high_resolution_clock::now();
+    auto&& observed_outputs = _describe_slots(output_slots);
+    for (auto&& o : observers)
+        o->on_execution(name, observed_inputs, observed_outputs, std::chrono::duration<double, std::milli>(tock - tick).count());
 }
 
 
 void QnnGraph::execute_async(std::function<void(void*, Qnn_NotifyStatus_t)> notify, void* notify_param) {
-    if (!notify) {
-        if (notify_param)
-            throw libsdod_exception(ErrorCode::INVALID_ARGUMENT, "notify_params provided but notify function is empty!", __func__, __FILE__, STR(__LINE__));
-        return api->execute_graph_async(graph, inputs, outputs, nullptr, nullptr);
+    if (!notify && notify_param)
+        throw libsdod_exception(ErrorCode::INVALID_ARGUMENT, "notify_params provided but notify function is empty!", __func__, __FILE__, STR(__LINE__));
+    _execute_async(_prepare_execution(), std::move(notify), notify_param);
+}
+
+
+QnnGraph::PreparedExecution QnnGraph::_prepare_execution() const {
+    PreparedExecution ret{ .inputs = std::vector<Qnn_Tensor_t>(inputs.begin(), inputs.end()), .outputs = std::vector<Qnn_Tensor_t>(outputs.begin(), outputs.end()) };
+    if (!observers.empty()) {
+        ret.observed_inputs = _describe_slots(input_slots);
+        ret.observed_outputs = _describe_slots(output_slots);
+    }
+    return ret;
+}
+
+
+void QnnGraph::_execute_async(PreparedExecution&& request, std::function<void(void*, Qnn_NotifyStatus_t)> notify, void* notify_param) {
+    if (!observers.empty()) {
+        // inputs are copied at submission, outputs are read when the execution finishes - but from the tensors
+        // active when the execution was prepared, different ones might be active by then
+        auto&& observed_inputs = std::make_shared<std::vector<TraceTensor>>(std::move(request.observed_inputs));
+        auto&& observed_outputs = std::make_shared<std::vector<TraceTensor>>(std::move(request.observed_outputs));
+        auto&& inputs_copy = std::make_shared<std::list<std::vector<uint8_t>>>();
+        for (auto&& t : *observed_inputs)
+            t.data = inputs_copy->emplace_back(t.data.begin(), t.data.end());
+
+        auto&& tick = std::chrono::high_resolution_clock::now();
+        notify = [this, observers=observers, observed_inputs, observed_outputs, inputs_copy, tick, user_notify=std::move(notify)](void* param, Qnn_NotifyStatus_t status) {
+            auto&& tock = std::chrono::high_resolution_clock::now();
+            for (auto&& o : observers)
+                o->on_execution(name, *observed_inputs, *observed_outputs, std::chrono::duration<double, std::milli>(tock - tick).count());
+            if (user_notify)
+                user_notify(param, status);
+        };
+    }
+
+    // the backend may keep reading the descriptors (and writes to the output ones) until the request is done, while tensors
+    // of the graph can be (de)activated in the meantime - so each request gets its own copies, freed by the notification
+    auto* _param = new _notify_fn_internal_workload{ .fn=std::move(notify), .param=notify_param, .inputs=std::move(request.inputs), .outputs=std::move(request.outputs) };
+    std::span<Qnn_Tensor_t> request_outputs{ _param->outputs };
+    try {
+        api->execute_graph_async(graph, _param->inputs, request_outputs, _notify_fn_internal, _param);
+    } catch (...) {
+        delete _param;
+        throw;
     }
+}
+
+
+std::future<void> QnnGraph::submit() {
+    return submit_sequence({ this });
+}
+
+
+std::future<void> QnnGraph::submit_sequence(std::vector<QnnGraph*> const& graphs) {
+    if (graphs.empty())
+        throw libsdod_exception(ErrorCode::INVALID_ARGUMENT, "No graphs to submit", __func__, __FILE__, STR(__LINE__));
+
+    // shared by the notifications, each of which submits the next graph (or reports the result of the whole sequence)
+    // NOTE: the next graph is submitted (QnnGraph_executeAsync) from inside the backend's notify callback - the stub allows it,
+    // as it notifies from its worker thread without holding its queue lock, but no real HTP backend has been shown to accept it
+    struct Sequence : std::enable_shared_from_this<Sequence> {
+        std::vector<std::pair<QnnGraph*, PreparedExecution>> graphs;
+        std::promise<void> done;
+
+        void submit(std::size_t idx) {
+            auto&& [graph, request] = graphs[idx];
+            graph->_execute_async(std::move(request), [self = shared_from_this(), idx](void*, Qnn_NotifyStatus_t status) {
+                auto* graph = self->graphs[idx].first;
+                if (status.error != QNN_SUCCESS)
+                    return self->done.set_exception(std::make_exception_ptr(
+                        libsdod_exception(ErrorCode::RUNTIME_ERROR, format("Asynchronous execution of graph {} failed with error: {}", graph->name, status.error), __func__, __FILE__, STR(__LINE__))));
+                if (idx + 1 == self->graphs.size())
+                    return self->done.set_value();
+                try {
+                    self->submit(idx + 1);
+                } catch (...) {
+                    self->done.set_exception(std::current_exception());
+                }
+            }, nullptr);
+        }
+    };
 
-    auto* _param = new _notify_fn_internal_workload{ .fn=std::move(notify), .param=notify_param };
-    api->execute_graph_async(graph, inputs, outputs, _notify_fn_internal, _param);
+    auto&& sequence = std::make_shared<Sequence>();
+    for (auto* graph : graphs)
+        sequence->graphs.emplace_back(graph, graph->_prepare_execution());
+    auto&& ret = sequence->done.get_future();
+    sequence->submit(0);
+    return ret;
 }
 
 
@@ -1005,141 +1204,3 @@ graph_list QnnBackend::load_graphs(std::string const& file, bool is_cached) {
     else
         return load_model(file);
 }
-
-
-/*
- * DATA MOVING FUNCTIONS BELOW
-*/
-
-
-namespace libsdod { namespace {
-
-
-template <bool Accum, bool Scale, class T, class U>
-void tf2any(T* out, const U* in, int32_t offset, float scale, std::size_t elements, float accum_scale) {
-    static_assert(std::is_unsigned<U>::value, "tf2float supports only unsigned types!");
-    double offset_d = static_cast<double>(offset);
-    for (auto i : range(elements)) {
-        double quant = static_cast<double>(in[i]);
-        if constexpr (Accum && Scale)
-            out[i] += static_cast<T>(accum_scale * static_cast<float>((quant + offset_d) * scale));
-        else if constexpr (Accum)
-            out[i] += static_cast<T>((quant + offset_d) * scale);
-        else if constexpr (Scale)
-            out[i] = static_cast<T>(accum_scale * static_cast<float>((quant + offset_d) * scale));
-        else
-            out[i] = static_cast<T>((quant + offset_d) * scale);
-    }
-}
-
-template <bool Accum, bool Scale, class T, class U>
-void any2tf(T* out, const U* in, int32_t offset, float scale, std::size_t elements, float accum_scale) {
-    static_assert(std::is_unsigned<T>::value, "float2tf supports only unsigned types!");
-
-    std::size_t bits = sizeof(T) * 8;
-    double max_in = double((2 << bits) - 1);
-    double enc_min = offset * scale;
-    double enc_max = (max_in + offset) * scale;
-    double enc_range = enc_max - enc_min;
-    int lower = 0;
-    int upper = (int)max_in;
-
-    T quant_scale;
-    if constexpr (Scale) {
-        quant_scale = static_cast<T>(std::clamp<int>(std::round(max_in * (accum_scale - enc_min) / enc_range), lower, upper));
-    }
-
-    for (auto i : range(elements)) {
-        int quant = std::clamp<int>(std::round(max_in * (static_cast<double>(in[i]) - enc_min) / enc_range), lower, upper);
-        if constexpr (Accum && Scale)
-            out[i] += quant_scale * static_cast<T>(quant);
-        else if constexpr (Accum)
-            out[i] += static_cast<T>(quant);
-        else if constexpr (Scale)
-            out[i] = quant_scale * static_cast<T>(quant);
-        else
-            out[i] = static_cast<T>(quant);
-    }
-}
-
-template <bool Accum, bool Scale, class T, class U>
-void simple_cast(T* dst, const U* src, std::size_t elements, float scale) {
-    if constexpr (!Accum && !Scale && std::is_same<T, U>::value)
-        std::memcpy(dst, src, elements*sizeof(T));
-    else {
-        for (auto i : range(elements)) {
-            if constexpr (Accum && Scale)
-                dst[i] += static_cast<T>(static_cast<float>(src[i]) * scale);
-            else if constexpr (Accum)
-                dst[i] += static_cast<T>(src[i]);
-            else if constexpr (Scale)
-                dst[i] = static_cast<T>(static_cast<float>(src[i]) * scale);
-            else
-                dst[i] = static_cast<T>(src[i]);
-        }
-    }
-}
-
-}
-
-
-template <bool Accum, bool Scale, class T>
-void qnn2host(const void* src, T* dst, unsigned int elements, const Qnn_Tensor_t& desc, float scale) {
-    switch (desc.v1.dataType) {
-    case QNN_DATATYPE_UFIXED_POINT_8:
-        tf2any<Accum, Scale>(dst, reinterpret_cast<const uint8_t*>(src), desc.v1.quantizeParams.scaleOffsetEncoding.offset, desc.v1.quantizeParams.scaleOffsetEncoding.scale, elements, scale);
-        break;
-
-    case QNN_DATATYPE_UFIXED_POINT_16:
-        tf2any<Accum, Scale>(dst, reinterpret_cast<const uint16_t*>(src), desc.v1.quantizeParams.scaleOffsetEncoding.offset, desc.v1.quantizeParams.scaleOffsetEncoding.scale, elements, scale);
-        break;
-
-    case QNN_DATATYPE_FLOAT_16: return simple_cast<Accum, Scale>(dst, reinterpret_cast<const __fp16*>(src), elements, scale);
-    case QNN_DATATYPE_FLOAT_32: return simple_cast<Accum, Scale>(dst, reinterpret_cast<const float*>(src), elements, scale);
-
-    case QNN_DATATYPE_UINT_8: return simple_cast<Accum, Scale>(dst, reinterpret_cast<const uint8_t*>(src), elements, scale);
-    case QNN_DATATYPE_UINT_16: return simple_cast<Accum, Scale>(dst, reinterpret_cast<const uint16_t*>(src), elements, scale);
-    case QNN_DATATYPE_UINT_32: return simple_cast<Accum, Scale>(dst, reinterpret_cast<const uint32_t*>(src), elements, scale);
-    case QNN_DATATYPE_UINT_64: return simple_cast<Accum, Scale>(dst, reinterpret_cast<const uint64_t*>(src), elements, scale);
-
-    case QNN_DATATYPE_INT_8: return simple_cast<Accum, Scale>(dst, reinterpret_cast<const int8_t*>(src), elements, scale);
-    case QNN_DATATYPE_INT_16: return simple_cast<Accum, Scale>(dst, reinterpret_cast<const int16_t*>(src), elements, scale);
-    case QNN_DATATYPE_INT_32: return simple_cast<Accum, Scale>(dst, reinterpret_cast<const int32_t*>(src), elements, scale);
-    case QNN_DATATYPE_INT_64: return simple_cast<Accum, Scale>(dst, reinterpret_cast<const int64_t*>(src), elements, scale);
-
-    default:
-        throw libsdod_exception(ErrorCode::INVALID_ARGUMENT, format("Unexpected source tensor data type when copying to a host buffer: {}", _dtype_to_str(desc.v1.dataType)), __func__, __FILE__, STR(__LINE__));
-    }
-}
-
-
-template <bool Accum, bool Scale, class T>
-void host2qnn(void* dst, const T* src, unsigned int elements, const Qnn_Tensor_t& desc, float scale) {
-    switch (desc.v1.dataType) {
-    case QNN_DATATYPE_UFIXED_POINT_8:
-        any2tf<Accum, Scale>(reinterpret_cast<uint8_t*>(dst), src, desc.v1.quantizeParams.scaleOffsetEncoding.offset, desc.v1.quantizeParams.scaleOffsetEncoding.scale, elements, scale);
-        break;
-
-    case QNN_DATATYPE_UFIXED_POINT_16:
-        any2tf<Accum, Scale>(reinterpret_cast<uint16_t*>(dst), src, desc.v1.quantizeParams.scaleOffsetEncoding.offset, desc.v1.quantizeParams.scaleOffsetEncoding.scale, elements, scale);
-        break;
-
-    case QNN_DATATYPE_FLOAT_16: return simple_cast<Accum, Scale>(reinterpret_cast<__fp16*>(dst), src, elements, scale);
-    case QNN_DATATYPE_FLOAT_32: return simple_cast<Accum, Scale>(reinterpret_cast<float*>(dst), src, elements, scale);
-
-    case QNN_DATATYPE_UINT_8: return simple_cast<Accum, Scale>(reinterpret_cast<uint8_t*>(dst), src, elements, scale);
-    case QNN_DATATYPE_UINT_16: return simple_cast<Accum, Scale>(reinterpret_cast<uint16_t*>(dst), src, elements, scale);
-    case QNN_DATATYPE_UINT_32: return simple_cast<Accum, Scale>(reinterpret_cast<uint32_t*>(dst), src, elements, scale);
-    case QNN_DATATYPE_UINT_64: return simple_cast<Accum, Scale>(reinterpret_cast<uint64_t*>(dst), src, elements, scale);
-
-    case QNN_DATATYPE_INT_8: return simple_cast<Accum, Scale>(reinterpret_cast<int8_t*>(dst), src, elements, scale);
-    case QNN_DATATYPE_INT_16: return simple_cast<Accum, Scale>(reinterpret_cast<int16_t*>(dst), src, elements, scale);
-    case QNN_DATATYPE_INT_32: return simple_cast<Accum, Scale>(reinterpret_cast<int32_t*>(dst), src, elements, scale);
-    case QNN_DATATYPE_INT_64: return simple_cast<Accum, Scale>(reinterpret_cast<int64_t*>(dst), src, elements, scale);
-
-    default:
-        throw libsdod_exception(ErrorCode::INVALID_ARGUMENT, format("Unexpected destination tensor data type when copying a host buffer: {}", _dtype_to_str(desc.v1.dataType)), __func__, __FILE__, STR(__LINE__));
-    }
-}
-
-}
@@ -2,6 +2,7 @@
 #define LIBSDOD_QNN_CONTEXT_H
 
 #include "utils.h"
+#include "trace.h"
 
 #include <list>
 #include <span>
@@ -10,6 +11,7 @@
 #include <memory>
 #include <optional>
 #include <functional>
+#include <future>
 #include <mutex>
 
 #include <QnnInterface.h>
@@ -126,6 +128,8 @@ public:
     static uint8_t get_element_size(Qnn_Tensor_t const& t);
     static bool is_quantized(Qnn_Tensor_t const& t);
     static bool is_floating_point(Qnn_Tensor_t const& t);
+    // true if data of both tensors is stored in the same way (data type and quantization), regardless of their shapes
+    static bool same_encoding(Qnn_Tensor_t const& a, Qnn_Tensor_t const& b);
 
     void activate() const;
     void deactivate() const;
@@ -134,6 +138,7 @@ public:
     uint8_t get_element_size() const { return get_element_size(slot.target); }
     bool is_quantized() const { return is_quantized(slot.target); }
     bool is_floating_point() const { return is_floating_point(slot.target); }
+    Qnn_Tensor_t const& get_desc() const { return slot.target; }
 
     void set_data(std::vector<float> const& buffer, bool accum=false);
     void set_data(std::vector<uint16_t> const& buffer, bool accum=false);
@@ -145,9 +150,33 @@ public:
 
     void get_data(std::vector<float>& buffer, float scale, bool accum=false) const;
 
+    // access to a single element of the batch, ``idx`` should be smaller than the batch size
+    void set_batch_data(unsigned int idx, std::vector<float> const& buffer);
+    void get_batch_data(unsigned int idx, std::vector<float>& buffer) const;
+    // copies raw data of the element ``src`` to all other elements of the batch, without any conversions
+    void broadcast_batch(unsigned int src=0);
+    // buffer = guidance * batch[0] + (1 - guidance) * batch[1], for tensors holding (cond, uncond) outputs of batch 2
+    void get_guided_data(std::vector<float>& buffer, float guidance) const;
+
+    // copies all elements of the batch to ``dst``, starting at its element ``dst_idx``, without going through a host buffer:
+    // values are converted between the two formats in a single pass, or simply copied if both use the same encoding
+    void copy_to(QnnTensor& dst, unsigned int dst_idx=0) const;
+
+    unsigned int get_batch_size() const { return batch_size; }
+
+    // direct access to the memory backing the tensor, data is stored exactly as expected by the backend
+    std::span<uint8_t> get_raw_data() { return std::span(reinterpret_cast<uint8_t*>(data.get()), data_size); }
+    std::span<const uint8_t> get_raw_data() const { return std::span(reinterpret_cast<const uint8_t*>(data.get()), data_size); }
+
     std::string get_slot_name() const;
 
+    // keeps an alias of this tensor (see QnnGraph::attach_input), which is then (de)activated together with it,
+    // e.g. to bind the same input to several graphs executed one after another
+    void link(QnnTensor&& alias);
+
 private:
+    uint32_t _check_batch_access(unsigned int idx, std::size_t buffer_size) const;
+
     QnnTensor(QnnApi& api, Qnn_ContextHandle_t ctx, graph_slot& slot, unsigned int batch_size=1); //allocate new
     QnnTensor(QnnTensor const& other, graph_slot& slot, bool strict_shape); //reuse the same allocation for different input/output slot
 
@@ -160,6 +189,7 @@ private:
     qnn_hnd<Qnn_MemHandle_t> data_hnd;
 
     graph_slot& slot;
+    std::vector<QnnTensor> links;
 };
 
 
@@ -189,13 +219,28 @@ public:
     auto get_num_inputs() const { return inputs.size(); }
     auto get_num_outputs() const { return outputs.size(); }
 
+    Qnn_Tensor_t const& get_input_desc(unsigned int idx) const { return inputs[idx]; }
+    Qnn_Tensor_t const& get_output_desc(unsigned int idx) const { return outputs[idx]; }
+
     void verify();
     void execute();
     void execute_async(std::function<void(void*, Qnn_NotifyStatus_t)> notify = std::function<void(void*, Qnn_NotifyStatus_t)>(), void* notify_param = nullptr);
+    // asynchronous execution which can be waited for, errors reported by the backend are rethrown by ``get()``;
+    // tensors can be (de)activated as soon as this (or execute_async) returns, the submitted request keeps using its own copies
+    // of the descriptors of the ones active at submission
+    std::future<void> submit();
+    // as above, but for several graphs which have to run one after another (e.g. partitions of a model): each of them is handed
+    // to the backend only once the previous one has finished, rather than relying on the order in which the backend executes
+    // requests; all of them use the tensors active when this is called, the first error stops the sequence
+    static std::future<void> submit_sequence(std::vector<QnnGraph*> const& graphs);
 
     void set_name(std::string s) { name.swap(s); }
     auto const& get_name() const { return name; }
 
+    // observers are given inputs and outputs of each subsequent execution (e.g. to write them to a trace)
+    void add_observer(std::shared_ptr<ExecutionObserver> observer);
+    void remove_observer(std::shared_ptr<ExecutionObserver> const& observer);
+
 private:
     const char* orig_name;
     std::span<Qnn_Tensor_t> inputs;
@@ -209,6 +254,19 @@ private:
     std::shared_ptr<QnnApi> api;
 
     std::string name;
+    std::vector<std::shared_ptr<ExecutionObserver>> observers;
+
+    // what is needed to execute the graph with the tensors active at the time it was made, see execute_async
+    struct PreparedExecution {
+        std::vector<Qnn_Tensor_t> inputs;
+        std::vector<Qnn_Tensor_t> outputs;
+        std::vector<TraceTensor> observed_inputs; // only with observers, the data is copied when the execution is submitted
+        std::vector<TraceTensor> observed_outputs;
+    };
+
+    std::vector<TraceTensor> _describe_slots(graph_slots const& slots) const;
+    PreparedExecution _prepare_execution() const;
+    void _execute_async(PreparedExecution&& request, std::function<void(void*, Qnn_NotifyStatus_t)> notify, void* notify_param);
 };
 
 
@@ -0,0 +1,86 @@
+#ifndef LIBSDOD_SPSC_QUEUE_H
+#define LIBSDOD_SPSC_QUEUE_H
+
+#include <atomic>
+#include <vector>
+#include <cstddef>
+#include <algorithm>
+
+
+namespace libsdod {
+
+// Bounded single-producer single-consumer queue. Pushing and popping do not take any locks, when the queue is full (or empty)
+// the producer (or consumer) sleeps on the consumer's (or producer's) position using atomic wait/notify.
+// The producer additionally keeps track of the number of queued elements it has seen, to be reported as metrics.
+template <class T>
+class SpscQueue {
+public:
+    explicit SpscQueue(std::size_t capacity) : slots(std::max<std::size_t>(capacity, 1)) {}
+
+    SpscQueue(SpscQueue const&) = delete;
+    SpscQueue& operator=(SpscQueue const&) = delete;
+
+    // producer side
+    void push(T value) {
+        auto t = tail.load(std::memory_order_relaxed);
+        auto h = head.load(std::memory_order_acquire);
+        while (t - h == slots.size()) {
+            head.wait(h, std::memory_order_acquire);
+            h = head.load(std::memory_order_acquire);
+        }
+
+        slots[t % slots.size()] = std::move(value);
+        tail.store(t + 1, std::memory_order_release);
+        tail.notify_one();
+
+        auto depth = t + 1 - h;
+        max_depth = std::max(max_depth, depth);
+        depth_sum += depth;
+        ++pushes;
+    }
+
+    // consumer side
+    T pop() {
+        auto h = head.load(std::memory_order_relaxed);
+        auto t = tail.load(std::memory_order_acquire);
+        while (t == h) {
+            tail.wait(t, std::memory_order_acquire);
+            t = tail.load(std::memory_order_acquire);
+        }
+        return _take(h);
+    }
+
+    bool try_pop(T& value) {
+        auto h = head.load(std::memory_order_relaxed);
+        if (tail.load(std::memory_order_acquire) == h)
+            return false;
+        value = _take(h);
+        return true;
+    }
+
+    auto get_capacity() const { return slots.size(); }
+
+    // number of elements in the queue right after each push, only valid if read by the producer or after it has finished
+    auto get_max_depth() const { return max_depth; }
+    double get_mean_depth() const { return pushes ? double(depth_sum) / pushes : 0.0; }
+
+private:
+    std::vector<T> slots;
+    alignas(64) std::atomic<std::size_t> head = 0; // written by the consumer
+    alignas(64) std::atomic<std::size_t> tail = 0; // written by the producer
+
+    std::size_t max_depth = 0;
+    std::size_t depth_sum = 0;
+    std::size_t pushes = 0;
+
+    T _take(std::size_t h) {
+        T ret = std::move(slots[h % slots.size()]);
+        head.store(h + 1, std::memory_order_release);
+        head.notify_one();
+        return ret;
+    }
+};
+
+}
+
+#endif // LIBSDOD_SPSC_QUEUE_H
@@ -0,0 +1,30 @@
+#include "stats.h"
+
+using namespace libsdod;
+
+
+void Stats::record(std::string name, double value) {
+    auto&& _guard = std::lock_guard<std::mutex>{ _mutex };
+    (void)_guard;
+    _samples.emplace_back(Sample{ .name=std::move(name), .value=value });
+}
+
+
+void Stats::record_time(std::string name, clock::time_point const& t1, clock::time_point const& t2) {
+    auto&& diff = std::chrono::duration_cast<std::chrono::duration<double, std::milli>>(t2 - t1);
+    record(std::move(name), diff.count());
+}
+
+
+void Stats::clear() {
+    auto&& _guard = std::lock_guard<std::mutex>{ _mutex };
+    (void)_guard;
+    _samples.clear();
+}
+
+
+std::vector<Sample> Stats::get_samples() const {
+    auto&& _guard = std::lock_guard<std::mutex>{ _mutex };
+    (void)_guard;
+    return _samples;
+}
@@ -0,0 +1,35 @@
+#ifndef LIBSDOD_STATS_H
+#define LIBSDOD_STATS_H
+
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+
+
+namespace libsdod {
+
+struct Sample {
+    std::string name;
+    double value;
+};
+
+
+class Stats {
+public:
+    using clock = std::chrono::high_resolution_clock;
+
+    void record(std::string name, double value);
+    void record_time(std::string name, clock::time_point const& t1, clock::time_point const& t2); // in ms
+    void clear();
+
+    std::vector<Sample> get_samples() const;
+
+private:
+    mutable std::mutex _mutex;
+    std::vector<Sample> _samples;
+};
+
+}
+
+#endif // LIBSDOD_STATS_H
@@ -0,0 +1,215 @@
+#include "trace.h"
+#include "errors.h"
+#include "logging.h"
+
+#include <cstring>
+#include <algorithm>
+
+using namespace libsdod;
+
+
+namespace {
+
+constexpr char trace_magic[8] = { 'S', 'D', 'O', 'D', 'T', 'R', 'C', '1' };
+constexpr uint32_t trace_version = 1;
+constexpr uint64_t trace_alignment = 64;
+constexpr std::size_t max_name_len = 128;
+constexpr std::size_t max_rank = 8;
+
+struct FileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t alignment;
+};
+
+struct RecordHeader {
+    uint64_t record_size; // including this header, tensor headers, data and padding
+    uint64_t sequence;
+    double exec_ms;
+    uint32_t num_inputs;
+    uint32_t num_outputs;
+    char graph[max_name_len];
+};
+
+struct TensorHeader {
+    char name[max_name_len];
+    uint32_t dtype;
+    uint32_t rank;
+    uint32_t dims[max_rank];
+    float scale;
+    int32_t offset;
+    uint64_t data_offset; // relative to the beginning of the record
+    uint64_t data_size;
+};
+
+
+uint64_t _align(uint64_t value) {
+    return (value + trace_alignment - 1) / trace_alignment * trace_alignment;
+}
+
+
+void _copy_name(char (&dst)[max_name_len], std::string const& src) {
+    std::memset(dst, 0, max_name_len);
+    std::memcpy(dst, src.data(), std::min(src.size(), max_name_len - 1));
+}
+
+
+std::string _read_name(const char (&src)[max_name_len]) {
+    return std::string(src, strnlen(src, max_name_len));
+}
+
+}
+
+
+Qnn_Tensor_t TraceTensor::get_desc() const {
+    Qnn_Tensor_t ret{};
+    ret.version = QNN_TENSOR_VERSION_1;
+    ret.v1.name = name.c_str();
+    ret.v1.dataType = dtype;
+    ret.v1.rank = dims.size();
+    ret.v1.dimensions = const_cast<uint32_t*>(dims.data());
+    ret.v1.quantizeParams.encodingDefinition = QNN_DEFINITION_DEFINED;
+    ret.v1.quantizeParams.quantizationEncoding = QNN_QUANTIZATION_ENCODING_SCALE_OFFSET;
+    ret.v1.quantizeParams.scaleOffsetEncoding.scale = scale;
+    ret.v1.quantizeParams.scaleOffsetEncoding.offset = offset;
+    return ret;
+}
+
+
+uint32_t TraceTensor::get_num_elements() const {
+    uint32_t ret = 1;
+    for (auto d : dims)
+        ret *= d;
+    return ret;
+}
+
+
+TraceWriter::TraceWriter(std::string const& path) : path(path), out(path, std::ios::binary | std::ios::trunc) {
+    if (!out)
+        throw libsdod_exception(ErrorCode::INVALID_ARGUMENT, format("Could not open trace file for writing: {}", path), __func__, __FILE__, STR(__LINE__));
+
+    FileHeader header{};
+    std::memcpy(header.magic, trace_magic, sizeof(trace_magic));
+    header.version = trace_version;
+    header.alignment = trace_alignment;
+
+    std::vector<char> buffer(_align(sizeof(header)), 0);
+    std::memcpy(buffer.data(), &header, sizeof(header));
+    out.write(buffer.data(), buffer.size());
+    info("Recording graph executions to: {}", path);
+}
+
+
+TraceWriter::~TraceWriter() {
+    info("Recorded {} graph executions to: {}", next_sequence, path);
+}
+
+
+void TraceWriter::write(std::string const& graph, std::vector<TraceTensor> const& inputs, std::vector<TraceTensor> const& outputs, double exec_ms) {
+    auto&& _guard = std::lock_guard<std::mutex>{ mutex };
+    (void)_guard;
+
+    RecordHeader record{};
+    record.sequence = next_sequence;
+    record.exec_ms = exec_ms;
+    record.num_inputs = inputs.size();
+    record.num_outputs = outputs.size();
+    _copy_name(record.graph, graph);
+
+    std::vector<TensorHeader> headers;
+    std::vector<TraceTensor const*> tensors;
+    uint64_t pos = _align(sizeof(RecordHeader) + (inputs.size() + outputs.size()) * sizeof(TensorHeader));
+    for (auto&& list : { &inputs, &outputs }) {
+        for (auto&& t : *list) {
+            if (t.dims.size() > max_rank)
+                throw libsdod_exception(ErrorCode::INVALID_ARGUMENT, format("Cannot record tensor {} with rank {}", t.name, t.dims.size()), __func__, __FILE__, STR(__LINE__));
+
+            auto&& h = headers.emplace_back();
+            std::memset(&h, 0, sizeof(h));
+            _copy_name(h.name, t.name);
+            h.dtype = t.dtype;
+            h.rank = t.dims.size();
+            std::copy(t.dims.begin(), t.dims.end(), h.dims);
+            h.scale = t.scale;
+            h.offset = t.offset;
+            h.data_offset = pos;
+            h.data_size = t.data.size();
+            pos = _align(pos + t.data.size());
+            tensors.push_back(&t);
+        }
+    }
+    record.record_size = pos;
+
+    uint64_t written = 0;
+    auto&& pad_to = [this, &written](uint64_t target) {
+        static const char zeros[trace_alignment] = {};
+        while (written < target) {
+            auto len = std::min<uint64_t>(target - written, trace_alignment);
+            out.write(zeros, len);
+            written += len;
+        }
+    };
+
+    out.write(reinterpret_cast<const char*>(&record), sizeof(record));
+    out.write(reinterpret_cast<const char*>(headers.data()), headers.size() * sizeof(TensorHeader));
+    written = sizeof(record) + headers.size() * sizeof(TensorHeader);
+    for (auto i : range(tensors.size())) {
+        pad_to(headers[i].data_offset);
+        out.write(reinterpret_cast<const char*>(tensors[i]->data.data()), tensors[i]->data.size());
+        written += tensors[i]->data.size();
+    }
+    pad_to(record.record_size);
+    out.flush();
+
+    if (!out)
+        throw libsdod_exception(ErrorCode::RUNTIME_ERROR, format("Failed to write to trace file: {}", path), __func__, __FILE__, STR(__LINE__));
+
+    ++next_sequence;
+}
+
+
+TraceReader::TraceReader(std::string const& path) : file(path) {
+    if (!file.data)
+        throw libsdod_exception(ErrorCode::INVALID_ARGUMENT, format("Could not map trace file: {}", path), __func__, __FILE__, STR(__LINE__));
+
+    auto base = reinterpret_cast<const uint8_t*>(file.data);
+    uint64_t size = file.size;
+
+    auto header = reinterpret_cast<const FileHeader*>(base);
+    if (size < sizeof(FileHeader) || std::memcmp(header->magic, trace_magic, sizeof(trace_magic)) != 0)
+        throw libsdod_exception(ErrorCode::INVALID_ARGUMENT, format("Not a trace file: {}", path), __func__, __FILE__, STR(__LINE__));
+    if (header->version != trace_version || header->alignment != trace_alignment)
+        throw libsdod_exception(ErrorCode::INVALID_ARGUMENT, format("Unsupported trace version: {}, alignment: {}", header->version, header->alignment), __func__, __FILE__, STR(__LINE__));
+
+    uint64_t pos = _align(sizeof(FileHeader));
+    while (pos + sizeof(RecordHeader) <= size) {
+        auto record = reinterpret_cast<const RecordHeader*>(base + pos);
+        auto num_tensors = uint64_t(record->num_inputs) + record->num_outputs;
+        if (pos + record->record_size > size || sizeof(RecordHeader) + num_tensors * sizeof(TensorHeader) > record->record_size) {
+            info("Warning: trace {} ends with an incomplete record, {} complete records found", path, records.size());
+            break;
+        }
+
+        auto&& rec = records.emplace_back(TraceRecord{ .graph = _read_name(record->graph), .sequence = record->sequence, .exec_ms = record->exec_ms });
+        auto tensor_headers = reinterpret_cast<const TensorHeader*>(base + pos + sizeof(RecordHeader));
+        for (auto i : range(num_tensors)) {
+            auto&& h = tensor_headers[i];
+            if (h.rank > max_rank || h.data_offset + h.data_size > record->record_size)
+                throw libsdod_exception(ErrorCode::INVALID_ARGUMENT, format("Corrupted trace file {}, record {}, tensor {}", path, records.size() - 1, i), __func__, __FILE__, STR(__LINE__));
+
+            auto&& list = (i < record->num_inputs ? rec.inputs : rec.outputs);
+            list.emplace_back(TraceTensor{
+                .name = _read_name(h.name),
+                .dtype = static_cast<Qnn_DataType_t>(h.dtype),
+                .dims = std::vector<uint32_t>(h.dims, h.dims + h.rank),
+                .scale = h.scale,
+                .offset = h.offset,
+                .data = std::span<const uint8_t>(base + pos + h.data_offset, h.data_size)
+            });
+        }
+
+        pos += record->record_size;
+    }
+
+    debug("Read {} records from trace: {}", records.size(), path);
+}
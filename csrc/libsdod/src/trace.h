@@ -0,0 +1,87 @@
+#ifndef LIBSDOD_TRACE_H
+#define LIBSDOD_TRACE_H
+
+#include "utils.h"
+
+#include <span>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cstdint>
+
+#include <QnnTypes.h>
+
+
+namespace libsdod {
+
+// A single input or output of a recorded graph execution.
+// When reading a trace, ``data`` points directly to the mapped trace file.
+struct TraceTensor {
+    std::string name;
+    Qnn_DataType_t dtype;
+    std::vector<uint32_t> dims;
+    float scale;
+    int32_t offset;
+    std::span<const uint8_t> data;
+
+    Qnn_Tensor_t get_desc() const; // minimal QNN tensor description, sufficient to (de)quantize the data
+    uint32_t get_num_elements() const;
+};
+
+
+struct TraceRecord {
+    std::string graph;
+    uint64_t sequence;
+    double exec_ms;
+    std::vector<TraceTensor> inputs;
+    std::vector<TraceTensor> outputs;
+};
+
+
+// Receives inputs and outputs of graph executions, see ``QnnGraph::add_observer``.
+// Data of the tensors is only valid for the duration of the call.
+class ExecutionObserver {
+public:
+    virtual ~ExecutionObserver() = default;
+    virtual void on_execution(std::string const& graph, std::vector<TraceTensor> const& inputs, std::vector<TraceTensor> const& outputs, double exec_ms) = 0;
+};
+
+
+// Appends graph executions to a trace file. The file is a sequence of records, each holding a fixed-size header,
+// headers of all tensors and raw tensor data (exactly as seen by the backend), data of each tensor is aligned
+// to ``trace_alignment`` bytes relative to the beginning of the file so the trace can be used directly after mapping it.
+class TraceWriter : public ExecutionObserver {
+public:
+    TraceWriter(std::string const& path);
+    ~TraceWriter();
+
+    void write(std::string const& graph, std::vector<TraceTensor> const& inputs, std::vector<TraceTensor> const& outputs, double exec_ms);
+    void on_execution(std::string const& graph, std::vector<TraceTensor> const& inputs, std::vector<TraceTensor> const& outputs, double exec_ms) override {
+        write(graph, inputs, outputs, exec_ms);
+    }
+
+    auto const& get_path() const { return path; }
+
+private:
+    std::string path;
+    std::ofstream out;
+    std::mutex mutex;
+    uint64_t next_sequence = 0;
+};
+
+
+class TraceReader {
+public:
+    TraceReader(std::string const& path);
+
+    auto const& get_records() const { return records; }
+
+private:
+    mmap_t file;
+    std::vector<TraceRecord> records;
+};
+
+}
+
+#endif // LIBSDOD_TRACE_H
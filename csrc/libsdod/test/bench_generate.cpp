@@ -0,0 +1,461 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <cstdio>
+#include <algorithm>
+
+#include "libsdod.h"
+
+
+namespace {
+
+struct Options {
+    std::string models_dir;
+    std::string prompts_file;
+    unsigned int steps = 20;
+    float guidance = 7.5f;
+    unsigned int batch = 1;
+    bool interleave = false;
+    unsigned int iterations = 10;
+    unsigned int warmup = 1;
+    int backend = LIBSDOD_BACKEND_HTP;
+    int decoder = LIBSDOD_DECODER_FULL;
+    int64_t seed = -1; // random if negative
+    std::string guidance_policy = "full";
+    int guidance_mode = LIBSDOD_GUIDANCE_FULL;
+    float guidance_start = 0.0f;
+    float guidance_end = 1.0f;
+    unsigned int uncond_interval = 1;
+    std::vector<unsigned int> skip_steps;
+    int skip_mode = LIBSDOD_SKIP_REUSE;
+    unsigned int feature_cache = 1;
+    float early_stopping = 0.0f;
+    unsigned int early_stopping_patience = 1;
+    float latency_budget = 0.0f;
+    unsigned int latency_budget_min_steps = 1;
+    unsigned int log_level = LIBSDOD_LOG_ERROR;
+    std::string record;
+    std::string calibrate;
+    unsigned int calibration_bitwidth = 8;
+    float calibration_percentile = 100.0f;
+};
+
+
+void usage(const char* argv0) {
+    std::cerr << "Usage: " << argv0 << " <models_dir> <prompts_file> [--steps N] [--guidance G] [--batch B] [--iterations I] [--warmup W] [--backend htp|gpu|cpu] [--decoder full|fast] [--seed S] [--log_level L] [--record TRACE]" << std::endl
+        << "       [--guidance_policy full|truncated:END|interval:START:END|reuse:K] [--skip_steps S1,S2,...] [--skip_mode reuse|extrapolate]" << std::endl
+        << "       [--feature_cache N] [--early_stopping T[:K]] [--latency_budget MS[:MIN_STEPS]] [--interleave 0|1] [--calibrate DIR] [--calibration_bitwidth 8|16] [--calibration_percentile P]" << std::endl
+        << "    prompts_file should hold one prompt per line, prompts are used in a round-robin fashion" << std::endl
+        << "    each iteration generates B images, results are printed to stdout as JSON" << std::endl
+        << "    --interleave 1 generates all B images of an iteration with a single call, denoising them in pairs" << std::endl
+        << "    --decoder fast decodes images with the tiny autoencoder (taesd_decoder), if present in models_dir" << std::endl
+        << "    --guidance_policy skips unconditional UNet passes: truncated guides steps before END (a fraction of the steps), interval between" << std::endl
+        << "        START and END, reuse computes the unconditional prediction every K steps" << std::endl
+        << "    --skip_steps makes the given steps (0 - first) without executing the UNet, reusing or extrapolating earlier predictions (--skip_mode)" << std::endl
+        << "    --feature_cache executes the middle partition of a partitioned UNet only every N steps, reusing its outputs in between" << std::endl
+        << "    --early_stopping stops denoising an image once its data prediction changes by less than T (relative L2) on K consecutive steps" << std::endl
+        << "    --latency_budget makes as many steps (between MIN_STEPS and --steps) as are predicted to fit into MS per call, based on earlier calls" << std::endl
+        << "    --record writes inputs and outputs of all model executions after warmup to TRACE (affects measurements)" << std::endl
+        << "    --calibrate gathers ranges of all model inputs and outputs after warmup and saves quantization encodings to DIR (affects measurements)," << std::endl
+        << "        use with models with floating-point activations and a representative prompts_file, e.g. --iterations <number of prompts> --warmup 0" << std::endl;
+}
+
+
+bool parse_args(int argc, char** argv, Options& opts) {
+    std::vector<std::string> positional;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg.rfind("--", 0) != 0) {
+            positional.push_back(arg);
+            continue;
+        }
+        if (i + 1 >= argc) {
+            std::cerr << "Missing value for argument: " << arg << std::endl;
+            return false;
+        }
+
+        std::string value = argv[++i];
+        if (arg == "--steps")
+            opts.steps = std::stoul(value);
+        else if (arg == "--seed")
+            opts.seed = std::stoul(value);
+        else if (arg == "--guidance")
+            opts.guidance = std::stof(value);
+        else if (arg == "--batch")
+            opts.batch = std::stoul(value);
+        else if (arg == "--interleave")
+            opts.interleave = (std::stoul(value) != 0);
+        else if (arg == "--iterations")
+            opts.iterations = std::stoul(value);
+        else if (arg == "--warmup")
+            opts.warmup = std::stoul(value);
+        else if (arg == "--log_level")
+            opts.log_level = std::stoul(value);
+        else if (arg == "--record")
+            opts.record = value;
+        else if (arg == "--calibrate")
+            opts.calibrate = value;
+        else if (arg == "--calibration_bitwidth")
+            opts.calibration_bitwidth = std::stoul(value);
+        else if (arg == "--calibration_percentile")
+            opts.calibration_percentile = std::stof(value);
+        else if (arg == "--backend") {
+            if (value == "htp")
+                opts.backend = LIBSDOD_BACKEND_HTP;
+            else if (value == "gpu")
+                opts.backend = LIBSDOD_BACKEND_GPU;
+            else if (value == "cpu")
+                opts.backend = LIBSDOD_BACKEND_CPU;
+            else {
+                std::cerr << "Unknown backend: " << value << std::endl;
+                return false;
+            }
+        } else if (arg == "--decoder") {
+            if (value == "full")
+                opts.decoder = LIBSDOD_DECODER_FULL;
+            else if (value == "fast")
+                opts.decoder = LIBSDOD_DECODER_FAST;
+            else {
+                std::cerr << "Unknown decoder: " << value << std::endl;
+                return false;
+            }
+        } else if (arg == "--skip_steps") {
+            std::istringstream in{ value };
+            std::string step;
+            while (std::getline(in, step, ','))
+                opts.skip_steps.push_back(std::stoul(step));
+        } else if (arg == "--feature_cache") {
+            opts.feature_cache = std::stoul(value);
+        } else if (arg == "--early_stopping") {
+            auto colon = value.find(':');
+            opts.early_stopping = std::stof(value.substr(0, colon));
+            if (colon != std::string::npos)
+                opts.early_stopping_patience = std::stoul(value.substr(colon + 1));
+        } else if (arg == "--latency_budget") {
+            auto colon = value.find(':');
+            opts.latency_budget = std::stof(value.substr(0, colon));
+            if (colon != std::string::npos)
+                opts.latency_budget_min_steps = std::stoul(value.substr(colon + 1));
+        } else if (arg == "--skip_mode") {
+            if (value == "reuse")
+                opts.skip_mode = LIBSDOD_SKIP_REUSE;
+            else if (value == "extrapolate")
+                opts.skip_mode = LIBSDOD_SKIP_EXTRAPOLATE;
+            else {
+                std::cerr << "Unknown skip mode: " << value << std::endl;
+                return false;
+            }
+        } else if (arg == "--guidance_policy") {
+            opts.guidance_policy = value;
+            auto&& params = value.substr(std::min(value.find(':'), value.size()));
+            if (value == "full")
+                opts.guidance_mode = LIBSDOD_GUIDANCE_FULL;
+            else if (value.rfind("truncated:", 0) == 0 && std::sscanf(params.c_str(), ":%f", &opts.guidance_end) == 1)
+                opts.guidance_mode = LIBSDOD_GUIDANCE_TRUNCATED;
+            else if (value.rfind("interval:", 0) == 0 && std::sscanf(params.c_str(), ":%f:%f", &opts.guidance_start, &opts.guidance_end) == 2)
+                opts.guidance_mode = LIBSDOD_GUIDANCE_INTERVAL;
+            else if (value.rfind("reuse:", 0) == 0 && std::sscanf(params.c_str(), ":%u", &opts.uncond_interval) == 1)
+                opts.guidance_mode = LIBSDOD_GUIDANCE_REUSE_UNCOND;
+            else {
+                std::cerr << "Unknown guidance policy: " << value << std::endl;
+                return false;
+            }
+        } else {
+            std::cerr << "Unknown argument: " << arg << std::endl;
+            return false;
+        }
+    }
+
+    if (positional.size() != 2)
+        return false;
+
+    opts.models_dir = positional[0];
+    opts.prompts_file = positional[1];
+    return opts.batch > 0 && opts.iterations > 0;
+}
+
+
+double percentile(std::vector<double> const& sorted, double p) {
+    if (sorted.empty())
+        return 0.0;
+    double pos = p * (sorted.size() - 1);
+    auto lower = static_cast<std::size_t>(std::floor(pos));
+    auto upper = static_cast<std::size_t>(std::ceil(pos));
+    return sorted[lower] + (sorted[upper] - sorted[lower]) * (pos - lower);
+}
+
+
+std::string json_str(std::string const& s) {
+    std::string ret = "\"";
+    for (auto c : s) {
+        if (c == '"' || c == '\\')
+            ret.push_back('\\');
+        ret.push_back(c);
+    }
+    ret.push_back('"');
+    return ret;
+}
+
+
+// strips "setup."/"generate." prefix and "_ms" suffix
+std::string stage_name(std::string const& name) {
+    auto ret = name.substr(name.find('.') + 1);
+    if (ret.size() > 3 && ret.compare(ret.size() - 3, 3, "_ms") == 0)
+        ret.resize(ret.size() - 3);
+    return ret;
+}
+
+
+void print_distribution(std::ostream& out, std::vector<double> values) {
+    std::sort(values.begin(), values.end());
+    double sum = 0.0;
+    for (auto v : values)
+        sum += v;
+    out << "{ \"count\": " << values.size()
+        << ", \"mean\": " << (values.empty() ? 0.0 : sum / values.size())
+        << ", \"min\": " << (values.empty() ? 0.0 : values.front())
+        << ", \"p50\": " << percentile(values, 0.5)
+        << ", \"p90\": " << percentile(values, 0.9)
+        << ", \"p99\": " << percentile(values, 0.99)
+        << ", \"max\": " << (values.empty() ? 0.0 : values.back())
+        << " }";
+}
+
+
+int report_error(const char* what, int status, void* ctx) {
+    auto extra = libsdod_get_last_error_extra_info(status, ctx);
+    std::cerr << what << ": " << libsdod_get_error_description(status) << "; " << (extra ? extra : "") << std::endl;
+    if (ctx)
+        libsdod_release(ctx);
+    return 1;
+}
+
+}
+
+
+int main(int argc, char** argv) {
+    Options opts;
+    try {
+        if (!parse_args(argc, argv, opts)) {
+            usage(argv[0]);
+            return 1;
+        }
+    } catch (std::exception const& e) {
+        std::cerr << "Invalid argument value: " << e.what() << std::endl;
+        usage(argv[0]);
+        return 1;
+    }
+
+    std::vector<std::string> prompts;
+    {
+        std::ifstream in{ opts.prompts_file };
+        std::string line;
+        while (std::getline(in, line))
+            if (!line.empty())
+                prompts.push_back(line);
+    }
+    if (prompts.empty()) {
+        std::cerr << "No prompts found in: " << opts.prompts_file << std::endl;
+        return 1;
+    }
+
+    void* ctx = nullptr;
+    auto&& setup_start = std::chrono::high_resolution_clock::now();
+    int status = libsdod_setup(&ctx, opts.models_dir.c_str(), 4, 64, 8, opts.steps, opts.log_level, opts.backend);
+    auto&& setup_end = std::chrono::high_resolution_clock::now();
+    if (status)
+        return report_error("Initialization error", status, ctx);
+    status = libsdod_set_decoder(ctx, opts.decoder);
+    if (status)
+        return report_error("Could not select the decoder", status, ctx);
+    status = libsdod_set_guidance_policy(ctx, opts.guidance_mode, opts.guidance_start, opts.guidance_end, opts.uncond_interval);
+    if (status)
+        return report_error("Could not set the guidance policy", status, ctx);
+    status = libsdod_set_step_skipping(ctx, opts.skip_mode, opts.skip_steps.data(), opts.skip_steps.size());
+    if (status)
+        return report_error("Could not set the steps to skip", status, ctx);
+    status = libsdod_set_feature_cache(ctx, opts.feature_cache);
+    if (status)
+        return report_error("Could not set the feature cache interval", status, ctx);
+    status = libsdod_set_early_stopping(ctx, opts.early_stopping, opts.early_stopping_patience);
+    if (status)
+        return report_error("Could not set early stopping", status, ctx);
+    status = libsdod_set_latency_budget(ctx, opts.latency_budget, opts.latency_budget_min_steps, opts.steps);
+    if (status)
+        return report_error("Could not set the latency budget", status, ctx);
+    if (opts.seed >= 0) {
+        status = libsdod_set_seed(ctx, static_cast<unsigned int>(opts.seed));
+        if (status)
+            return report_error("Could not set the seed", status, ctx);
+    }
+
+    const char* const* names = nullptr;
+    const double* values = nullptr;
+    unsigned int count = 0;
+
+    std::map<std::string, double> setup_phases;
+    status = libsdod_get_stats(ctx, &names, &values, &count);
+    if (status)
+        return report_error("Could not query setup statistics", status, ctx);
+    for (unsigned int i = 0; i < count; ++i)
+        if (std::strncmp(names[i], "setup.", 6) == 0)
+            setup_phases[stage_name(names[i])] += values[i];
+
+    unsigned char* img = nullptr;
+    unsigned int img_len = 0;
+    unsigned int buffer_len = 0;
+    std::size_t next_prompt = 0;
+
+    std::map<std::string, std::vector<double>> stages;
+    std::map<std::string, double> counters;
+    std::map<std::string, std::vector<double>> pipeline; // per-call gauges, e.g. stage occupancy or queue depth
+    double measured_ms = 0.0;
+    unsigned int measured_images = 0;
+
+    for (unsigned int iter = 0; iter < opts.warmup + opts.iterations; ++iter) {
+        bool measured = (iter >= opts.warmup);
+        if (iter == opts.warmup && !opts.record.empty()) {
+            status = libsdod_start_recording(ctx, opts.record.c_str());
+            if (status)
+                return report_error("Could not start recording", status, ctx);
+        }
+        if (iter == opts.warmup && !opts.calibrate.empty()) {
+            status = libsdod_start_calibration(ctx);
+            if (status)
+                return report_error("Could not start calibration", status, ctx);
+        }
+        auto&& iter_start = std::chrono::high_resolution_clock::now();
+        unsigned int per_call = (opts.interleave ? opts.batch : 1);
+        for (unsigned int b = 0; b < opts.batch; b += per_call) {
+            std::vector<const char*> call_prompts;
+            for (unsigned int i = 0; i < per_call; ++i) {
+                call_prompts.push_back(prompts[next_prompt].c_str());
+                next_prompt = (next_prompt + 1) % prompts.size();
+            }
+
+            img_len = buffer_len;
+            if (opts.interleave)
+                status = libsdod_generate_images(ctx, call_prompts.data(), per_call, opts.guidance, &img, &img_len);
+            else
+                status = libsdod_generate_image(ctx, call_prompts.front(), opts.guidance, &img, &img_len);
+            if (status)
+                return report_error("Generation error", status, ctx);
+            buffer_len = std::max(buffer_len, img_len);
+
+            if (!measured)
+                continue;
+
+            status = libsdod_get_stats(ctx, &names, &values, &count);
+            if (status)
+                return report_error("Could not query generation statistics", status, ctx);
+            for (unsigned int i = 0; i < count; ++i) {
+                if (std::strncmp(names[i], "generate.", 9) != 0)
+                    continue;
+                auto&& len = std::strlen(names[i]);
+                if (std::strncmp(names[i], "generate.pipeline.", 18) == 0)
+                    pipeline[names[i] + 18].push_back(values[i]);
+                else if (len > 3 && std::strcmp(names[i] + len - 3, "_ms") == 0)
+                    stages[stage_name(names[i])].push_back(values[i]);
+                else
+                    counters[stage_name(names[i])] += values[i];
+            }
+        }
+        auto&& iter_end = std::chrono::high_resolution_clock::now();
+        if (measured) {
+            auto&& diff = std::chrono::duration<double, std::milli>(iter_end - iter_start).count();
+            stages["iteration"].push_back(diff);
+            measured_ms += diff;
+            measured_images += opts.batch;
+        }
+    }
+
+    if (!opts.record.empty()) {
+        status = libsdod_stop_recording(ctx);
+        if (status)
+            return report_error("Could not stop recording", status, ctx);
+    }
+
+    if (!opts.calibrate.empty()) {
+        status = libsdod_save_calibration(ctx, opts.calibrate.c_str(), opts.calibration_bitwidth, opts.calibration_percentile);
+        if (status)
+            return report_error("Could not save calibration results", status, ctx);
+        status = libsdod_stop_calibration(ctx);
+        if (status)
+            return report_error("Could not stop calibration", status, ctx);
+    }
+
+    std::ostringstream out;
+    out << "{" << std::endl;
+    out << "  \"library_version\": " << json_str(libsdod_get_version()) << "," << std::endl;
+    out << "  \"config\": { \"models_dir\": " << json_str(opts.models_dir)
+        << ", \"prompts\": " << prompts.size()
+        << ", \"steps\": " << opts.steps
+        << ", \"guidance\": " << opts.guidance
+        << ", \"guidance_policy\": " << json_str(opts.guidance_policy)
+        << ", \"skipped_steps\": " << opts.skip_steps.size()
+        << ", \"feature_cache\": " << opts.feature_cache
+        << ", \"early_stopping\": " << opts.early_stopping
+        << ", \"early_stopping_patience\": " << opts.early_stopping_patience
+        << ", \"latency_budget\": " << opts.latency_budget
+        << ", \"latency_budget_min_steps\": " << opts.latency_budget_min_steps
+        << ", \"seed\": " << opts.seed
+        << ", \"batch\": " << opts.batch
+        << ", \"interleave\": " << (opts.interleave ? "true" : "false")
+        << ", \"iterations\": " << opts.iterations
+        << ", \"warmup\": " << opts.warmup
+        << ", \"backend\": " << opts.backend
+        << ", \"decoder\": " << json_str(opts.decoder == LIBSDOD_DECODER_FAST ? "fast" : "full") << " }," << std::endl;
+
+    out << "  \"setup_ms\": { \"wall\": " << std::chrono::duration<double, std::milli>(setup_end - setup_start).count();
+    for (auto&& phase : setup_phases)
+        out << ", " << json_str(phase.first) << ": " << phase.second;
+    out << " }," << std::endl;
+
+    out << "  \"stages_ms\": {";
+    bool first = true;
+    for (auto&& stage : stages) {
+        out << (first ? "" : ",") << std::endl << "    " << json_str(stage.first) << ": ";
+        print_distribution(out, stage.second);
+        first = false;
+    }
+    out << std::endl << "  }," << std::endl;
+
+    out << "  \"counters_per_image\": {";
+    first = true;
+    for (auto&& counter : counters) {
+        out << (first ? " " : ", ") << json_str(counter.first) << ": " << counter.second / std::max(measured_images, 1u);
+        first = false;
+    }
+    out << " }," << std::endl;
+
+    out << "  \"pipeline\": {";
+    first = true;
+    for (auto&& gauge : pipeline) {
+        double sum = 0.0;
+        for (auto v : gauge.second)
+            sum += v;
+        out << (first ? " " : ", ") << json_str(gauge.first) << ": " << sum / gauge.second.size();
+        first = false;
+    }
+    out << " }," << std::endl;
+
+    double seconds = measured_ms / 1000.0;
+    out << "  \"throughput\": { \"images_per_s\": " << (seconds > 0 ? measured_images / seconds : 0.0)
+        << ", \"steps_per_s\": " << (seconds > 0 ? counters["steps"] / seconds : 0.0)
+        << " }" << std::endl;
+    out << "}" << std::endl;
+
+    std::cout << out.str();
+
+    free(img);
+    libsdod_release(ctx);
+    return 0;
+}
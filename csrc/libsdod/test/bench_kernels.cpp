@@ -0,0 +1,430 @@
+#include "tokenizer.h"
+#include "dpm_solver.h"
+#include "qnn_context.h"
+#include "conversions.h"
+#include "noise.h"
+#include "utils.h"
+
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <functional>
+#include <algorithm>
+
+
+namespace {
+
+using clock_type = std::chrono::high_resolution_clock;
+
+constexpr unsigned int repetitions = 5;
+constexpr double min_repetition_ms = 20.0;
+
+// keeps the compiler from optimizing away results of benchmarked kernels
+volatile unsigned char sink;
+
+
+// runs ``fn`` in a loop and prints median/min time per call and throughput
+// computed from ``bytes`` (the amount of data read and written by a single call);
+// ``reset`` is called before each repetition and is not included in the measurements
+void run(std::string const& name, std::size_t bytes, std::function<void()> const& fn, std::function<void()> const& reset = nullptr) {
+    auto&& measure = [&](unsigned int calls) {
+        if (reset)
+            reset();
+        auto&& tick = clock_type::now();
+        for (unsigned int i = 0; i < calls; ++i)
+            fn();
+        auto&& tock = clock_type::now();
+        return std::chrono::duration<double, std::milli>(tock - tick).count();
+    };
+
+    unsigned int calls = 1;
+    while (true) {
+        auto&& ms = measure(calls);
+        if (ms >= min_repetition_ms || calls >= (1u << 24))
+            break;
+        calls = (ms > 0.0 ? std::max<unsigned int>(calls * 2, calls * min_repetition_ms / ms) : calls * 16);
+    }
+
+    std::vector<double> per_call;
+    for (unsigned int r = 0; r < repetitions; ++r)
+        per_call.push_back(measure(calls) * 1000.0 / calls);
+    std::sort(per_call.begin(), per_call.end());
+
+    auto median_us = per_call[per_call.size() / 2];
+    auto gbps = (median_us > 0.0 ? bytes / (median_us * 1000.0) : 0.0);
+    std::cout << std::left << std::setw(56) << name
+        << std::right << std::fixed << std::setprecision(3)
+        << std::setw(14) << median_us
+        << std::setw(14) << per_call.front()
+        << std::setw(12) << gbps
+        << std::endl;
+}
+
+
+void print_header(std::string const& group) {
+    std::cout << std::endl << std::left << std::setw(56) << group
+        << std::right << std::setw(14) << "median [us]"
+        << std::setw(14) << "min [us]"
+        << std::setw(12) << "GB/s"
+        << std::endl;
+}
+
+
+const std::vector<std::string> default_prompts = {
+    "A photograph of an astronaut riding a horse",
+    "a cat",
+    "An oil painting of a lighthouse on a cliff during a storm, dramatic lighting, highly detailed, trending on artstation",
+    "portrait of a young woman, studio lighting, 85mm, bokeh",
+    "  Multiple   spaces,   punctuation!!! and UPPERCASE words...  ",
+    "a futuristic city skyline at night with flying cars and neon signs, cyberpunk, 4k, octane render, volumetric fog"
+};
+
+
+void bench_tokenizer(std::string const& bpe_file, std::vector<std::string> const& prompts) {
+    print_header("Tokenizer::tokenize");
+    std::ifstream probe{ bpe_file };
+    if (!probe) {
+        std::cout << "    skipped, could not open tokenizer file: " << bpe_file << std::endl;
+        return;
+    }
+
+    libsdod::Tokenizer tokenizer{ bpe_file };
+    std::vector<libsdod::Tokenizer::token_type> out;
+    std::size_t corpus_bytes = 0;
+    for (auto&& p : prompts)
+        corpus_bytes += p.size();
+
+    run(libsdod::format("corpus ({} prompts, per prompt)", prompts.size()), corpus_bytes / prompts.size(), [&]() {
+        for (auto&& p : prompts)
+            tokenizer.tokenize(out, p);
+        sink = out.back();
+    });
+
+    for (auto&& p : prompts) {
+        auto name = p.size() > 40 ? p.substr(0, 37) + "..." : p;
+        run(libsdod::format("\"{}\"", name), p.size(), [&]() {
+            tokenizer.tokenize(out, p);
+            sink = out.back();
+        });
+    }
+}
+
+
+void bench_dpm() {
+    print_header("DPMSolver::update");
+    libsdod::DPMSolver solver(1000, 0.00085, 0.0120);
+    std::vector<float> ts;
+    solver.prepare(20, ts);
+
+    std::mt19937 gen{ 0 };
+    std::normal_distribution<float> normal{ 0, 1 };
+
+    for (unsigned int spatial : { 64u, 96u, 128u }) {
+        std::size_t elements = 4 * spatial * spatial;
+        std::vector<float> x0(elements), y0(elements);
+        for (auto& f : x0)
+            f = normal(gen);
+        for (auto& f : y0)
+            f = normal(gen);
+
+        std::vector<float> x, y;
+        auto&& reset = [&]() {
+            x = x0;
+            y = y0;
+        };
+
+        // x and y are read and written, order 2 also reads the previous data prediction
+        run(libsdod::format("order 1, 4x{}x{}", spatial, spatial), 4 * elements * sizeof(float), [&]() {
+            solver.update(0, x, y);
+            sink = x[0] > 0;
+        }, reset);
+
+        // make sure the history used by the multistep update is populated
+        reset();
+        solver.update(0, x, y);
+        run(libsdod::format("order 2, 4x{}x{}", spatial, spatial), 5 * elements * sizeof(float), [&]() {
+            solver.update(10, x, y);
+            sink = x[0] > 0;
+        }, reset);
+    }
+}
+
+
+// initial noise of a single image: sequential std::normal_distribution (as done originally) vs. counter-based normal_noise
+void bench_noise() {
+    print_header("initial noise");
+    for (unsigned int spatial : { 64u, 96u, 128u }) {
+        std::size_t elements = 4 * spatial * spatial;
+        std::vector<float> out(elements);
+
+        std::mt19937 gen{ 0 };
+        std::normal_distribution<float> normal{ 0, 1 };
+        run(libsdod::format("std::normal_distribution, 4x{}x{}", spatial, spatial), elements * sizeof(float), [&]() {
+            for (auto& f : out)
+                f = normal(gen);
+            sink = out[0] > 0;
+        });
+        run(libsdod::format("normal_noise, 4x{}x{}", spatial, spatial), elements * sizeof(float), [&]() {
+            libsdod::normal_noise(out.data(), out.size(), 42, 0);
+            sink = out[0] > 0;
+        });
+    }
+}
+
+
+struct DType {
+    Qnn_DataType_t dtype;
+    const char* name;
+    float scale;
+    int32_t offset;
+};
+
+
+const std::vector<DType> dtypes = {
+    { QNN_DATATYPE_UFIXED_POINT_8, "uq8", 8.0f / 255, -128 },
+    { QNN_DATATYPE_UFIXED_POINT_16, "uq16", 8.0f / 65535, -32768 },
+    { QNN_DATATYPE_FLOAT_16, "float16", 0.0f, 0 },
+    { QNN_DATATYPE_FLOAT_32, "float32", 0.0f, 0 },
+    { QNN_DATATYPE_UINT_8, "uint8", 0.0f, 0 },
+    { QNN_DATATYPE_UINT_16, "uint16", 0.0f, 0 },
+    { QNN_DATATYPE_UINT_32, "uint32", 0.0f, 0 },
+    { QNN_DATATYPE_UINT_64, "uint64", 0.0f, 0 },
+    { QNN_DATATYPE_INT_8, "int8", 0.0f, 0 },
+    { QNN_DATATYPE_INT_16, "int16", 0.0f, 0 },
+    { QNN_DATATYPE_INT_32, "int32", 0.0f, 0 },
+    { QNN_DATATYPE_INT_64, "int64", 0.0f, 0 }
+};
+
+
+// sizes of tensors moved between host and device when running SD1.5: temb output, latent, prompt embedding and image
+const std::vector<std::pair<const char*, unsigned int>> sizes = {
+    { "1280", 1280 },
+    { "4x64x64", 4 * 64 * 64 },
+    { "77x768", 77 * 768 },
+    { "512x512x3", 512 * 512 * 3 }
+};
+
+
+void bench_conversions() {
+    std::mt19937 gen{ 0 };
+    std::uniform_real_distribution<float> uniform{ -1, 1 };
+
+    for (auto&& size : sizes) {
+        print_header(libsdod::format("qnn2host/host2qnn, float host buffer, {}", size.first));
+        std::vector<float> host(size.second);
+        for (auto& f : host)
+            f = uniform(gen);
+
+        for (auto&& dt : dtypes) {
+            Qnn_Tensor_t desc{};
+            desc.version = QNN_TENSOR_VERSION_1;
+            desc.v1.dataType = dt.dtype;
+            desc.v1.quantizeParams.encodingDefinition = QNN_DEFINITION_DEFINED;
+            desc.v1.quantizeParams.quantizationEncoding = QNN_QUANTIZATION_ENCODING_SCALE_OFFSET;
+            desc.v1.quantizeParams.scaleOffsetEncoding.scale = dt.scale;
+            desc.v1.quantizeParams.scaleOffsetEncoding.offset = dt.offset;
+
+            auto elem_size = libsdod::QnnTensor::get_element_size(desc);
+            std::vector<unsigned char> device(size.second * elem_size);
+            // fill the device buffer with valid values of the target type
+            libsdod::host2qnn<false, false>(device.data(), host.data(), size.second, desc, 0.0f);
+
+            std::size_t bytes = size.second * (elem_size + sizeof(float));
+            run(libsdod::format("host2qnn {}", dt.name), bytes, [&]() {
+                libsdod::host2qnn<false, false>(device.data(), host.data(), size.second, desc, 0.0f);
+                sink = device[0];
+            });
+            run(libsdod::format("qnn2host {}", dt.name), bytes, [&]() {
+                libsdod::qnn2host<false, false>(device.data(), host.data(), size.second, desc, 0.0f);
+                sink = host[0] > 0;
+            });
+            // the variant used to combine conditional and unconditional outputs
+            run(libsdod::format("qnn2host {} (scale, accumulate)", dt.name), bytes + size.second * sizeof(float), [&]() {
+                libsdod::qnn2host<true, true>(device.data(), host.data(), size.second, desc, 0.5f);
+                sink = host[0] > 0;
+            });
+            if (libsdod::QnnTensor::is_floating_point(desc)) {
+                // batched guidance, both halves of a batch-2 output combined in a single pass
+                std::vector<unsigned char> device2(device);
+                run(libsdod::format("guided2host {}", dt.name), 2 * size.second * elem_size + size.second * sizeof(float), [&]() {
+                    libsdod::guided2host(device.data(), device2.data(), host.data(), size.second, desc, 7.5f);
+                    sink = host[0] > 0;
+                });
+            }
+        }
+    }
+}
+
+
+// a single denoising step done on the host: guidance, solver update and conversion of the new latent to the UNet input,
+// separate passes (as done originally) vs. guided_solver_update
+void bench_step() {
+    libsdod::DPMSolver solver(1000, 0.00085, 0.0120);
+    std::vector<float> ts;
+    solver.prepare(20, ts);
+
+    std::mt19937 gen{ 0 };
+    std::normal_distribution<float> normal{ 0, 1 };
+    std::size_t elements = 4 * 64 * 64;
+    std::vector<float> x0(elements), e0(elements);
+    for (auto& f : x0)
+        f = normal(gen);
+    for (auto& f : e0)
+        f = normal(gen);
+
+    print_header("denoising step (guidance, DPMSolver order 2, latent conversion), 4x64x64");
+    for (auto&& dt : dtypes) {
+        Qnn_Tensor_t desc{};
+        desc.version = QNN_TENSOR_VERSION_1;
+        desc.v1.dataType = dt.dtype;
+        desc.v1.quantizeParams.encodingDefinition = QNN_DEFINITION_DEFINED;
+        desc.v1.quantizeParams.quantizationEncoding = QNN_QUANTIZATION_ENCODING_SCALE_OFFSET;
+        desc.v1.quantizeParams.scaleOffsetEncoding.scale = dt.scale;
+        desc.v1.quantizeParams.scaleOffsetEncoding.offset = dt.offset;
+        if (!libsdod::QnnTensor::is_floating_point(desc))
+            continue;
+
+        auto elem_size = libsdod::QnnTensor::get_element_size(desc);
+        std::vector<unsigned char> cond(elements * elem_size), uncond(elements * elem_size), x_dev(elements * elem_size);
+        libsdod::host2qnn<false, false>(cond.data(), e0.data(), elements, desc, 0.0f);
+        libsdod::host2qnn<false, false>(uncond.data(), x0.data(), elements, desc, 0.0f);
+
+        // both variants start each call from the same latent (and the same history of the multistep update), otherwise
+        // the latent drifts over repeated calls and the results depend on how many calls are made (e.g. once it becomes denormal)
+        std::vector<float> x = x0, e(elements), history;
+        solver.update(0, x, e);
+        libsdod::guided_solver_update(solver, 0, x, history, cond.data(), uncond.data(), desc, 7.5f, x_dev.data(), desc, 1);
+
+        // 2 reads of each output, x read/written twice, e read/written 4 times, history read
+        run(libsdod::format("separate passes {}", dt.name), 3 * elements * elem_size + 9 * elements * sizeof(float), [&]() {
+            std::copy(x0.begin(), x0.end(), x.begin());
+            libsdod::qnn2host<false, true>(cond.data(), e.data(), elements, desc, 7.5f);
+            libsdod::qnn2host<true, true>(uncond.data(), e.data(), elements, desc, 1 - 7.5f);
+            solver.update(10, x, e);
+            libsdod::host2qnn<false, false>(x_dev.data(), x.data(), elements, desc, 0.0f);
+            sink = x_dev[0];
+        });
+        // both outputs, x and history read and written once
+        run(libsdod::format("guided_solver_update {}", dt.name), 3 * elements * elem_size + 4 * elements * sizeof(float), [&]() {
+            std::copy(x0.begin(), x0.end(), x.begin());
+            libsdod::guided_solver_update(solver, 10, x, history, cond.data(), uncond.data(), desc, 7.5f, x_dev.data(), desc, 1);
+            sink = x_dev[0];
+        });
+        // the conditional output converted ahead of time (while the unconditional pass would be running), then the remaining update
+        std::vector<float> scaled_cond(elements);
+        run(libsdod::format("prescale_cond {}", dt.name), elements * elem_size + elements * sizeof(float), [&]() {
+            libsdod::prescale_cond(cond.data(), desc, 7.5f, scaled_cond);
+            sink = scaled_cond[0];
+        });
+        run(libsdod::format("guided_solver_update, prescaled {}", dt.name), elements * elem_size + 5 * elements * sizeof(float), [&]() {
+            std::copy(x0.begin(), x0.end(), x.begin());
+            libsdod::guided_solver_update(solver, 10, x, history, scaled_cond, uncond.data(), desc, 7.5f, x_dev.data(), desc, 1);
+            sink = x_dev[0];
+        });
+    }
+}
+
+
+void bench_image() {
+    print_header("float2uint8");
+    std::mt19937 gen{ 0 };
+    std::uniform_real_distribution<float> uniform{ -0.1, 1.1 };
+
+    std::vector<float> img(512 * 512 * 3);
+    for (auto& f : img)
+        f = uniform(gen);
+    std::vector<uint8_t> out(img.size());
+
+    run("512x512x3", img.size() * (sizeof(float) + sizeof(uint8_t)), [&]() {
+        libsdod::float2uint8(out.data(), img.data(), img.size());
+        sink = out[0];
+    });
+
+    // decoder output in its native format: converted to floats first (as done originally) vs. qnn2uint8
+    print_header("decoder output to pixels, 512x512x3");
+    for (auto&& dt : dtypes) {
+        Qnn_Tensor_t desc{};
+        desc.version = QNN_TENSOR_VERSION_1;
+        desc.v1.dataType = dt.dtype;
+        desc.v1.quantizeParams.encodingDefinition = QNN_DEFINITION_DEFINED;
+        desc.v1.quantizeParams.quantizationEncoding = QNN_QUANTIZATION_ENCODING_SCALE_OFFSET;
+        desc.v1.quantizeParams.scaleOffsetEncoding.scale = 1.2f / 255;
+        desc.v1.quantizeParams.scaleOffsetEncoding.offset = -21;
+        if (!libsdod::QnnTensor::is_floating_point(desc))
+            continue;
+
+        auto elem_size = libsdod::QnnTensor::get_element_size(desc);
+        std::vector<unsigned char> device(img.size() * elem_size);
+        libsdod::host2qnn<false, false>(device.data(), img.data(), img.size(), desc, 0.0f);
+        std::vector<float> tmp(img.size());
+        auto&& lut = libsdod::pixel_lut(desc);
+
+        run(libsdod::format("qnn2host + float2uint8 {}", dt.name), img.size() * (elem_size + 2 * sizeof(float) + sizeof(uint8_t)), [&]() {
+            libsdod::qnn2host<false, false>(device.data(), tmp.data(), img.size(), desc, 0.0f);
+            libsdod::float2uint8(out.data(), tmp.data(), tmp.size());
+            sink = out[0];
+        });
+        run(libsdod::format("qnn2uint8 {} (NHWC)", dt.name), img.size() * (elem_size + sizeof(uint8_t)), [&]() {
+            libsdod::qnn2uint8(out.data(), device.data(), desc, lut, img.size() / 3, 3, false);
+            sink = out[0];
+        });
+        run(libsdod::format("qnn2uint8 {} (NCHW)", dt.name), img.size() * (elem_size + sizeof(uint8_t)), [&]() {
+            libsdod::qnn2uint8(out.data(), device.data(), desc, lut, img.size() / 3, 3, true);
+            sink = out[0];
+        });
+    }
+}
+
+
+void bench_format() {
+    print_header("libsdod::format");
+    std::vector<float> values(15, 0.1234f);
+
+    run("\"{} took {}ms\" (str, int)", 0, [&]() {
+        auto&& s = libsdod::format("{} took {}ms", "Single iteration", 123);
+        sink = s.back();
+    });
+    run("\"Memory location {} ... slot: {}\" (ptr, str)", 0, [&]() {
+        auto&& s = libsdod::format("Memory location {} is now the source of data for slot: {}", &values, std::string("unet.serialized:x"));
+        sink = s.back();
+    });
+    run("\"{}: (size: {}) {}\" (str, int, vector<float>[15])", 0, [&]() {
+        auto&& s = libsdod::format("{}: (size: {}) {}", "Unet output", values.size(), values);
+        sink = s.back();
+    });
+}
+
+}
+
+
+int main(int argc, char** argv) {
+    if (argc > 3) {
+        std::cerr << "Usage: " << argv[0] << " [tokenizer_file] [prompts_file]" << std::endl;
+        return 1;
+    }
+
+    std::string bpe_file = (argc > 1 ? argv[1] : "../../../../dlc/ctokenizer.txt");
+    std::vector<std::string> prompts;
+    if (argc > 2) {
+        std::ifstream in{ argv[2] };
+        std::string line;
+        while (std::getline(in, line))
+            if (!line.empty())
+                prompts.push_back(line);
+    }
+    if (prompts.empty())
+        prompts = default_prompts;
+
+    bench_tokenizer(bpe_file, prompts);
+    bench_dpm();
+    bench_noise();
+    bench_conversions();
+    bench_step();
+    bench_image();
+    bench_format();
+    return 0;
+}
@@ -0,0 +1,106 @@
+#!/usr/bin/env python3
+# Creates a models directory which can be used with libsdod and the stub QNN backend (see qnn_stub_backend.cpp),
+# allowing to run the full pipeline (e.g. bench_generate) on a Linux host without Qualcomm hardware.
+import os
+import shutil
+import argparse
+
+
+graphs = {
+    'unet.serialized': 'unet',
+    'text_encoder.serialized': 'text_encoder',
+    'vae_decoder.serialized': 'vae_decoder',
+    'temb': 'temb',
+}
+
+optional_graphs = {
+    'taesd_decoder.serialized': 'taesd_decoder',
+    'vae_encoder.serialized': 'vae_encoder',
+}
+
+# simulated time of a single execution of each graph, can be overwritten at runtime with SDOD_STUB_LATENCY_<GRAPH>
+default_latency_ms = {
+    'unet': 120.0,
+    'unet_inputs': 25.0,
+    'unet_middle': 70.0,
+    'unet_outputs': 25.0,
+    'text_encoder': 10.0,
+    'vae_decoder': 350.0,
+    'taesd_decoder': 40.0,
+    'vae_encoder': 200.0,
+    'temb': 0.1,
+}
+
+# simulated time of a single execution of the unet with batch 2 (--cfg_batch), running both passes together
+# is assumed to be cheaper than two separate executions
+cfg_batch_unet_latency_ms = 200.0
+
+# created instead of unet.serialized with --partitioned_unet, see StableDiffusionModel in context.h
+unet_partitions = {
+    'unet_inputs.serialized': 'unet_inputs',
+    'unet_middle.serialized': 'unet_middle',
+    'unet_outputs.serialized': 'unet_outputs',
+}
+
+
+def bytes_to_unicode():
+    bs = list(range(ord("!"), ord("~")+1))+list(range(ord("¡"), ord("¬")+1))+list(range(ord("®"), ord("ÿ")+1))
+    cs = bs[:]
+    n = 0
+    for b in range(2**8):
+        if b not in bs:
+            bs.append(b)
+            cs.append(2**8+n)
+            n += 1
+    cs = [chr(n) for n in cs]
+    return dict(zip(bs, cs))
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('output_dir')
+    parser.add_argument('--dtype', default='float32', choices=['float32', 'float16', 'uq16', 'uq8'], help='Data type of activations exposed by the stub graphs')
+    parser.add_argument('--no_latency', action='store_true', help='Do not simulate execution time of the graphs')
+    parser.add_argument('--cfg_batch', action='store_true', help='Create unet with batch 2, running conditional and unconditional passes in a single execution')
+    parser.add_argument('--partitioned_unet', action='store_true', help='Split the unet into input, middle and output partitions, used for feature caching')
+    parser.add_argument('--decoder_batch', type=int, default=1, help='Batch of the vae_decoder, used to decode several tiles of large latents at once')
+    parser.add_argument('--temb_batch', type=int, default=1, help='Batch of the temb, used to compute embeddings of several timesteps at once')
+    parser.add_argument('--fast_decoder', action='store_true', help='Also create the optional tiny autoencoder decoder (taesd_decoder), used for fast decoding')
+    parser.add_argument('--encoder', action='store_true', help='Also create the optional VAE encoder (vae_encoder), used for image to image generation')
+    parser.add_argument('--tokenizer', default=None, help='Tokenizer file to copy (ctokenizer.txt, see gen_tokenizer_file.py), if not provided a byte-level tokenizer without merges is created')
+    args = parser.parse_args()
+
+    os.makedirs(args.output_dir, exist_ok=True)
+    enabled = { 'taesd_decoder': args.fast_decoder, 'vae_encoder': args.encoder }
+    models = dict(graphs)
+    if args.partitioned_unet:
+        del models['unet.serialized']
+        models.update(unet_partitions)
+    for filename, graph in {**models, **{ k: v for k, v in optional_graphs.items() if enabled[v] }}.items():
+        batch = 2 if args.cfg_batch and graph.startswith('unet') else 1
+        latency = default_latency_ms[graph]
+        if batch == 2:
+            latency *= cfg_batch_unet_latency_ms / default_latency_ms['unet']
+        if graph in ('vae_decoder', 'taesd_decoder'):
+            batch = args.decoder_batch
+            latency = default_latency_ms[graph] * batch
+        if graph == 'temb':
+            batch = args.temb_batch
+        if args.no_latency:
+            latency = 0.0
+        with open(os.path.join(args.output_dir, filename + '.bin'), 'w') as f:
+            f.write(f'sdod_stub {graph} {latency} {args.dtype} {batch}\n')
+
+    tokenizer = os.path.join(args.output_dir, 'ctokenizer.txt')
+    if args.tokenizer:
+        shutil.copyfile(args.tokenizer, tokenizer)
+    else:
+        vocab = list(bytes_to_unicode().values())
+        vocab = vocab + [v+'</w>' for v in vocab]
+        with open(tokenizer, 'wb') as f:
+            for v in vocab:
+                f.write((v + '\n').encode('utf-8'))
+
+
+if __name__ == '__main__':
+    main()
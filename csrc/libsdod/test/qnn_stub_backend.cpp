@@ -0,0 +1,778 @@
+// Stand-in for libQnnHtp.so/libQnnSystem.so which allows running the whole libsdod pipeline on a Linux host
+// without Qualcomm hardware. Only the subset of the QNN interface used by QnnApi is implemented.
+//
+// "Context binaries" understood by the stub are small text descriptors:
+//
+//     sdod_stub <graph> [latency_ms] [dtype] [batch]
+//
+// where <graph> is one of: unet, unet_inputs, unet_middle, unet_outputs, text_encoder, vae_decoder, taesd_decoder, vae_encoder, temb; [dtype] is one of: float32 (default), float16, uq16, uq8
+// and is used for all activations of the graph (tokens are always int32); [batch] (default 1) can be set to 2 for the unet
+// to simulate a model running conditional and unconditional passes in a single execution, or to any value for the vae_decoder
+// to decode several tiles of large latents in a single execution (same for the taesd_decoder, a stand-in for the optional
+// tiny autoencoder, which uses a different function of the latent so that its images can be told apart) and for the temb
+// to compute embeddings of several timesteps in a single execution. The unet_* graphs are partitions of the unet which, executed
+// one after another (connected by tensor names), compute exactly the same outputs; they accept the same batch as the unet. The vae_encoder
+// is the inverse of the vae_decoder (up to averaging of 8x8 blocks of pixels), used for img2img. Each graph exposes the same inputs and outputs
+// (names, shapes and order) as the real SD1.5 models and sleeps for [latency_ms] on each execution (can be overwritten
+// with SDOD_STUB_LATENCY_<GRAPH> environment variable, e.g. SDOD_STUB_LATENCY_UNET=120). Asynchronous executions run one at a time
+// in submission order, unless SDOD_STUB_ASYNC_WORKERS allows more of them to run concurrently. Outputs are a cheap, deterministic
+// and bounded function of inputs so the pipeline produces reproducible (although meaningless) images.
+// See test/make_stub_models.py for a script creating a complete models directory.
+
+#include <map>
+#include <list>
+#include <mutex>
+#include <deque>
+#include <cmath>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <algorithm>
+#include <functional>
+#include <condition_variable>
+
+#include <sys/mman.h>
+
+#include <QnnInterface.h>
+#include <System/QnnSystemInterface.h>
+#include <HTP/QnnHtpDevice.h>
+
+
+namespace {
+
+constexpr unsigned int latent_channels = 4;
+constexpr unsigned int latent_spatial = 64;
+constexpr unsigned int upscale_factor = 8;
+constexpr unsigned int context_len = 77;
+constexpr unsigned int embedding_dim = 768;
+constexpr unsigned int temb_in_dim = 320;
+constexpr unsigned int temb_out_dim = 1280;
+
+// range of values represented by quantized activations
+constexpr float quant_min = -8.0f;
+constexpr float quant_max = 8.0f;
+
+
+QnnLog_Callback_t _log_callback = nullptr;
+QnnLog_Level_t _log_level = QNN_LOG_LEVEL_ERROR;
+
+void stub_log(QnnLog_Level_t level, const char* fmt, ...) {
+    if (!_log_callback || level > _log_level)
+        return;
+    va_list args;
+    va_start(args, fmt);
+    auto&& now = std::chrono::steady_clock::now().time_since_epoch();
+    _log_callback(fmt, level, std::chrono::duration_cast<std::chrono::microseconds>(now).count(), args);
+    va_end(args);
+}
+
+
+enum class GraphKind {
+    UNET,
+    UNET_INPUTS,
+    UNET_MIDDLE,
+    UNET_OUTPUTS,
+    TEXT_ENCODER,
+    VAE_DECODER,
+    TAESD_DECODER,
+    VAE_ENCODER,
+    TEMB
+};
+
+
+struct TensorSpec {
+    const char* name;
+    std::vector<uint32_t> dims;
+    bool is_tokens = false;
+    bool is_image = false;
+};
+
+
+struct GraphSpec {
+    GraphKind kind;
+    const char* name;
+    std::vector<TensorSpec> inputs;
+    std::vector<TensorSpec> outputs;
+};
+
+
+const std::vector<GraphSpec> _graph_specs = {
+    { GraphKind::UNET, "unet",
+        { { "x", { 1, latent_spatial, latent_spatial, latent_channels } }, { "t", { 1, temb_out_dim } }, { "p", { 1, context_len, embedding_dim } } },
+        { { "e", { 1, latent_spatial, latent_spatial, latent_channels } } } },
+    { GraphKind::UNET_INPUTS, "unet_inputs",
+        { { "x", { 1, latent_spatial, latent_spatial, latent_channels } }, { "t", { 1, temb_out_dim } }, { "p", { 1, context_len, embedding_dim } } },
+        { { "h", { 1, latent_spatial, latent_spatial, latent_channels } }, { "skip", { 1, latent_spatial, latent_spatial, latent_channels } } } },
+    { GraphKind::UNET_MIDDLE, "unet_middle",
+        { { "h", { 1, latent_spatial, latent_spatial, latent_channels } }, { "t", { 1, temb_out_dim } }, { "p", { 1, context_len, embedding_dim } } },
+        { { "d", { 1, latent_spatial, latent_spatial, latent_channels } } } },
+    { GraphKind::UNET_OUTPUTS, "unet_outputs",
+        { { "d", { 1, latent_spatial, latent_spatial, latent_channels } }, { "skip", { 1, latent_spatial, latent_spatial, latent_channels } }, { "t", { 1, temb_out_dim } } },
+        { { "e", { 1, latent_spatial, latent_spatial, latent_channels } } } },
+    { GraphKind::TEXT_ENCODER, "text_encoder",
+        { { "tokens", { 1, context_len }, true } },
+        { { "p", { 1, context_len, embedding_dim } } } },
+    { GraphKind::VAE_DECODER, "vae_decoder",
+        { { "y", { 1, latent_spatial, latent_spatial, latent_channels } } },
+        { { "img", { 1, latent_spatial * upscale_factor, latent_spatial * upscale_factor, 3 }, false, true } } },
+    { GraphKind::TAESD_DECODER, "taesd_decoder",
+        { { "y", { 1, latent_spatial, latent_spatial, latent_channels } } },
+        { { "img", { 1, latent_spatial * upscale_factor, latent_spatial * upscale_factor, 3 }, false, true } } },
+    { GraphKind::VAE_ENCODER, "vae_encoder",
+        { { "img", { 1, latent_spatial * upscale_factor, latent_spatial * upscale_factor, 3 }, false, true } },
+        { { "y", { 1, latent_spatial, latent_spatial, latent_channels } } } },
+    { GraphKind::TEMB, "temb",
+        { { "t", { 1, temb_in_dim } } },
+        { { "temb", { 1, temb_out_dim } } } }
+};
+
+
+bool parse_dtype(std::string const& str, Qnn_DataType_t& dtype) {
+    if (str == "float32")
+        dtype = QNN_DATATYPE_FLOAT_32;
+    else if (str == "float16")
+        dtype = QNN_DATATYPE_FLOAT_16;
+    else if (str == "uq16")
+        dtype = QNN_DATATYPE_UFIXED_POINT_16;
+    else if (str == "uq8")
+        dtype = QNN_DATATYPE_UFIXED_POINT_8;
+    else
+        return false;
+    return true;
+}
+
+
+std::size_t element_size(Qnn_DataType_t dtype) {
+    switch (dtype & 0xFF) {
+    case 0x08: return 1;
+    case 0x16: return 2;
+    case 0x32: return 4;
+    case 0x64: return 8;
+    default: return 0;
+    }
+}
+
+
+std::size_t num_elements(Qnn_Tensor_t const& t) {
+    std::size_t ret = 1;
+    for (uint32_t i = 0; i < t.v1.rank; ++i)
+        ret *= t.v1.dimensions[i];
+    return ret;
+}
+
+
+// a single graph with tensors described by the same structures as returned from the real system context,
+// memory layout of the object is stable (vectors are never resized after construction)
+struct StubGraph {
+    GraphSpec const& spec;
+    std::string name;
+    Qnn_DataType_t dtype;
+    double latency_ms;
+    uint32_t batch;
+
+    std::vector<std::vector<uint32_t>> dims;
+    std::vector<Qnn_Tensor_t> inputs;
+    std::vector<Qnn_Tensor_t> outputs;
+
+    StubGraph(GraphSpec const& spec, Qnn_DataType_t dtype, double latency_ms, uint32_t batch) : spec(spec), name(spec.name), dtype(dtype), latency_ms(latency_ms), batch(batch) {
+        dims.reserve(spec.inputs.size() + spec.outputs.size());
+        for (auto&& t : spec.inputs)
+            inputs.push_back(_make_tensor(t, QNN_TENSOR_TYPE_APP_WRITE));
+        for (auto&& t : spec.outputs)
+            outputs.push_back(_make_tensor(t, QNN_TENSOR_TYPE_APP_READ));
+    }
+
+private:
+    Qnn_Tensor_t _make_tensor(TensorSpec const& spec, Qnn_TensorType_t type) {
+        auto&& d = dims.emplace_back(spec.dims);
+        d[0] = batch;
+
+        Qnn_Tensor_t ret{};
+        ret.version = QNN_TENSOR_VERSION_1;
+        ret.v1.id = inputs.size() + outputs.size();
+        ret.v1.name = spec.name;
+        ret.v1.type = type;
+        ret.v1.dataFormat = QNN_TENSOR_DATA_FORMAT_FLAT_BUFFER;
+        ret.v1.dataType = (spec.is_tokens ? QNN_DATATYPE_INT_32 : dtype);
+        ret.v1.rank = d.size();
+        ret.v1.dimensions = d.data();
+        ret.v1.memType = QNN_TENSORMEMTYPE_RAW;
+        ret.v1.clientBuf.data = nullptr;
+        ret.v1.clientBuf.dataSize = 0;
+
+        ret.v1.quantizeParams.encodingDefinition = QNN_DEFINITION_UNDEFINED;
+        ret.v1.quantizeParams.quantizationEncoding = QNN_QUANTIZATION_ENCODING_UNDEFINED;
+        if (ret.v1.dataType == QNN_DATATYPE_UFIXED_POINT_8 || ret.v1.dataType == QNN_DATATYPE_UFIXED_POINT_16) {
+            float min = (spec.is_image ? 0.0f : quant_min);
+            float max = (spec.is_image ? 1.0f : quant_max);
+            float levels = (ret.v1.dataType == QNN_DATATYPE_UFIXED_POINT_8 ? 255.0f : 65535.0f);
+            float scale = (max - min) / levels;
+            ret.v1.quantizeParams.encodingDefinition = QNN_DEFINITION_DEFINED;
+            ret.v1.quantizeParams.quantizationEncoding = QNN_QUANTIZATION_ENCODING_SCALE_OFFSET;
+            ret.v1.quantizeParams.scaleOffsetEncoding.scale = scale;
+            ret.v1.quantizeParams.scaleOffsetEncoding.offset = static_cast<int32_t>(std::round(min / scale));
+        }
+        return ret;
+    }
+};
+
+
+// parsed content of a descriptor, used both as a context handle and as a storage for binary info
+struct StubBinary {
+    std::list<StubGraph> graphs;
+    std::vector<QnnSystemContext_GraphInfo_t> graphs_info;
+    QnnSystemContext_BinaryInfo_t binary_info;
+};
+
+
+std::unique_ptr<StubBinary> parse_binary(const void* buffer, uint64_t size) {
+    if (!buffer || !size)
+        return nullptr;
+
+    std::istringstream in{ std::string(reinterpret_cast<const char*>(buffer), size) };
+    std::string magic, graph, dtype_str;
+    double latency_ms = 0.0;
+    uint32_t batch = 1;
+    in >> magic >> graph;
+    if (magic != "sdod_stub")
+        return nullptr;
+    if (!(in >> latency_ms))
+        latency_ms = 0.0;
+    else if (!(in >> dtype_str))
+        dtype_str.clear();
+    else if (!(in >> batch))
+        batch = 1;
+    if (dtype_str.empty())
+        dtype_str = "float32";
+
+    Qnn_DataType_t dtype;
+    if (!parse_dtype(dtype_str, dtype))
+        return nullptr;
+
+    auto&& spec = std::find_if(_graph_specs.begin(), _graph_specs.end(), [&graph](GraphSpec const& s) { return graph == s.name; });
+    if (spec == _graph_specs.end())
+        return nullptr;
+    bool unet = (spec->kind == GraphKind::UNET || spec->kind == GraphKind::UNET_INPUTS || spec->kind == GraphKind::UNET_MIDDLE || spec->kind == GraphKind::UNET_OUTPUTS);
+    if (batch < 1 || (batch > 1 && !unet && spec->kind != GraphKind::VAE_DECODER && spec->kind != GraphKind::TAESD_DECODER && spec->kind != GraphKind::TEMB))
+        return nullptr;
+
+    std::string env_name = "SDOD_STUB_LATENCY_" + graph;
+    std::transform(env_name.begin(), env_name.end(), env_name.begin(), [](unsigned char c) { return std::toupper(c); });
+    if (auto&& env = std::getenv(env_name.c_str()))
+        latency_ms = std::atof(env);
+
+    auto ret = std::make_unique<StubBinary>();
+    auto&& g = ret->graphs.emplace_back(*spec, dtype, latency_ms, batch);
+
+    auto&& info = ret->graphs_info.emplace_back();
+    info.version = QNN_SYSTEM_CONTEXT_GRAPH_INFO_VERSION_1;
+    info.graphInfoV1.graphName = g.name.c_str();
+    info.graphInfoV1.numGraphInputs = g.inputs.size();
+    info.graphInfoV1.graphInputs = g.inputs.data();
+    info.graphInfoV1.numGraphOutputs = g.outputs.size();
+    info.graphInfoV1.graphOutputs = g.outputs.data();
+
+    std::memset(&ret->binary_info, 0, sizeof(ret->binary_info));
+    ret->binary_info.version = QNN_SYSTEM_CONTEXT_BINARY_INFO_VERSION_1;
+    ret->binary_info.contextBinaryInfoV1.numGraphs = ret->graphs_info.size();
+    ret->binary_info.contextBinaryInfoV1.graphs = ret->graphs_info.data();
+    return ret;
+}
+
+
+struct StubSystemContext {
+    std::list<std::unique_ptr<StubBinary>> binaries;
+};
+
+
+// memory registered with memRegister, mapped from the provided file descriptor
+struct StubMem {
+    void* data;
+    std::size_t size;
+};
+
+std::mutex _mem_mutex;
+std::map<Qnn_MemHandle_t, StubMem> _registered_mem;
+
+
+void* get_tensor_data(Qnn_Tensor_t const& t, std::size_t required) {
+    if (t.v1.memType == QNN_TENSORMEMTYPE_RAW) {
+        if (!t.v1.clientBuf.data || t.v1.clientBuf.dataSize < required)
+            return nullptr;
+        return t.v1.clientBuf.data;
+    } else if (t.v1.memType == QNN_TENSORMEMTYPE_MEMHANDLE) {
+        auto&& _guard = std::lock_guard<std::mutex>{ _mem_mutex };
+        (void)_guard;
+        auto&& itr = _registered_mem.find(t.v1.memHandle);
+        if (itr == _registered_mem.end() || itr->second.size < required)
+            return nullptr;
+        return itr->second.data;
+    }
+    return nullptr;
+}
+
+
+bool read_tensor(Qnn_Tensor_t const& t, std::vector<float>& out) {
+    auto elements = num_elements(t);
+    auto src = get_tensor_data(t, elements * element_size(t.v1.dataType));
+    if (!src)
+        return false;
+
+    out.resize(elements);
+    auto&& q = t.v1.quantizeParams.scaleOffsetEncoding;
+    for (std::size_t i = 0; i < elements; ++i) {
+        switch (t.v1.dataType) {
+        case QNN_DATATYPE_FLOAT_32: out[i] = reinterpret_cast<const float*>(src)[i]; break;
+        case QNN_DATATYPE_FLOAT_16: out[i] = static_cast<float>(reinterpret_cast<const __fp16*>(src)[i]); break;
+        case QNN_DATATYPE_INT_32: out[i] = static_cast<float>(reinterpret_cast<const int32_t*>(src)[i]); break;
+        case QNN_DATATYPE_UFIXED_POINT_8: out[i] = (reinterpret_cast<const uint8_t*>(src)[i] + q.offset) * q.scale; break;
+        case QNN_DATATYPE_UFIXED_POINT_16: out[i] = (reinterpret_cast<const uint16_t*>(src)[i] + q.offset) * q.scale; break;
+        default: return false;
+        }
+    }
+    return true;
+}
+
+
+bool write_tensor(Qnn_Tensor_t const& t, std::vector<float> const& in) {
+    auto elements = num_elements(t);
+    auto dst = get_tensor_data(t, elements * element_size(t.v1.dataType));
+    if (!dst || in.size() != elements)
+        return false;
+
+    auto&& q = t.v1.quantizeParams.scaleOffsetEncoding;
+    auto&& quantize = [&q](float f, float levels) { return std::clamp(std::round(f / q.scale - q.offset), 0.0f, levels); };
+    for (std::size_t i = 0; i < elements; ++i) {
+        switch (t.v1.dataType) {
+        case QNN_DATATYPE_FLOAT_32: reinterpret_cast<float*>(dst)[i] = in[i]; break;
+        case QNN_DATATYPE_FLOAT_16: reinterpret_cast<__fp16*>(dst)[i] = static_cast<__fp16>(in[i]); break;
+        case QNN_DATATYPE_INT_32: reinterpret_cast<int32_t*>(dst)[i] = static_cast<int32_t>(in[i]); break;
+        case QNN_DATATYPE_UFIXED_POINT_8: reinterpret_cast<uint8_t*>(dst)[i] = static_cast<uint8_t>(quantize(in[i], 255.0f)); break;
+        case QNN_DATATYPE_UFIXED_POINT_16: reinterpret_cast<uint16_t*>(dst)[i] = static_cast<uint16_t>(quantize(in[i], 65535.0f)); break;
+        default: return false;
+        }
+    }
+    return true;
+}
+
+
+// synthetic models, each output depends on all inputs so stale or missing data is visible in the results
+void compute(GraphKind kind, std::vector<std::vector<float>> const& in, std::vector<std::vector<float>>& out) {
+    switch (kind) {
+    case GraphKind::UNET: {
+        // each element of the batch is computed independently
+        auto batch = in[0].size() / (latent_spatial * latent_spatial * latent_channels);
+        auto x_size = in[0].size() / batch;
+        auto t_size = in[1].size() / batch;
+        auto p_size = in[2].size() / batch;
+        for (std::size_t b = 0; b < batch; ++b) {
+            auto x = in[0].data() + b * x_size;
+            auto t = in[1].data() + b * t_size;
+            auto p = in[2].data() + b * p_size;
+            auto e = out[0].data() + b * x_size;
+            for (std::size_t i = 0; i < x_size; ++i)
+                e[i] = std::clamp(0.9f * x[i] + 0.05f * std::tanh(p[i % p_size]) + 0.05f * std::tanh(t[i % t_size]), quant_min, quant_max);
+        }
+        break;
+    }
+    // the same function split into three parts, computed in the same order so that the results are identical
+    case GraphKind::UNET_INPUTS:
+    case GraphKind::UNET_MIDDLE: {
+        auto batch = in[0].size() / (latent_spatial * latent_spatial * latent_channels);
+        auto x_size = in[0].size() / batch;
+        auto t_size = in[1].size() / batch;
+        auto p_size = in[2].size() / batch;
+        for (std::size_t b = 0; b < batch; ++b) {
+            auto x = in[0].data() + b * x_size;
+            auto t = in[1].data() + b * t_size;
+            auto p = in[2].data() + b * p_size;
+            for (std::size_t i = 0; i < x_size; ++i) {
+                if (kind == GraphKind::UNET_INPUTS) {
+                    out[0][b * x_size + i] = 0.9f * x[i];
+                    out[1][b * x_size + i] = 0.05f * std::tanh(t[i % t_size]);
+                } else
+                    out[0][b * x_size + i] = x[i] + 0.05f * std::tanh(p[i % p_size]);
+            }
+        }
+        break;
+    }
+    case GraphKind::UNET_OUTPUTS: {
+        for (std::size_t i = 0; i < in[0].size(); ++i)
+            out[0][i] = std::clamp(in[0][i] + in[1][i], quant_min, quant_max);
+        break;
+    }
+    case GraphKind::TEXT_ENCODER: {
+        auto&& tokens = in[0];
+        for (std::size_t i = 0; i < context_len; ++i)
+            for (std::size_t j = 0; j < embedding_dim; ++j)
+                out[0][i * embedding_dim + j] = std::sin(0.001f * tokens[i] * (j + 1) + 0.1f * i);
+        break;
+    }
+    case GraphKind::VAE_DECODER:
+    case GraphKind::TAESD_DECODER: {
+        bool tiny = (kind == GraphKind::TAESD_DECODER);
+        auto img_spatial = latent_spatial * upscale_factor;
+        auto y_size = latent_spatial * latent_spatial * latent_channels;
+        auto img_size = img_spatial * img_spatial * 3;
+        for (std::size_t b = 0; b < in[0].size() / y_size; ++b) {
+            auto y = in[0].data() + b * y_size;
+            auto img = out[0].data() + b * img_size;
+            for (unsigned int h = 0; h < img_spatial; ++h)
+                for (unsigned int w = 0; w < img_spatial; ++w)
+                    for (unsigned int c = 0; c < 3; ++c) {
+                        auto&& latent = y[((h / upscale_factor) * latent_spatial + (w / upscale_factor)) * latent_channels + c];
+                        img[(h * img_spatial + w) * 3 + c] = (tiny ? 0.5f + 0.5f * std::tanh(0.5f * latent) : std::clamp(0.5f + 0.25f * latent, 0.0f, 1.0f));
+                    }
+        }
+        break;
+    }
+    case GraphKind::VAE_ENCODER: {
+        auto&& img = in[0];
+        auto img_spatial = latent_spatial * upscale_factor;
+        std::fill(out[0].begin(), out[0].end(), 0.0f);
+        for (unsigned int h = 0; h < img_spatial; ++h)
+            for (unsigned int w = 0; w < img_spatial; ++w)
+                for (unsigned int c = 0; c < 3; ++c)
+                    out[0][((h / upscale_factor) * latent_spatial + (w / upscale_factor)) * latent_channels + c] += img[(h * img_spatial + w) * 3 + c];
+        for (unsigned int i = 0; i < latent_spatial * latent_spatial; ++i)
+            for (unsigned int c = 0; c < 3; ++c) {
+                auto&& v = out[0][i * latent_channels + c];
+                v = 4.0f * (v / (upscale_factor * upscale_factor) - 0.5f);
+            }
+        break;
+    }
+    case GraphKind::TEMB: {
+        auto&& t = in[0];
+        for (std::size_t b = 0; b < t.size() / temb_in_dim; ++b)
+            for (std::size_t i = 0; i < temb_out_dim; ++i)
+                out[0][b * temb_out_dim + i] = std::tanh(t[b * temb_in_dim + i % temb_in_dim] * (1.0f + i / temb_in_dim));
+        break;
+    }
+    }
+}
+
+
+Qnn_ErrorHandle_t execute(StubGraph const& graph, const Qnn_Tensor_t* inputs, uint32_t num_inputs, Qnn_Tensor_t* outputs, uint32_t num_outputs) {
+    auto&& deadline = std::chrono::steady_clock::now() + std::chrono::duration<double, std::milli>(graph.latency_ms);
+    if (num_inputs != graph.inputs.size() || num_outputs != graph.outputs.size())
+        return QNN_COMMON_ERROR_GENERAL;
+
+    std::vector<std::vector<float>> in(num_inputs);
+    std::vector<std::vector<float>> out(num_outputs);
+    for (uint32_t i = 0; i < num_inputs; ++i)
+        if (!read_tensor(inputs[i], in[i])) {
+            stub_log(QNN_LOG_LEVEL_ERROR, "[stub] %s: invalid input tensor %u", graph.name.c_str(), i);
+            return QNN_COMMON_ERROR_GENERAL;
+        }
+    for (uint32_t i = 0; i < num_outputs; ++i)
+        out[i].resize(num_elements(outputs[i]));
+
+    compute(graph.spec.kind, in, out);
+
+    for (uint32_t i = 0; i < num_outputs; ++i)
+        if (!write_tensor(outputs[i], out[i])) {
+            stub_log(QNN_LOG_LEVEL_ERROR, "[stub] %s: invalid output tensor %u", graph.name.c_str(), i);
+            return QNN_COMMON_ERROR_GENERAL;
+        }
+
+    std::this_thread::sleep_until(deadline);
+    return QNN_SUCCESS;
+}
+
+
+// executes asynchronous requests in submission order, similar to a single HTP queue; with SDOD_STUB_ASYNC_WORKERS set to more
+// than 1, that many requests run concurrently and may finish in any order (as nothing guarantees the order of a real backend)
+class AsyncQueue {
+public:
+    ~AsyncQueue() {
+        {
+            auto&& _guard = std::lock_guard<std::mutex>{ mutex };
+            (void)_guard;
+            stop = true;
+        }
+        cv.notify_all();
+        for (auto&& w : workers)
+            w.join();
+    }
+
+    void push(std::function<void()> job) {
+        auto&& _guard = std::lock_guard<std::mutex>{ mutex };
+        (void)_guard;
+        if (workers.empty()) {
+            auto&& env = std::getenv("SDOD_STUB_ASYNC_WORKERS");
+            auto count = std::max(env ? std::atoi(env) : 1, 1);
+            for (int i = 0; i < count; ++i)
+                workers.emplace_back([this]() { _run(); });
+        }
+        jobs.push_back(std::move(job));
+        cv.notify_one();
+    }
+
+private:
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<std::function<void()>> jobs;
+    std::vector<std::thread> workers;
+    bool stop = false;
+
+    void _run() {
+        while (true) {
+            std::function<void()> job;
+            {
+                auto&& _lock = std::unique_lock<std::mutex>{ mutex };
+                cv.wait(_lock, [this]() { return stop || !jobs.empty(); });
+                if (jobs.empty())
+                    return;
+                job = std::move(jobs.front());
+                jobs.pop_front();
+            }
+            job();
+        }
+    }
+};
+
+AsyncQueue _async_queue;
+
+
+Qnn_ErrorHandle_t stub_log_create(QnnLog_Callback_t callback, QnnLog_Level_t max_level, Qnn_LogHandle_t* hnd) {
+    _log_callback = callback;
+    _log_level = max_level;
+    *hnd = reinterpret_cast<Qnn_LogHandle_t>(&_log_callback);
+    return QNN_SUCCESS;
+}
+
+Qnn_ErrorHandle_t stub_log_free(Qnn_LogHandle_t) {
+    _log_callback = nullptr;
+    return QNN_SUCCESS;
+}
+
+
+int _backend_token;
+int _device_token;
+
+Qnn_ErrorHandle_t stub_backend_create(Qnn_LogHandle_t, const QnnBackend_Config_t**, Qnn_BackendHandle_t* hnd) {
+    stub_log(QNN_LOG_LEVEL_INFO, "[stub] Using stub QNN backend, no real hardware will be used");
+    *hnd = &_backend_token;
+    return QNN_SUCCESS;
+}
+
+Qnn_ErrorHandle_t stub_backend_free(Qnn_BackendHandle_t) { return QNN_SUCCESS; }
+
+Qnn_ErrorHandle_t stub_device_create(Qnn_LogHandle_t, const QnnDevice_Config_t**, Qnn_DeviceHandle_t* hnd) {
+    *hnd = &_device_token;
+    return QNN_SUCCESS;
+}
+
+Qnn_ErrorHandle_t stub_device_free(Qnn_DeviceHandle_t) { return QNN_SUCCESS; }
+
+
+Qnn_ErrorHandle_t stub_create_power_config_id(uint32_t, uint32_t, uint32_t* id) {
+    *id = 1;
+    return QNN_SUCCESS;
+}
+
+Qnn_ErrorHandle_t stub_destroy_power_config_id(uint32_t) { return QNN_SUCCESS; }
+Qnn_ErrorHandle_t stub_set_power_config(uint32_t, const QnnHtpPerfInfrastructure_PowerConfig_t**) { return QNN_SUCCESS; }
+
+QnnHtpDevice_Infrastructure_t _htp_infra;
+
+Qnn_ErrorHandle_t stub_device_get_infrastructure(const QnnDevice_Infrastructure_t* infra) {
+    _htp_infra.infraType = QNN_HTP_DEVICE_INFRASTRUCTURE_TYPE_PERF;
+    _htp_infra.perfInfra.createPowerConfigId = stub_create_power_config_id;
+    _htp_infra.perfInfra.destroyPowerConfigId = stub_destroy_power_config_id;
+    _htp_infra.perfInfra.setPowerConfig = stub_set_power_config;
+    *const_cast<QnnDevice_Infrastructure_t*>(infra) = &_htp_infra;
+    return QNN_SUCCESS;
+}
+
+
+Qnn_ErrorHandle_t stub_context_create(Qnn_BackendHandle_t, Qnn_DeviceHandle_t, const QnnContext_Config_t**, Qnn_ContextHandle_t*) {
+    stub_log(QNN_LOG_LEVEL_ERROR, "[stub] Only contexts created from binaries are supported");
+    return QNN_COMMON_ERROR_NOT_SUPPORTED;
+}
+
+Qnn_ErrorHandle_t stub_context_create_from_binary(Qnn_BackendHandle_t, Qnn_DeviceHandle_t, const QnnContext_Config_t**, const void* buffer, Qnn_ContextBinarySize_t size, Qnn_ContextHandle_t* hnd, Qnn_ProfileHandle_t) {
+    auto&& binary = parse_binary(buffer, size);
+    if (!binary) {
+        stub_log(QNN_LOG_LEVEL_ERROR, "[stub] Context binary is not a valid stub descriptor");
+        return QNN_COMMON_ERROR_GENERAL;
+    }
+    auto&& g = binary->graphs.front();
+    stub_log(QNN_LOG_LEVEL_INFO, "[stub] Created context with graph %s, latency: %.2fms", g.name.c_str(), g.latency_ms);
+    *hnd = binary.release();
+    return QNN_SUCCESS;
+}
+
+Qnn_ErrorHandle_t stub_context_free(Qnn_ContextHandle_t hnd, Qnn_ProfileHandle_t) {
+    delete reinterpret_cast<StubBinary*>(hnd);
+    return QNN_SUCCESS;
+}
+
+
+Qnn_ErrorHandle_t stub_graph_retrieve(Qnn_ContextHandle_t ctx, const char* name, Qnn_GraphHandle_t* hnd) {
+    for (auto&& g : reinterpret_cast<StubBinary*>(ctx)->graphs) {
+        if (g.name == name) {
+            *hnd = &g;
+            return QNN_SUCCESS;
+        }
+    }
+    return QNN_COMMON_ERROR_GENERAL;
+}
+
+Qnn_ErrorHandle_t stub_graph_finalize(Qnn_GraphHandle_t, Qnn_ProfileHandle_t, Qnn_SignalHandle_t) { return QNN_SUCCESS; }
+Qnn_ErrorHandle_t stub_graph_set_config(Qnn_GraphHandle_t, const QnnGraph_Config_t**) { return QNN_SUCCESS; }
+
+Qnn_ErrorHandle_t stub_graph_execute(Qnn_GraphHandle_t graph, const Qnn_Tensor_t* inputs, uint32_t num_inputs, Qnn_Tensor_t* outputs, uint32_t num_outputs, Qnn_ProfileHandle_t, Qnn_SignalHandle_t) {
+    return execute(*reinterpret_cast<StubGraph*>(graph), inputs, num_inputs, outputs, num_outputs);
+}
+
+Qnn_ErrorHandle_t stub_graph_execute_async(Qnn_GraphHandle_t graph, const Qnn_Tensor_t* inputs, uint32_t num_inputs, Qnn_Tensor_t* outputs, uint32_t num_outputs, Qnn_ProfileHandle_t, Qnn_SignalHandle_t, Qnn_NotifyFn_t notify, void* notify_param) {
+    // as with a real backend, the caller's tensor descriptors (and the data they point to) are only read when the request
+    // is executed, so they have to stay unchanged until it is done
+    _async_queue.push([graph, inputs, num_inputs, outputs, num_outputs, notify, notify_param]() {
+        Qnn_NotifyStatus_t status;
+        status.error = execute(*reinterpret_cast<StubGraph*>(graph), inputs, num_inputs, outputs, num_outputs);
+        if (notify)
+            notify(notify_param, status);
+    });
+    return QNN_SUCCESS;
+}
+
+
+Qnn_ErrorHandle_t stub_mem_register(Qnn_ContextHandle_t, const Qnn_MemDescriptor_t* desc, uint32_t num_desc, Qnn_MemHandle_t* hnds) {
+    for (uint32_t i = 0; i < num_desc; ++i) {
+        if (desc[i].memType != QNN_MEM_TYPE_ION)
+            return QNN_COMMON_ERROR_NOT_SUPPORTED;
+
+        std::size_t size = element_size(desc[i].dataType);
+        for (uint32_t d = 0; d < desc[i].memShape.numDim; ++d)
+            size *= desc[i].memShape.dimSize[d];
+
+        auto ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, desc[i].ionInfo.fd, 0);
+        if (ptr == MAP_FAILED)
+            return QNN_COMMON_ERROR_GENERAL;
+
+        auto&& _guard = std::lock_guard<std::mutex>{ _mem_mutex };
+        (void)_guard;
+        hnds[i] = new int(desc[i].ionInfo.fd);
+        _registered_mem[hnds[i]] = StubMem{ .data = ptr, .size = size };
+    }
+    return QNN_SUCCESS;
+}
+
+Qnn_ErrorHandle_t stub_mem_deregister(const Qnn_MemHandle_t* hnds, uint32_t num_hnds) {
+    auto&& _guard = std::lock_guard<std::mutex>{ _mem_mutex };
+    (void)_guard;
+    for (uint32_t i = 0; i < num_hnds; ++i) {
+        auto&& itr = _registered_mem.find(hnds[i]);
+        if (itr == _registered_mem.end())
+            continue;
+        munmap(itr->second.data, itr->second.size);
+        delete reinterpret_cast<int*>(hnds[i]);
+        _registered_mem.erase(itr);
+    }
+    return QNN_SUCCESS;
+}
+
+
+Qnn_ErrorHandle_t stub_system_context_create(QnnSystemContext_Handle_t* hnd) {
+    *hnd = new StubSystemContext();
+    return QNN_SUCCESS;
+}
+
+Qnn_ErrorHandle_t stub_system_context_get_binary_info(QnnSystemContext_Handle_t hnd, void* buffer, uint64_t size, const QnnSystemContext_BinaryInfo_t** info, Qnn_ContextBinarySize_t* info_size) {
+    auto&& binary = parse_binary(buffer, size);
+    if (!binary)
+        return QNN_COMMON_ERROR_GENERAL;
+    *info = &binary->binary_info;
+    *info_size = sizeof(QnnSystemContext_BinaryInfo_t);
+    reinterpret_cast<StubSystemContext*>(hnd)->binaries.push_back(std::move(binary));
+    return QNN_SUCCESS;
+}
+
+Qnn_ErrorHandle_t stub_system_context_free(QnnSystemContext_Handle_t hnd) {
+    delete reinterpret_cast<StubSystemContext*>(hnd);
+    return QNN_SUCCESS;
+}
+
+
+QnnInterface_t make_interface() {
+    QnnInterface_t ret;
+    std::memset(&ret, 0, sizeof(ret));
+    ret.backendId = 0;
+    ret.providerName = "SDOD_STUB";
+    ret.apiVersion.coreApiVersion.major = QNN_API_VERSION_MAJOR;
+    ret.apiVersion.coreApiVersion.minor = QNN_API_VERSION_MINOR;
+    ret.apiVersion.coreApiVersion.patch = QNN_API_VERSION_PATCH;
+
+    auto&& impl = ret.QNN_INTERFACE_VER_NAME;
+    impl.logCreate = stub_log_create;
+    impl.logFree = stub_log_free;
+    impl.backendCreate = stub_backend_create;
+    impl.backendFree = stub_backend_free;
+    impl.deviceCreate = stub_device_create;
+    impl.deviceFree = stub_device_free;
+    impl.deviceGetInfrastructure = stub_device_get_infrastructure;
+    impl.contextCreate = stub_context_create;
+    impl.contextCreateFromBinary = stub_context_create_from_binary;
+    impl.contextFree = stub_context_free;
+    impl.graphRetrieve = stub_graph_retrieve;
+    impl.graphFinalize = stub_graph_finalize;
+    impl.graphSetConfig = stub_graph_set_config;
+    impl.graphExecute = stub_graph_execute;
+    impl.graphExecuteAsync = stub_graph_execute_async;
+    impl.memRegister = stub_mem_register;
+    impl.memDeRegister = stub_mem_deregister;
+    return ret;
+}
+
+
+QnnSystemInterface_t make_system_interface() {
+    QnnSystemInterface_t ret;
+    std::memset(&ret, 0, sizeof(ret));
+    ret.backendId = 0;
+    ret.providerName = "SDOD_STUB";
+    ret.systemApiVersion.major = QNN_SYSTEM_API_VERSION_MAJOR;
+    ret.systemApiVersion.minor = QNN_SYSTEM_API_VERSION_MINOR;
+    ret.systemApiVersion.patch = 0;
+
+    auto&& impl = ret.QNN_SYSTEM_INTERFACE_VER_NAME;
+    impl.systemContextCreate = stub_system_context_create;
+    impl.systemContextGetBinaryInfo = stub_system_context_get_binary_info;
+    impl.systemContextFree = stub_system_context_free;
+    return ret;
+}
+
+
+QnnInterface_t _interface = make_interface();
+const QnnInterface_t* _interfaces[] = { &_interface };
+
+QnnSystemInterface_t _system_interface = make_system_interface();
+const QnnSystemInterface_t* _system_interfaces[] = { &_system_interface };
+
+}
+
+
+extern "C" {
+
+__attribute__((visibility("default")))
+Qnn_ErrorHandle_t QnnInterface_getProviders(const QnnInterface_t*** providers, uint32_t* num_providers) {
+    *providers = _interfaces;
+    *num_providers = 1;
+    return QNN_SUCCESS;
+}
+
+__attribute__((visibility("default")))
+Qnn_ErrorHandle_t QnnSystemInterface_getProviders(const QnnSystemInterface_t*** providers, uint32_t* num_providers) {
+    *providers = _system_interfaces;
+    *num_providers = 1;
+    return QNN_SUCCESS;
+}
+
+}
@@ -0,0 +1,250 @@
+#include "trace.h"
+#include "qnn_context.h"
+#include "conversions.h"
+#include "logging.h"
+#include "errors.h"
+#include "utils.h"
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+
+namespace {
+
+void usage(const char* argv0) {
+    std::cerr << "Usage: " << argv0 << " list <trace>" << std::endl
+        << "       " << argv0 << " run <trace> <models_dir> <record> [--iterations N] [--warmup W] [--backend htp|gpu|cpu] [--log_level L]" << std::endl
+        << "       " << argv0 << " diff <trace_a> <trace_b>" << std::endl
+        << "    list - print all graph executions recorded in a trace" << std::endl
+        << "    run - load the graph used by the selected record from <models_dir> and execute it in a loop with the recorded inputs," << std::endl
+        << "          then compare its outputs with the recorded ones (e.g. to compare different builds of the same model)" << std::endl
+        << "    diff - compare outputs of the corresponding records of two traces (e.g. recorded with the same prompts and seeds but different models)" << std::endl;
+}
+
+
+std::string describe(libsdod::TraceTensor const& t) {
+    auto ret = libsdod::format("{} {} {}", t.name, libsdod::dtype_to_str(t.dtype), t.dims);
+    if (libsdod::QnnTensor::is_quantized(t.get_desc()))
+        ret += libsdod::format(" (scale: {}, offset: {})", t.scale, t.offset);
+    return ret;
+}
+
+
+std::vector<float> to_float(std::span<const uint8_t> data, Qnn_Tensor_t const& desc, uint32_t elements) {
+    if (data.size() < std::size_t(elements) * libsdod::QnnTensor::get_element_size(desc))
+        throw libsdod::libsdod_exception(libsdod::ErrorCode::INVALID_ARGUMENT, libsdod::format("Tensor {} holds {} bytes, expected {} elements", desc.v1.name, data.size(), elements), __func__, __FILE__, STR(__LINE__));
+    std::vector<float> ret(elements);
+    libsdod::qnn2host<false, false>(data.data(), ret.data(), elements, desc, 0.0f);
+    return ret;
+}
+
+
+void print_diff(std::string const& what, std::vector<float> const& ref, std::vector<float> const& other) {
+    if (ref.size() != other.size()) {
+        std::cout << "    " << what << ": size mismatch, " << ref.size() << " vs. " << other.size() << std::endl;
+        return;
+    }
+
+    double max_abs = 0.0, sum_abs = 0.0, ref_sq = 0.0, diff_sq = 0.0;
+    for (auto i : libsdod::range(ref.size())) {
+        double d = std::abs(double(ref[i]) - other[i]);
+        max_abs = std::max(max_abs, d);
+        sum_abs += d;
+        diff_sq += d * d;
+        ref_sq += double(ref[i]) * ref[i];
+    }
+
+    std::cout << "    " << std::left << std::setw(32) << what << std::right << std::scientific << std::setprecision(3)
+        << " max abs: " << max_abs
+        << ", mean abs: " << (ref.empty() ? 0.0 : sum_abs / ref.size())
+        << ", rel l2: " << (ref_sq > 0 ? std::sqrt(diff_sq / ref_sq) : std::sqrt(diff_sq))
+        << std::defaultfloat << std::endl;
+}
+
+
+int list(std::string const& trace_path) {
+    libsdod::TraceReader trace{ trace_path };
+    auto&& records = trace.get_records();
+    std::cout << records.size() << " records" << std::endl;
+    for (auto i : libsdod::range(records.size())) {
+        auto&& r = records[i];
+        std::cout << "[" << i << "] " << r.graph << ", executed in " << r.exec_ms << "ms" << std::endl;
+        for (auto&& t : r.inputs)
+            std::cout << "    in:  " << describe(t) << std::endl;
+        for (auto&& t : r.outputs)
+            std::cout << "    out: " << describe(t) << std::endl;
+    }
+    return 0;
+}
+
+
+int diff(std::string const& trace_a, std::string const& trace_b) {
+    libsdod::TraceReader a{ trace_a };
+    libsdod::TraceReader b{ trace_b };
+    auto&& ra = a.get_records();
+    auto&& rb = b.get_records();
+    std::size_t count = std::min(ra.size(), rb.size());
+    if (ra.size() != rb.size())
+        std::cout << "Warning: number of records differs: " << ra.size() << " vs. " << rb.size() << ", comparing the first " << count << std::endl;
+
+    for (auto i : libsdod::range(count)) {
+        if (ra[i].graph != rb[i].graph || ra[i].outputs.size() != rb[i].outputs.size()) {
+            std::cout << "[" << i << "] graphs do not match: " << ra[i].graph << " vs. " << rb[i].graph << ", stopping" << std::endl;
+            return 1;
+        }
+
+        std::cout << "[" << i << "] " << ra[i].graph << ", " << ra[i].exec_ms << "ms vs. " << rb[i].exec_ms << "ms" << std::endl;
+        for (auto j : libsdod::range(ra[i].outputs.size())) {
+            auto&& ta = ra[i].outputs[j];
+            auto&& tb = rb[i].outputs[j];
+            print_diff(ta.name, to_float(ta.data, ta.get_desc(), ta.get_num_elements()), to_float(tb.data, tb.get_desc(), tb.get_num_elements()));
+        }
+    }
+    return 0;
+}
+
+
+int run(std::string const& trace_path, std::string const& models_dir, unsigned int record_idx, unsigned int iterations, unsigned int warmup, libsdod::QnnBackendType backend_type) {
+    libsdod::TraceReader trace{ trace_path };
+    auto&& records = trace.get_records();
+    if (record_idx >= records.size()) {
+        std::cerr << "Record index out of range, trace has " << records.size() << " records" << std::endl;
+        return 1;
+    }
+    auto&& record = records[record_idx];
+
+    libsdod::QnnBackend backend{ backend_type };
+    bool is_cached = (backend_type == libsdod::QnnBackendType::HTP);
+    auto&& path = models_dir + "/" + record.graph + (is_cached ? ".bin" : ".so");
+    auto&& graphs = backend.load_graphs(path, is_cached);
+    if (graphs.empty()) {
+        std::cerr << "No graphs found in: " << path << std::endl;
+        return 1;
+    }
+
+    auto&& graph = graphs.front();
+    graph.set_name(record.graph);
+    if (graph.get_num_inputs() != record.inputs.size() || graph.get_num_outputs() != record.outputs.size()) {
+        std::cerr << "Graph from " << path << " has " << graph.get_num_inputs() << " inputs and " << graph.get_num_outputs()
+            << " outputs, recorded: " << record.inputs.size() << " and " << record.outputs.size() << std::endl;
+        return 1;
+    }
+
+    // graphs compiled with batch > 1 (e.g. UNet with batched guidance) need tensors of the matching batch
+    auto&& batch_of = [](Qnn_Tensor_t const& desc) { return desc.v1.rank ? desc.v1.dimensions[0] : 1u; };
+
+    libsdod::tensor_list inputs;
+    libsdod::tensor_list outputs;
+    for (auto i : libsdod::range(record.inputs.size())) {
+        auto&& t = inputs.emplace_back(graph.allocate_input(i, batch_of(graph.get_input_desc(i))));
+        auto&& rec = record.inputs[i];
+        if (libsdod::QnnTensor::same_encoding(t.get_desc(), rec.get_desc()) && t.get_raw_data().size() == rec.data.size()) {
+            std::memcpy(t.get_raw_data().data(), rec.data.data(), rec.data.size());
+        } else {
+            std::cout << "Input " << rec.name << " is stored differently in the trace and in the model, converting" << std::endl;
+            t.set_data(to_float(rec.data, rec.get_desc(), rec.get_num_elements()));
+        }
+    }
+    for (auto i : libsdod::range(record.outputs.size()))
+        outputs.emplace_back(graph.allocate_output(i, batch_of(graph.get_output_desc(i))));
+    graph.verify();
+
+    for (auto i : libsdod::range(warmup)) {
+        (void)i;
+        graph.execute();
+    }
+
+    std::vector<double> times;
+    for (auto i : libsdod::range(iterations)) {
+        (void)i;
+        auto&& tick = std::chrono::high_resolution_clock::now();
+        graph.execute();
+        auto&& tock = std::chrono::high_resolution_clock::now();
+        times.push_back(std::chrono::duration<double, std::milli>(tock - tick).count());
+    }
+    std::sort(times.begin(), times.end());
+
+    double sum = 0.0;
+    for (auto t : times)
+        sum += t;
+    std::cout << "[" << record_idx << "] " << record.graph << ", " << iterations << " iterations" << std::endl
+        << "    recorded: " << record.exec_ms << "ms" << std::endl
+        << "    mean: " << (times.empty() ? 0.0 : sum / times.size()) << "ms"
+        << ", min: " << (times.empty() ? 0.0 : times.front()) << "ms"
+        << ", p50: " << (times.empty() ? 0.0 : times[times.size() / 2]) << "ms"
+        << ", max: " << (times.empty() ? 0.0 : times.back()) << "ms" << std::endl;
+
+    std::cout << "Outputs compared to the trace:" << std::endl;
+    auto&& out_itr = outputs.begin();
+    for (auto i : libsdod::range(record.outputs.size())) {
+        auto&& rec = record.outputs[i];
+        auto&& t = *out_itr++;
+        print_diff(rec.name, to_float(rec.data, rec.get_desc(), rec.get_num_elements()), to_float(t.get_raw_data(), t.get_desc(), t.get_num_elements(t.get_batch_size())));
+    }
+    return 0;
+}
+
+}
+
+
+int main(int argc, char** argv) {
+    if (argc < 3) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    std::string cmd = argv[1];
+    libsdod::Logger logger;
+    logger.set_level(libsdod::LogLevel::ERROR);
+    auto&& _log_guard = libsdod::ActiveLoggerScopeGuard(logger);
+    (void)_log_guard;
+
+    try {
+        if (cmd == "list" && argc == 3)
+            return list(argv[2]);
+        if (cmd == "diff" && argc == 4)
+            return diff(argv[2], argv[3]);
+        if (cmd == "run" && argc >= 5) {
+            unsigned int iterations = 10;
+            unsigned int warmup = 1;
+            auto backend = libsdod::QnnBackendType::HTP;
+            for (int i = 5; i < argc; i += 2) {
+                std::string arg = argv[i];
+                if (i + 1 >= argc) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                std::string value = argv[i + 1];
+                if (arg == "--iterations")
+                    iterations = std::stoul(value);
+                else if (arg == "--warmup")
+                    warmup = std::stoul(value);
+                else if (arg == "--log_level")
+                    logger.set_level(static_cast<libsdod::LogLevel>(std::stoul(value)));
+                else if (arg == "--backend" && value == "htp")
+                    backend = libsdod::QnnBackendType::HTP;
+                else if (arg == "--backend" && value == "gpu")
+                    backend = libsdod::QnnBackendType::GPU;
+                else if (arg == "--backend" && value == "cpu")
+                    backend = libsdod::QnnBackendType::CPU;
+                else {
+                    usage(argv[0]);
+                    return 1;
+                }
+            }
+            return run(argv[2], argv[3], std::stoul(argv[4]), iterations, warmup, backend);
+        }
+    } catch (std::exception const& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+
+    usage(argv[0]);
+    return 1;
+}
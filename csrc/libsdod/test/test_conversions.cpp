@@ -0,0 +1,149 @@
+#include "conversions.h"
+#include "dpm_solver.h"
+#include "qnn_context.h"
+#include "utils.h"
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cmath>
+#include <cstdint>
+#include <random>
+
+
+namespace {
+
+unsigned int failures = 0;
+
+void check(bool ok, std::string const& what) {
+    std::cout << (ok ? "ok:     " : "FAILED: ") << what << std::endl;
+    if (!ok)
+        ++failures;
+}
+
+
+Qnn_Tensor_t quantized_desc(Qnn_DataType_t dtype, float scale, int32_t offset) {
+    Qnn_Tensor_t desc{};
+    desc.version = QNN_TENSOR_VERSION_1;
+    desc.v1.dataType = dtype;
+    desc.v1.quantizeParams.encodingDefinition = QNN_DEFINITION_DEFINED;
+    desc.v1.quantizeParams.quantizationEncoding = QNN_QUANTIZATION_ENCODING_SCALE_OFFSET;
+    desc.v1.quantizeParams.scaleOffsetEncoding.scale = scale;
+    desc.v1.quantizeParams.scaleOffsetEncoding.offset = offset;
+    return desc;
+}
+
+
+// values within the encoding round-trip to the nearest step, values outside of it saturate at the ends of the range
+template <class T>
+void test_quantization_range(Qnn_DataType_t dtype, std::string const& name) {
+    constexpr double max_q = double((std::size_t(1) << (8 * sizeof(T))) - 1);
+    const float scale = 2.0f / max_q;
+    const int32_t offset = -std::int32_t(max_q / 2); // roughly [-1, 1]
+    auto&& desc = quantized_desc(dtype, scale, offset);
+
+    std::vector<float> in = { -5.0f, -1.0f, -0.25f, 0.0f, 0.3f, 0.999f, 1.5f, 100.0f };
+    std::vector<T> q(in.size());
+    libsdod::host2qnn<false, false>(q.data(), in.data(), in.size(), desc, 0.0f);
+
+    check(q.front() == 0 && q[1] == 0, libsdod::format("{}: values below the range saturate at 0, got: {} {}", name, q[0], q[1]));
+    check(q.back() == T(max_q) && q[q.size() - 2] == T(max_q), libsdod::format("{}: values above the range saturate at {}, got: {} {}", name, max_q, q[q.size() - 2], q.back()));
+
+    std::vector<float> out(in.size());
+    libsdod::qnn2host<false, false>(q.data(), out.data(), out.size(), desc, 0.0f);
+    bool ok = true;
+    for (auto i : libsdod::range(std::size_t(2), in.size() - 2))
+        ok = ok && std::abs(out[i] - in[i]) <= scale / 2 + 1e-6f;
+    check(ok, libsdod::format("{}: values within the range round-trip to the nearest step: {} -> {}", name, in, out));
+}
+
+
+
+// guided_solver_update (with both the raw and the prescaled conditional prediction) against the original separate passes:
+// dequantization with guidance, DPMSolver::update and conversion of the new latent; a few steps, so both orders are covered
+void test_guided_solver_update(Qnn_DataType_t dtype, std::string const& name, float scale, int32_t offset, float guidance) {
+    std::size_t elements = 4 * 16 * 16;
+    unsigned int steps = 4;
+    auto&& desc = quantized_desc(dtype, scale, offset);
+    auto elem_size = libsdod::QnnTensor::get_element_size(desc);
+    bool guided = (guidance != 1.0f);
+
+    libsdod::DPMSolver reference_solver(1000, 0.00085, 0.0120), solver(1000, 0.00085, 0.0120);
+    std::vector<float> ts;
+    reference_solver.prepare(steps, ts);
+    solver.prepare(steps, ts);
+
+    std::mt19937 gen{ 0 };
+    std::normal_distribution<float> normal{ 0, 1 };
+    std::vector<float> x0(elements);
+    for (auto& f : x0)
+        f = normal(gen);
+    std::vector<float> x_ref = x0, x = x0, x_prescaled = x0;
+    std::vector<float> history, history_prescaled, e(elements), scaled_cond(elements);
+    std::vector<unsigned char> cond(elements * elem_size), uncond(elements * elem_size);
+    std::vector<unsigned char> x_dev_ref(elements * elem_size), x_dev(elements * elem_size), x_dev_prescaled(elements * elem_size);
+
+    double max_x_diff = 0.0, max_prescaled_diff = 0.0;
+    std::size_t dev_mismatches = 0;
+    for (auto step : libsdod::range(steps)) {
+        for (auto& f : e)
+            f = 0.5f * normal(gen);
+        libsdod::host2qnn<false, false>(cond.data(), e.data(), elements, desc, 0.0f);
+        for (auto& f : e)
+            f = 0.5f * normal(gen);
+        libsdod::host2qnn<false, false>(uncond.data(), e.data(), elements, desc, 0.0f);
+
+        if (guided) {
+            libsdod::qnn2host<false, true>(cond.data(), e.data(), elements, desc, guidance);
+            libsdod::qnn2host<true, true>(uncond.data(), e.data(), elements, desc, 1 - guidance);
+        } else
+            libsdod::qnn2host<false, false>(cond.data(), e.data(), elements, desc, 0.0f);
+        reference_solver.update(step, x_ref, e);
+        libsdod::host2qnn<false, false>(x_dev_ref.data(), x_ref.data(), elements, desc, 0.0f);
+
+        libsdod::guided_solver_update(solver, step, x, history, cond.data(), guided ? uncond.data() : nullptr, desc, guidance, x_dev.data(), desc, 1);
+        if (guided) {
+            libsdod::prescale_cond(cond.data(), desc, guidance, scaled_cond);
+            libsdod::guided_solver_update(solver, step, x_prescaled, history_prescaled, scaled_cond, uncond.data(), desc, guidance, x_dev_prescaled.data(), desc, 1);
+        }
+
+        for (auto i : libsdod::range(elements)) {
+            max_x_diff = std::max(max_x_diff, double(std::abs(x[i] - x_ref[i])) / (1.0 + std::abs(x_ref[i])));
+            if (guided)
+                max_prescaled_diff = std::max(max_prescaled_diff, double(std::abs(x_prescaled[i] - x_ref[i])) / (1.0 + std::abs(x_ref[i])));
+        }
+        // the latents may round differently to the nearest quantization step
+        std::vector<float> dev_ref(elements), dev(elements);
+        libsdod::qnn2host<false, false>(x_dev_ref.data(), dev_ref.data(), elements, desc, 0.0f);
+        libsdod::qnn2host<false, false>(x_dev.data(), dev.data(), elements, desc, 0.0f);
+        auto step_tolerance = (libsdod::QnnTensor::is_quantized(desc) ? 1.01 * scale : 0.0);
+        for (auto i : libsdod::range(elements))
+            if (std::abs(dev[i] - dev_ref[i]) > step_tolerance + 2e-3 * std::abs(dev_ref[i]))
+                ++dev_mismatches;
+    }
+
+    // 8-bit outputs are combined with fixed-point weights, see guided_solver_update
+    auto tolerance = (dtype == QNN_DATATYPE_UFIXED_POINT_8 ? 1e-3 : 1e-4);
+    check(max_x_diff <= tolerance, libsdod::format("{}, guidance {}: latent matches the separate passes, max relative difference: {}", name, guidance, max_x_diff));
+    if (guided)
+        check(max_prescaled_diff <= 1e-4, libsdod::format("{}, guidance {}: latent with a prescaled conditional prediction matches the separate passes, max relative difference: {}", name, guidance, max_prescaled_diff));
+    check(dev_mismatches == 0, libsdod::format("{}, guidance {}: converted latent matches the separate passes, mismatches: {}", name, guidance, dev_mismatches));
+}
+
+}
+
+
+int main() {
+    test_quantization_range<uint8_t>(QNN_DATATYPE_UFIXED_POINT_8, "ufixed8");
+    test_quantization_range<uint16_t>(QNN_DATATYPE_UFIXED_POINT_16, "ufixed16");
+
+    for (auto guidance : { 7.5f, 1.0f }) {
+        test_guided_solver_update(QNN_DATATYPE_UFIXED_POINT_8, "ufixed8", 8.0f / 255, -128, guidance);
+        test_guided_solver_update(QNN_DATATYPE_UFIXED_POINT_16, "ufixed16", 8.0f / 65535, -32768, guidance);
+        test_guided_solver_update(QNN_DATATYPE_FLOAT_16, "float16", 0.0f, 0, guidance);
+        test_guided_solver_update(QNN_DATATYPE_FLOAT_32, "float32", 0.0f, 0, guidance);
+    }
+
+    std::cout << (failures ? libsdod::format("{} check(s) failed", failures) : std::string("All checks passed")) << std::endl;
+    return failures ? 1 : 0;
+}
@@ -4,6 +4,10 @@
 #include <iostream>
 #include <string>
 #include <sstream>
+#include <vector>
+#include <random>
+#include <cmath>
+#include <algorithm>
 
 
 std::string format_long(std::vector<libsdod::DPMSolver::value_type> const& v) {
@@ -23,7 +27,120 @@ std::string format_long(std::vector<libsdod::DPMSolver::value_type> const& v) {
 
 
 
+unsigned int failures = 0;
+
+void check(bool ok, std::string const& what) {
+    std::cout << (ok ? "ok:     " : "FAILED: ") << what << std::endl;
+    if (!ok)
+        ++failures;
+}
+
+
+double max_relative_diff(std::vector<float> const& a, std::vector<float> const& b) {
+    double ret = 0.0;
+    for (auto i : libsdod::range(a.size()))
+        ret = std::max(ret, std::abs(double(a[i]) - b[i]) / (1.0 + std::abs(double(b[i]))));
+    return ret;
+}
+
+
+// update_fused (with and without an affine transformation of the model output) has to make the same steps as update;
+// the number of elements is not a multiple of update_fused's block
+void test_update_fused(unsigned int steps) {
+    std::size_t elements = 1000;
+    std::mt19937 gen{ steps };
+    std::normal_distribution<float> normal{ 0, 1 };
+
+    libsdod::DPMSolver reference(1000, 0.00085, 0.0120), fused(1000, 0.00085, 0.0120);
+    std::vector<float> ts;
+    reference.prepare(steps, ts);
+    fused.prepare(steps, ts);
+
+    std::vector<float> x_ref(elements), e(elements), raw(elements);
+    for (auto& f : x_ref)
+        f = normal(gen);
+    auto x = x_ref, x_affine = x_ref;
+    std::vector<float> history, history_affine, out(elements), out_affine(elements);
+    const float eps_scale = 0.25f, eps_bias = -0.5f;
+
+    double max_diff = 0.0, max_affine_diff = 0.0;
+    bool outputs_match = true;
+    for (auto step : libsdod::range(steps)) {
+        for (auto i : libsdod::range(elements)) {
+            e[i] = normal(gen);
+            raw[i] = (e[i] - eps_bias) / eps_scale;
+        }
+
+        fused.update_fused(step, x, history, [&e](std::size_t i) { return e[i]; }, [&out](std::size_t i, float value) { out[i] = value; });
+        fused.update_fused(step, x_affine, history_affine, [&raw](std::size_t i) { return raw[i]; }, eps_scale, eps_bias,
+            [&out_affine](std::size_t i, float value) { out_affine[i] = value; });
+        auto y = e;
+        reference.update(step, x_ref, y);
+
+        max_diff = std::max(max_diff, max_relative_diff(x, x_ref));
+        max_affine_diff = std::max(max_affine_diff, max_relative_diff(x_affine, x_ref));
+        outputs_match = outputs_match && out == x && out_affine == x_affine;
+    }
+
+    check(max_diff <= 1e-5, libsdod::format("{} steps: update_fused matches update, max relative difference: {}", steps, max_diff));
+    check(max_affine_diff <= 1e-4, libsdod::format("{} steps: update_fused with a scaled model output matches update, max relative difference: {}", steps, max_affine_diff));
+    check(outputs_match, libsdod::format("{} steps: update_fused passes the new latent to its callback", steps));
+}
+
+
+// estimated steps against the formulas: the data prediction is reused (y = y1) or extrapolated linearly in lambda
+// (y = (1 + r) * y1 - r * y0, r = (lambda[s] - lambda[s-1]) / (lambda[s-1] - lambda[s-2])), then the step is made as usual
+void test_update_estimated(unsigned int steps, unsigned int step) {
+    std::size_t elements = 100;
+    std::mt19937 gen{ step };
+    std::normal_distribution<float> normal{ 0, 1 };
+
+    libsdod::DPMSolver s(1000, 0.00085, 0.0120);
+    std::vector<float> ts;
+    s.prepare(steps, ts);
+
+    std::vector<float> x(elements), e(elements), history, prev_history;
+    for (auto& f : x)
+        f = normal(gen);
+    for (auto i : libsdod::range(step)) {
+        prev_history = history;
+        for (auto& f : e)
+            f = normal(gen);
+        s.update_fused(i, x, history, [&e](std::size_t j) { return e[j]; }, [](std::size_t, float) {});
+    }
+
+    auto&& c = s.get_coefficients(step);
+    auto&& lambdas = s.get_lambdas();
+    double r = (double(lambdas[step]) - lambdas[step-1]) / (double(lambdas[step-1]) - lambdas[step-2]);
+
+    for (bool extrapolate : { false, true }) {
+        std::vector<float> expected_x(elements), expected_y(elements);
+        for (auto i : libsdod::range(elements)) {
+            double y1 = history[i], y0 = prev_history[i];
+            double y = (extrapolate ? (1 + r) * y1 - r * y0 : y1);
+            expected_y[i] = float(y);
+            expected_x[i] = float(double(c.x_scale) * x[i] + double(c.y_scale) * y + double(c.prev_y_scale) * y1);
+        }
+
+        auto x_est = x, history_est = history;
+        std::vector<float> out(elements);
+        s.update_estimated(step, x_est, history_est, extrapolate ? prev_history : std::vector<float>{}, [&out](std::size_t i, float value) { out[i] = value; });
+
+        auto name = (extrapolate ? "extrapolated" : "reused");
+        auto x_diff = max_relative_diff(x_est, expected_x);
+        auto y_diff = max_relative_diff(history_est, expected_y);
+        check(x_diff <= 1e-5 && out == x_est, libsdod::format("step {} of {}, {} prediction: latent matches, max relative difference: {}", step, steps, name, x_diff));
+        check(y_diff <= 1e-5, libsdod::format("step {} of {}, {} prediction: history holds the estimated prediction, max relative difference: {}", step, steps, name, y_diff));
+    }
+}
+
+
 int main() {
+    for (auto steps : { 1u, 2u, 7u, 20u })
+        test_update_fused(steps);
+    for (auto step : { 2u, 5u, 12u })
+        test_update_estimated(20, step);
+
     libsdod::DPMSolver s(1000, 0.00085, 0.0120);
     std::cout << libsdod::format("all t: {}", format_long(s.get_all_t())) << std::endl;
     std::cout << libsdod::format("all log alpha: {}", format_long(s.get_all_log_alpha())) << std::endl;
@@ -49,5 +166,6 @@ int main() {
             s.update(i, x, y);
     }
 
-    return 0;
+    std::cout << (failures ? libsdod::format("{} check(s) failed", failures) : std::string("All checks passed")) << std::endl;
+    return failures ? 1 : 0;
 }
@@ -0,0 +1,124 @@
+#include "noise.h"
+#include "utils.h"
+
+#include <iostream>
+#include <string>
+#include <sstream>
+#include <vector>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+
+
+namespace {
+
+unsigned int failures = 0;
+
+void check(bool ok, std::string const& what) {
+    std::cout << (ok ? "ok:     " : "FAILED: ") << what << std::endl;
+    if (!ok)
+        ++failures;
+}
+
+
+// known-answer vectors of Philox4x32-10 published with Random123 (kat_vectors): counter, key, output
+struct PhiloxVector {
+    std::array<uint32_t, 4> counter;
+    std::array<uint32_t, 2> key;
+    std::array<uint32_t, 4> expected;
+};
+
+template <std::size_t N>
+std::string hex(std::array<uint32_t, N> const& words) {
+    std::ostringstream ss;
+    ss << std::hex;
+    for (auto w : words)
+        ss << w << " ";
+    auto&& ret = ss.str();
+    ret.pop_back();
+    return ret;
+}
+
+
+const std::vector<PhiloxVector> philox_vectors = {
+    { { 0x00000000, 0x00000000, 0x00000000, 0x00000000 }, { 0x00000000, 0x00000000 }, { 0x6627e8d5, 0xe169c58d, 0xbc57ac4c, 0x9b00dbd8 } },
+    { { 0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff }, { 0xffffffff, 0xffffffff }, { 0x408f276d, 0x41c83b0e, 0xa20bc7c6, 0x6d5451fd } },
+    { { 0x243f6a88, 0x85a308d3, 0x13198a2e, 0x03707344 }, { 0xa4093822, 0x299f31d0 }, { 0xd16cfe09, 0x94fdcceb, 0x5001e420, 0x24126ea1 } }
+};
+
+
+void test_philox_known_answers() {
+    for (auto&& v : philox_vectors) {
+        // the same counter in every lane, each of them has to produce the published output
+        uint32_t c0[libsdod::philox_lanes], c1[libsdod::philox_lanes], c2[libsdod::philox_lanes], c3[libsdod::philox_lanes];
+        for (std::size_t l = 0; l < libsdod::philox_lanes; ++l) {
+            c0[l] = v.counter[0];
+            c1[l] = v.counter[1];
+            c2[l] = v.counter[2];
+            c3[l] = v.counter[3];
+        }
+        libsdod::philox4x32(c0, c1, c2, c3, v.key[0], v.key[1]);
+
+        bool ok = true;
+        for (std::size_t l = 0; l < libsdod::philox_lanes; ++l)
+            ok = ok && c0[l] == v.expected[0] && c1[l] == v.expected[1] && c2[l] == v.expected[2] && c3[l] == v.expected[3];
+        check(ok, libsdod::format("philox4x32-10 of counter {}, key {} gives {}, got: {}",
+            hex(v.counter), hex(v.key), hex(v.expected), hex(std::array<uint32_t, 4>{ c0[0], c1[0], c2[0], c3[0] })));
+    }
+}
+
+
+// the same stream generated at once and in chunks of various sizes and offsets (including ones not aligned to blocks)
+void test_chunk_invariance() {
+    std::size_t elements = 4 * 64 * 64 + 3;
+    uint64_t seed = 0x123456789abcdefull, stream = 5;
+    std::vector<float> whole(elements);
+    libsdod::normal_noise(whole.data(), elements, seed, stream);
+
+    for (std::size_t chunk : { 1, 3, 4, 7, 63, 64, 65, 1000 }) {
+        std::vector<float> pieces(elements);
+        for (std::size_t first = 0; first < elements; first += chunk)
+            libsdod::normal_noise(pieces.data() + first, std::min(chunk, elements - first), seed, stream, first);
+        check(pieces == whole, libsdod::format("stream generated in chunks of {} is the same as generated at once", chunk));
+    }
+
+    // a single element far into the stream
+    float single = 0.0f;
+    libsdod::normal_noise(&single, 1, seed, stream, elements - 2);
+    check(single == whole[elements - 2], libsdod::format("element {} generated on its own is the same as within the stream", elements - 2));
+}
+
+
+void test_streams() {
+    std::size_t elements = 1 << 16;
+    std::vector<float> a(elements), b(elements), c(elements);
+    libsdod::normal_noise(a.data(), elements, 42, 0);
+    libsdod::normal_noise(b.data(), elements, 42, 1);
+    libsdod::normal_noise(c.data(), elements, 43, 0);
+    check(a != b && a != c, "different streams and seeds give different noise");
+
+    double sum = 0.0, sum_sq = 0.0;
+    bool finite = true;
+    for (auto f : a) {
+        finite = finite && std::isfinite(f);
+        sum += f;
+        sum_sq += double(f) * f;
+    }
+    auto mean = sum / elements;
+    auto var = sum_sq / elements - mean * mean;
+    check(finite, "all values are finite");
+    check(std::abs(mean) < 0.02 && std::abs(var - 1.0) < 0.03, libsdod::format("values are standard normal, mean: {}, variance: {}", mean, var));
+}
+
+}
+
+
+int main() {
+    test_philox_known_answers();
+    test_chunk_invariance();
+    test_streams();
+
+    std::cout << (failures ? libsdod::format("{} check(s) failed", failures) : std::string("All checks passed")) << std::endl;
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,131 @@
+#include "spsc_queue.h"
+#include "utils.h"
+
+#include <iostream>
+#include <string>
+#include <memory>
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include <cstdint>
+
+
+namespace {
+
+unsigned int failures = 0;
+
+void check(bool ok, std::string const& what) {
+    std::cout << (ok ? "ok:     " : "FAILED: ") << what << std::endl;
+    if (!ok)
+        ++failures;
+}
+
+
+void test_fifo_order() {
+    libsdod::SpscQueue<int> q{ 4 };
+    for (auto i : libsdod::range(4))
+        q.push(i);
+
+    bool ok = true;
+    for (auto i : libsdod::range(4))
+        ok = ok && q.pop() == i;
+    check(ok, "elements are popped in the order they were pushed");
+
+    // positions wrap around the slots
+    ok = true;
+    for (auto i : libsdod::range(10)) {
+        q.push(i);
+        q.push(i + 100);
+        ok = ok && q.pop() == i && q.pop() == i + 100;
+    }
+    check(ok, "order is kept when the positions wrap around");
+}
+
+
+void test_try_pop() {
+    libsdod::SpscQueue<std::unique_ptr<int>> q{ 2 };
+    std::unique_ptr<int> value;
+    check(!q.try_pop(value) && !value, "try_pop fails on an empty queue");
+
+    q.push(std::make_unique<int>(7));
+    check(q.try_pop(value) && value && *value == 7, "try_pop returns a queued element");
+    check(!q.try_pop(value), "try_pop fails once the queue has been emptied");
+
+    // nullptr is a regular element, used to mark the end of a stream
+    q.push(nullptr);
+    value = std::make_unique<int>(1);
+    check(q.try_pop(value) && !value, "try_pop returns a queued nullptr");
+}
+
+
+void test_capacity() {
+    check(libsdod::SpscQueue<int>{ 0 }.get_capacity() == 1, "capacity is at least 1");
+
+    libsdod::SpscQueue<int> q{ 2 };
+    q.push(1);
+    q.push(2);
+    check(q.get_max_depth() == 2 && q.get_mean_depth() == 1.5, libsdod::format("depth is tracked by the producer, max: {}, mean: {}", q.get_max_depth(), q.get_mean_depth()));
+
+    // the producer blocks on a full queue until the consumer makes room
+    std::atomic<bool> pushed = false;
+    auto&& producer = std::thread([&]() {
+        q.push(3);
+        pushed = true;
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    check(!pushed, "push blocks while the queue is full");
+    auto first = q.pop();
+    producer.join();
+    check(pushed && first == 1 && q.pop() == 2 && q.pop() == 3, "push continues once an element has been popped");
+
+    // and the consumer blocks on an empty queue until something is pushed
+    std::atomic<bool> popped = false;
+    int value = 0;
+    auto&& consumer = std::thread([&]() {
+        value = q.pop();
+        popped = true;
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    check(!popped, "pop blocks while the queue is empty");
+    q.push(4);
+    consumer.join();
+    check(popped && value == 4, "pop continues once an element has been pushed");
+}
+
+
+// a producer and a consumer running concurrently through a small queue, every element arrives exactly once and in order
+void test_concurrent() {
+    constexpr uint64_t count = 200000;
+    libsdod::SpscQueue<uint64_t> q{ 3 };
+
+    uint64_t sum = 0;
+    bool ordered = true;
+    auto&& consumer = std::thread([&]() {
+        uint64_t expected = 1;
+        while (auto value = q.pop()) {
+            ordered = ordered && value == expected;
+            sum += value;
+            ++expected;
+        }
+    });
+    for (uint64_t i = 1; i <= count; ++i)
+        q.push(i);
+    q.push(0);
+    consumer.join();
+
+    check(ordered && sum == count * (count + 1) / 2, libsdod::format("{} elements passed between threads in order, sum: {}", count, sum));
+    check(q.get_max_depth() <= q.get_capacity(), libsdod::format("depth never exceeds the capacity, max: {}", q.get_max_depth()));
+}
+
+}
+
+
+int main() {
+    test_fifo_order();
+    test_try_pop();
+    test_capacity();
+    test_concurrent();
+
+    std::cout << (failures ? libsdod::format("{} check(s) failed", failures) : std::string("All checks passed")) << std::endl;
+    return failures ? 1 : 0;
+}
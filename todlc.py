@@ -20,10 +20,16 @@ parser.add_argument('--ts', action='store_true', help='Convert via torchscript r
 parser.add_argument('--group_norm', action='store_true')
 parser.add_argument('--qnn', action='store_true', help='Convert to QNN .so model libraries instead of SNPE .dlc')
 parser.add_argument('--fp16', action='store_true')
+parser.add_argument('--encodings', type=str, default=None, help='Directory with activation encodings obtained by calibrating the models with libsdod (see libsdod_save_calibration and bench_generate --calibrate), ' \
+    'encodings for a part are read from <encodings>/<part_name>.encodings.json (or <part_name>.serialized.encodings.json), mapped from runtime tensor names to the names of the ONNX inputs/outputs ' \
+    'and passed to the converter as quantization overrides. Only used with --qnn when quantizing.')
+parser.add_argument('--act_bitwidth', type=int, default=8, choices=[8, 16], help='Bitwidth of quantized activations, should match --calibration_bitwidth used to obtain --encodings. Only used with --qnn when quantizing.')
 
 args = parser.parse_args()
 if args.fp16 and not args.qnn:
     raise ValueError('--fp16 is currently only supported for QNN')
+if (args.encodings or args.act_bitwidth != 8) and not args.qnn:
+    raise ValueError('--encodings and --act_bitwidth are currently only supported for QNN')
 
 debug = args.debug
 regex = args.regex
@@ -43,6 +49,49 @@ output_folder = Path(__file__).parent.joinpath('dlc')
 output_folder.mkdir(parents=True, exist_ok=True)
 
 
+def find_encodings(onnx_file):
+    if not args.encodings:
+        return None
+    for name in [onnx_file.stem, onnx_file.stem + '.serialized']:
+        candidate = Path(args.encodings).joinpath(name + '.encodings.json')
+        if candidate.exists():
+            return candidate
+    return None
+
+
+def qnn_tensor_name(name):
+    # same as the QNN converters: anything other than letters, digits and underscores is replaced, names cannot start with a digit
+    name = re.sub(r'\W', '_', name)
+    return name if name and (name[0].isalpha() or name[0] == '_') else '_' + name
+
+
+def translate_encodings(encodings, onnx_file, target):
+    # encodings saved by libsdod are keyed by runtime (QNN) tensor names, the converter expects the names used by the ONNX model
+    import json
+    import onnx
+    model = onnx.load(str(onnx_file), load_external_data=False)
+    source_names = {}
+    for tensor in list(model.graph.input) + list(model.graph.output):
+        source_names.setdefault(qnn_tensor_name(tensor.name), tensor.name)
+
+    with open(encodings) as f:
+        data = json.load(f)
+    translated = {}
+    for name, enc in data.get('activation_encodings', {}).items():
+        if name in source_names:
+            translated[source_names[name]] = enc
+        else:
+            print(f'Warning: calibrated tensor {name} from {encodings} does not match any input or output of {onnx_file}, skipping')
+    if not translated:
+        return None
+
+    data['activation_encodings'] = translated
+    output = target.with_suffix('.encodings.json')
+    with open(output, 'w') as f:
+        json.dump(data, f, indent=2)
+    return output
+
+
 def convert_onnx(onnx_file):
     part = onnx_file.relative_to(models_folder)
     ts_file = onnx_file.with_suffix('.pt')
@@ -105,7 +154,19 @@ def convert_onnx(onnx_file):
                 if args.fp16 or 'temb' in str(onnx_file):
                     cc.compile(source_file, model_type=source_type, output_file=target, quantize=False, halfs=True, for_host=False, generate_htp_context='sm8550', **extra_args)
                 else:
-                    cc.compile(source_file, model_type=source_type, output_file=target, quantize=8, generate_htp_context='sm8550', **extra_args)
+                    quant_args = dict(extra_args)
+                    quant_args['extra_tool_args'] = list(extra_args.get('extra_tool_args', []))
+                    if args.act_bitwidth != 8:
+                        quant_args['extra_tool_args'].extend(['--act_bw', str(args.act_bitwidth)])
+                    encodings = find_encodings(onnx_file)
+                    if encodings is not None:
+                        encodings = translate_encodings(encodings, onnx_file, target)
+                    if encodings is not None:
+                        print('Using calibrated activation encodings:', encodings)
+                        quant_args['extra_tool_args'].extend(['--quantization_overrides', str(encodings)])
+                    elif args.encodings:
+                        print('Warning: no calibrated encodings found, quantization will use default calibration data for part:', part)
+                    cc.compile(source_file, model_type=source_type, output_file=target, quantize=8, generate_htp_context='sm8550', **quant_args)
             else:
                 cc.quantize(int_target, precision=8, output_file=target)
         except Exception: